@@ -0,0 +1,37 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;
+    void (*setup)(void); // optional
+    void (*run)(void);
+    void (*teardown)(void); // optional
+    unsigned long max_allocs_per_op; // allocation budget. Lower it when an optimization removes allocations.
+} Benchmark;
+
+// Benchmarks of the full SDK publish path over the loopback transport. Defined in bench_e2e.cpp.
+// bench_e2e_init initializes and connects the SDK. It returns false on failure.
+bool bench_e2e_init(void);
+
+void bench_e2e_deinit(void);
+
+const Benchmark *bench_e2e_get_benchmarks(size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BENCH_H
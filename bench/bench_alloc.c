@@ -0,0 +1,89 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bench_alloc.h"
+
+// Each block is prefixed with a header that records its size. The header keeps the maximum alignment.
+typedef union {
+    size_t size;
+    long double align_ld;
+    long long align_ll;
+    void *align_p;
+} BlockHeader;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static BenchAllocStats stats;
+
+static void account_alloc(size_t size) {
+    stats.allocs++;
+    stats.live_bytes += size;
+    if (stats.live_bytes > stats.peak_bytes) {
+        stats.peak_bytes = stats.live_bytes;
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    BlockHeader *h = (BlockHeader *) __real_malloc(sizeof(BlockHeader) + size);
+    if (!h) {
+        return NULL;
+    }
+    h->size = size;
+    account_alloc(size);
+    return h + 1;
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *p = __wrap_malloc(num * size);
+    if (p) {
+        memset(p, 0, num * size);
+    }
+    return p;
+}
+
+void __wrap_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    BlockHeader *h = ((BlockHeader *) ptr) - 1;
+    stats.frees++;
+    stats.live_bytes -= h->size;
+    __real_free(h);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    BlockHeader *h = ((BlockHeader *) ptr) - 1;
+    size_t old_size = h->size;
+    BlockHeader *n = (BlockHeader *) __real_realloc(h, sizeof(BlockHeader) + size);
+    if (!n) {
+        return NULL;
+    }
+    n->size = size;
+    stats.live_bytes -= old_size;
+    account_alloc(size);
+    return n + 1;
+}
+
+void bench_alloc_reset(void) {
+    stats.allocs = 0;
+    stats.frees = 0;
+    stats.peak_bytes = stats.live_bytes;
+}
+
+void bench_alloc_get_stats(BenchAllocStats *s) {
+    *s = stats;
+}
@@ -0,0 +1,28 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Heap accounting for the host benchmarks.
+// malloc, calloc, realloc and free are wrapped at link time with -Wl,--wrap, so all heap calls
+// made by the SDK core and the benchmark are counted.
+
+#ifndef BENCH_ALLOC_H
+#define BENCH_ALLOC_H
+
+#include <stddef.h>
+
+typedef struct {
+    unsigned long allocs; // calls to malloc, calloc and realloc
+    unsigned long frees;
+    size_t live_bytes; // currently allocated bytes
+    size_t peak_bytes; // highest live_bytes since the last bench_alloc_reset()
+} BenchAllocStats;
+
+// Resets the call counters and sets the peak to the current live bytes.
+void bench_alloc_reset(void);
+
+void bench_alloc_get_stats(BenchAllocStats *stats);
+
+#endif // BENCH_ALLOC_H
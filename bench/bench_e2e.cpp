@@ -0,0 +1,190 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// End to end benchmarks: telemetry -> serialize -> iotconnect_sdk_send_packet -> MQTT publish,
+// through the SDK and the MQTT client, with the loopback transport in place of the network.
+
+#include <stdio.h>
+#include <string.h>
+#include "IoTConnectSDK.h"
+#include "iotc_transport_loopback.h"
+#include "bench.h"
+
+#define BENCH_TIME "2021-06-24T12:34:56.000Z"
+#define BENCH_CONTEXTS 64
+
+static IotcTransport transport;
+static IotcLoopbackTransport loopback;
+static volatile size_t sink;
+
+// device identities of a gateway, each with its own connection
+static IotConnectContext contexts[BENCH_CONTEXTS];
+static IotcTransport context_transports[BENCH_CONTEXTS];
+static IotcLoopbackTransport context_loopbacks[BENCH_CONTEXTS];
+static char context_duids[BENCH_CONTEXTS][16];
+static size_t next_context;
+
+static void bench_publish_dom(void) {
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    iotcl_telemetry_add_with_iso_time(msg, BENCH_TIME);
+    iotcl_telemetry_set_number(msg, "temperature", 23.45);
+    iotcl_telemetry_set_number(msg, "humidity", 48.2);
+    iotcl_telemetry_set_string(msg, "status", "ok");
+    iotcl_telemetry_set_bool(msg, "led", true);
+    iotcl_telemetry_set_number(msg, "accel.x", 0.012);
+    iotcl_telemetry_set_number(msg, "accel.y", -0.981);
+    iotcl_telemetry_set_number(msg, "accel.z", 0.103);
+    const char *str = iotcl_create_serialized_string(msg, false);
+    sink = (size_t) iotconnect_sdk_send_packet(str);
+    iotcl_destroy_serialized(str);
+    iotcl_telemetry_destroy(msg);
+}
+
+static void bench_publish_writer(void) {
+    char buffer[512];
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init(&w, buffer, sizeof(buffer));
+    iotcl_telemetry_writer_add_with_iso_time(&w, BENCH_TIME);
+    iotcl_telemetry_writer_set_number(&w, "temperature", 23.45);
+    iotcl_telemetry_writer_set_number(&w, "humidity", 48.2);
+    iotcl_telemetry_writer_set_string(&w, "status", "ok");
+    iotcl_telemetry_writer_set_bool(&w, "led", true);
+    iotcl_telemetry_writer_begin_object(&w, "accel");
+    iotcl_telemetry_writer_set_number(&w, "x", 0.012);
+    iotcl_telemetry_writer_set_number(&w, "y", -0.981);
+    iotcl_telemetry_writer_set_number(&w, "z", 0.103);
+    iotcl_telemetry_writer_end_object(&w);
+    iotcl_telemetry_writer_finish(&w);
+    sink = (size_t) iotconnect_sdk_send_packet(buffer);
+}
+
+// the writer serializes straight into the transmit buffer of the transport
+static void bench_publish_reserve(void) {
+    size_t size;
+    char *buffer = iotconnect_sdk_reserve_packet(&size);
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init(&w, buffer, size);
+    iotcl_telemetry_writer_add_with_iso_time(&w, BENCH_TIME);
+    iotcl_telemetry_writer_set_number(&w, "temperature", 23.45);
+    iotcl_telemetry_writer_set_number(&w, "humidity", 48.2);
+    iotcl_telemetry_writer_set_string(&w, "status", "ok");
+    iotcl_telemetry_writer_set_bool(&w, "led", true);
+    iotcl_telemetry_writer_begin_object(&w, "accel");
+    iotcl_telemetry_writer_set_number(&w, "x", 0.012);
+    iotcl_telemetry_writer_set_number(&w, "y", -0.981);
+    iotcl_telemetry_writer_set_number(&w, "z", 0.103);
+    iotcl_telemetry_writer_end_object(&w);
+    sink = (size_t) iotconnect_sdk_commit_packet(iotcl_telemetry_writer_finish(&w));
+}
+
+// a QoS 1 message is copied into the in-flight window until the PUBACK arrives with the next poll
+static void bench_publish_qos1(void) {
+    sink = (size_t) iotconnect_sdk_send_packet_qos("{\"d\":[{\"d\":{\"alert\":\"overheat\"}}]}", 1);
+    iotconnect_sdk_loop();
+}
+
+static void bench_loop_idle(void) {
+    iotconnect_sdk_loop();
+}
+
+// every context logs its discovery, sync and disconnect, which would bury the results table
+static void quiet_log_sink(int level, const char *line, size_t len, void *ctx) {
+    (void) level;
+    (void) line;
+    (void) len;
+    (void) ctx;
+}
+
+static void teardown_contexts(void) {
+    iotcl_log_set_sink(quiet_log_sink, NULL);
+    for (size_t i = 0; i < BENCH_CONTEXTS; i++) {
+        iotconnect_sdk_destroy_context(contexts[i]);
+        contexts[i] = NULL;
+        iotc_transport_loopback_deinit(&context_loopbacks[i]);
+    }
+    iotcl_log_flush(0);
+    iotcl_log_set_sink(NULL, NULL);
+}
+
+static void bench_publish_contexts(void);
+
+static void setup_contexts(void) {
+    iotcl_log_set_sink(quiet_log_sink, NULL);
+    for (size_t i = 0; i < BENCH_CONTEXTS; i++) {
+        memset(&context_loopbacks[i], 0, sizeof(context_loopbacks[i]));
+        iotc_transport_loopback_init(&context_transports[i], &context_loopbacks[i]);
+        snprintf(context_duids[i], sizeof(context_duids[i]), "bench-gw-%u", (unsigned int) i);
+        contexts[i] = iotconnect_sdk_create_context();
+        if (!contexts[i]) {
+            break;
+        }
+        IotConnectClientConfig *config = iotconnect_sdk_init_and_get_config_ctx(contexts[i]);
+        config->cpid = (char *) "BENCHCPID";
+        config->env = (char *) "bench";
+        config->duid = context_duids[i];
+        config->auth_info.type = IOTC_AT_TOKEN;
+        config->transport = &context_transports[i];
+        if (0 != iotconnect_sdk_init_ctx(contexts[i])) {
+            break;
+        }
+    }
+    // warm up every context, as each transport allocates its transmit buffer on first use
+    next_context = 0;
+    for (size_t i = 0; i < BENCH_CONTEXTS; i++) {
+        bench_publish_contexts();
+    }
+    iotcl_log_flush(0);
+    iotcl_log_set_sink(NULL, NULL);
+}
+
+// each iteration publishes for the next device, like a gateway forwarding the readings of its devices
+static void bench_publish_contexts(void) {
+    IotConnectContext ctx = contexts[next_context];
+    next_context = (next_context + 1) % BENCH_CONTEXTS;
+    size_t size;
+    char *buffer = iotconnect_sdk_reserve_packet_ctx(ctx, &size);
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init_ctx(iotconnect_sdk_get_lib_context(ctx), &w, buffer, size);
+    iotcl_telemetry_writer_add_with_iso_time(&w, BENCH_TIME);
+    iotcl_telemetry_writer_set_number(&w, "temperature", 23.45);
+    iotcl_telemetry_writer_set_number(&w, "humidity", 48.2);
+    sink = (size_t) iotconnect_sdk_commit_packet_ctx(ctx, iotcl_telemetry_writer_finish(&w));
+    iotconnect_sdk_loop_ctx(ctx);
+}
+
+static const Benchmark benchmarks[] = {
+        {"e2e_publish_dom", NULL, bench_publish_dom, NULL, 59},
+        {"e2e_publish_writer", NULL, bench_publish_writer, NULL, 0},
+        {"e2e_publish_reserve", NULL, bench_publish_reserve, NULL, 0},
+        {"e2e_publish_qos1", NULL, bench_publish_qos1, NULL, 1},
+        {"e2e_loop_idle", NULL, bench_loop_idle, NULL, 0},
+        {"e2e_publish_contexts", setup_contexts, bench_publish_contexts, teardown_contexts, 0},
+};
+
+bool bench_e2e_init(void) {
+    iotc_transport_loopback_init(&transport, &loopback);
+    IotConnectClientConfig *config = iotconnect_sdk_init_and_get_config();
+    config->cpid = (char *) "BENCHCPID";
+    config->env = (char *) "bench";
+    config->duid = (char *) "bench-device";
+    config->auth_info.type = IOTC_AT_TOKEN;
+    config->transport = &transport;
+    if (0 != iotconnect_sdk_init() || !iotconnect_sdk_is_connected()) {
+        return false;
+    }
+    return true;
+}
+
+void bench_e2e_deinit(void) {
+    printf("loopback: %lu messages published, %lu bytes\n", loopback.stats.published, loopback.stats.published_bytes);
+    iotconnect_sdk_disconnect();
+    iotc_transport_loopback_deinit(&loopback);
+}
+
+const Benchmark *bench_e2e_get_benchmarks(size_t *count) {
+    *count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    return benchmarks;
+}
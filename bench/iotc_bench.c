@@ -0,0 +1,471 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Benchmarks for the portable SDK core. For each operation, reports the time per operation,
+// heap allocations per operation and the peak heap used by the operation.
+//
+// Usage: iotc_bench [--quick] [--mem] [--iterations N] [name filter]
+// --quick runs a fixed small number of iterations, which is enough to check the allocation budgets.
+// --mem reports the heap used by each operation per SDK subsystem, as counted by iotconnect_mem.
+// The exit code is non-zero if any benchmark exceeded its allocation budget.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotconnect_common.h"
+#include "iotconnect_lib.h"
+#include "iotconnect_discovery.h"
+#include "iotconnect_arena.h"
+#include "iotconnect_mem.h"
+#include "iotconnect_log.h"
+#include "iotc_command_router.h"
+#include "bench_alloc.h"
+#include "bench.h"
+
+#define TARGET_RUN_NS 300000000ULL // 0.3 seconds per benchmark
+#define QUICK_ITERATIONS 1000
+
+#define BENCH_TIME "2021-06-24T12:34:56.000Z"
+
+#define COMMAND_EVENT_JSON \
+    "{\"cmdType\":\"0x01\",\"data\":{\"cpid\":\"BENCHCPID\",\"guid\":\"a1b2c3d4-e5f6-4789-abcd-0123456789ab\"," \
+    "\"uniqueId\":\"bench-device\",\"command\":\"set-led-frequency 100\",\"ack\":true," \
+    "\"ackId\":\"6c1d5a66-7ae6-4f77-8d2b-ee3fd29c4b21\",\"cmdType\":\"0x01\"}}"
+
+#define SYNC_RESPONSE_JSON \
+    "{\"d\":{\"ec\":0,\"ct\":200,\"sc\":{\"hb\":{\"fq\":60,\"h\":\"\",\"un\":\"\",\"pwd\":\"\",\"pub\":\"\"}," \
+    "\"log\":{\"h\":\"\",\"un\":\"\",\"pwd\":\"\",\"pub\":\"\"},\"sf\":0,\"df\":60}," \
+    "\"p\":{\"n\":\"mqtt\",\"h\":\"poc-iotconnect-iothub-eu.azure-devices.net\",\"p\":8883," \
+    "\"id\":\"BENCHCPID-bench-device\",\"un\":\"poc-iotconnect-iothub-eu.azure-devices.net/BENCHCPID-bench-device/?api-version=2018-06-30\"," \
+    "\"pwd\":\"SharedAccessSignature sr=poc-iotconnect-iothub-eu.azure-devices.net%2Fdevices%2FBENCHCPID-bench-device&sig=abcdefghijklmnopqrstuvwxyz0123456789%3D&se=1656070000\"," \
+    "\"pub\":\"devices/BENCHCPID-bench-device/messages/events/\",\"sub\":\"devices/BENCHCPID-bench-device/messages/devicebound/#\"}," \
+    "\"d\":null,\"att\":[],\"set\":[],\"r\":null,\"ota\":null,\"dtg\":\"5a913fef-428b-4a41-9927-6e0f4a1602ba\"," \
+    "\"cpId\":\"BENCHCPID\",\"rc\":0,\"ee\":0,\"at\":1,\"ds\":0}}"
+
+static const IotclTelemetryAttribute schema[] = {
+        {"temperature", IOTCL_ATTR_NUMBER, 2},
+        {"humidity", IOTCL_ATTR_NUMBER, 1},
+        {"status", IOTCL_ATTR_STRING, 0},
+        {"led", IOTCL_ATTR_BOOL, 0},
+        {"accel.x", IOTCL_ATTR_NUMBER, 3},
+        {"accel.y", IOTCL_ATTR_NUMBER, 3},
+        {"accel.z", IOTCL_ATTR_NUMBER, 3},
+};
+#define SCHEMA_SIZE (sizeof(schema) / sizeof(schema[0]))
+
+#define BENCH_ARENA_SIZE 2048
+
+static IotclConfig lib_config;
+static bool mem_report = false;
+static IotclMessageHandle prepared_message = NULL;
+static char out_buffer[2048];
+static volatile size_t sink; // keeps results alive so that the compiler cannot drop the work
+
+/////////////////////////////////////////////////////////
+// telemetry
+
+static void add_sample(IotclMessageHandle msg) {
+    iotcl_telemetry_add_with_iso_time(msg, BENCH_TIME);
+    iotcl_telemetry_set_number(msg, "temperature", 23.45);
+    iotcl_telemetry_set_number(msg, "humidity", 48.2);
+    iotcl_telemetry_set_string(msg, "status", "ok");
+    iotcl_telemetry_set_bool(msg, "led", true);
+    iotcl_telemetry_set_number(msg, "accel.x", 0.012);
+    iotcl_telemetry_set_number(msg, "accel.y", -0.981);
+    iotcl_telemetry_set_number(msg, "accel.z", 0.103);
+}
+
+static void bench_telemetry_create(void) {
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    add_sample(msg);
+    iotcl_telemetry_destroy(msg);
+}
+
+// re-initializes the library with telemetry arenas enabled
+static void setup_arena(void) {
+    lib_config.telemetry.arena_size = BENCH_ARENA_SIZE;
+    iotcl_init(&lib_config);
+}
+
+static void teardown_arena(void) {
+    IotclArenaStats stats;
+    iotcl_arena_get_stats(&stats);
+    printf("arena: %lu arenas, %lu extra blocks, %zu bytes peak use\n", stats.arenas, stats.extra_blocks, stats.peak_used);
+    lib_config.telemetry.arena_size = 0;
+    iotcl_init(&lib_config);
+}
+
+static void setup_prepared_message(void) {
+    prepared_message = iotcl_telemetry_create();
+    add_sample(prepared_message);
+}
+
+static void teardown_prepared_message(void) {
+    iotcl_telemetry_destroy(prepared_message);
+    prepared_message = NULL;
+}
+
+static void bench_telemetry_serialize(void) {
+    const char *str = iotcl_create_serialized_string(prepared_message, false);
+    sink = strlen(str);
+    iotcl_destroy_serialized(str);
+}
+
+static void bench_telemetry_serialize_into(void) {
+    sink = iotcl_telemetry_serialize_into(prepared_message, out_buffer, sizeof(out_buffer), false);
+}
+
+static void bench_telemetry_writer(void) {
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init(&w, out_buffer, sizeof(out_buffer));
+    iotcl_telemetry_writer_add_with_iso_time(&w, BENCH_TIME);
+    iotcl_telemetry_writer_set_number(&w, "temperature", 23.45);
+    iotcl_telemetry_writer_set_number(&w, "humidity", 48.2);
+    iotcl_telemetry_writer_set_string(&w, "status", "ok");
+    iotcl_telemetry_writer_set_bool(&w, "led", true);
+    iotcl_telemetry_writer_begin_object(&w, "accel");
+    iotcl_telemetry_writer_set_number(&w, "x", 0.012);
+    iotcl_telemetry_writer_set_number(&w, "y", -0.981);
+    iotcl_telemetry_writer_set_number(&w, "z", 0.103);
+    iotcl_telemetry_writer_end_object(&w);
+    sink = iotcl_telemetry_writer_finish(&w);
+}
+
+static void bench_telemetry_schema(void) {
+    IotclTelemetryValue values[SCHEMA_SIZE];
+    memset(values, 0, sizeof(values));
+    values[0].v.number = 23.45;
+    values[1].v.number = 48.2;
+    values[2].v.string = "ok";
+    values[3].v.boolean = true;
+    values[4].v.number = 0.012;
+    values[5].v.number = -0.981;
+    values[6].v.number = 0.103;
+    sink = iotcl_telemetry_render_schema(values, SCHEMA_SIZE, BENCH_TIME, out_buffer, sizeof(out_buffer));
+}
+
+static void bench_number_format(void) {
+    char buf[IOTCL_NUMBER_BUFFER_SIZE];
+    sink = iotcl_format_number(buf, -0.981);
+}
+
+/////////////////////////////////////////////////////////
+// events and acks
+
+static void on_command(IotclEventData data) {
+    iotcl_destroy_event(data);
+}
+
+static void on_command_ack(IotclEventData data) {
+    const char *ack = iotcl_create_ack_string_and_destroy_event(data, true, "done");
+    sink = strlen(ack);
+    free((void *) ack);
+}
+
+static void on_command_ack_into(IotclEventData data) {
+    sink = iotcl_create_ack_into(out_buffer, sizeof(out_buffer), data, true, "done");
+    iotcl_destroy_event(data);
+}
+
+static void bench_event_parse(void) {
+    iotcl_get_config()->event_functions.cmd_cb = on_command;
+    iotcl_process_event(COMMAND_EVENT_JSON);
+}
+
+static void bench_event_parse_with_length(void) {
+    iotcl_get_config()->event_functions.cmd_cb = on_command;
+    iotcl_process_event_with_length(COMMAND_EVENT_JSON, sizeof(COMMAND_EVENT_JSON) - 1);
+}
+
+static void bench_event_parse_and_ack(void) {
+    iotcl_get_config()->event_functions.cmd_cb = on_command_ack;
+    iotcl_process_event(COMMAND_EVENT_JSON);
+}
+
+static void bench_event_parse_and_ack_into(void) {
+    iotcl_get_config()->event_functions.cmd_cb = on_command_ack_into;
+    iotcl_process_event(COMMAND_EVENT_JSON);
+}
+
+static void bench_ack_create(void) {
+    char *ack = iotcl_create_ota_ack_response("6c1d5a66-7ae6-4f77-8d2b-ee3fd29c4b21", true, "done");
+    sink = strlen(ack);
+    free(ack);
+}
+
+static void bench_ack_create_into(void) {
+    sink = iotcl_create_ota_ack_into(out_buffer, sizeof(out_buffer), "6c1d5a66-7ae6-4f77-8d2b-ee3fd29c4b21", true, "done");
+}
+
+/////////////////////////////////////////////////////////
+// command routing
+
+static IotcCommandRouter router;
+
+static bool on_routed_command(const IotcCommandArgs *args, const char **message, void *user_data) {
+    (void) message;
+    (void) user_data;
+    sink = args->count;
+    return true;
+}
+
+static const IotcCommandRoute routes[] = {
+        {"led-on", on_routed_command, NULL},
+        {"led-off", on_routed_command, NULL},
+        {"set-led-frequency", on_routed_command, NULL},
+        {"reboot", on_routed_command, NULL},
+        {"set-interval", on_routed_command, NULL},
+        {"get-status", on_routed_command, NULL},
+};
+
+static void setup_router(void) {
+    iotc_command_router_init(&router, routes, sizeof(routes) / sizeof(routes[0]));
+}
+
+static void teardown_router(void) {
+    iotc_command_router_deinit(&router);
+}
+
+static void bench_command_route(void) {
+    const char *message;
+    sink = iotc_command_router_execute(&router, "set-led-frequency 100", &message);
+}
+
+/////////////////////////////////////////////////////////
+// timestamps
+
+static IotclClock bench_clock;
+static unsigned long bench_clock_ms;
+
+static void setup_clock(void) {
+    memset(&bench_clock, 0, sizeof(bench_clock));
+    bench_clock_ms = 0;
+    iotcl_clock_sync(&bench_clock, iotcl_utc_ms_now(), bench_clock_ms);
+}
+
+static void bench_timestamp_now(void) {
+    sink = iotcl_iso_timestamp_now_into(out_buffer);
+}
+
+// Per-sample stamping from a millisecond counter, with the date cached
+static void bench_timestamp_clock(void) {
+    bench_clock_ms += 7;
+    sink = iotcl_clock_timestamp(&bench_clock, bench_clock_ms, out_buffer);
+}
+
+/////////////////////////////////////////////////////////
+// logging
+
+static void null_log_sink(int level, const char *line, size_t len, void *ctx) {
+    (void) level;
+    (void) line;
+    (void) ctx;
+    sink = len;
+}
+
+static void setup_log(void) {
+    iotcl_log_set_sink(null_log_sink, NULL);
+}
+
+static void teardown_log(void) {
+    iotcl_log_set_sink(NULL, NULL);
+}
+
+// A truncated payload dump, like the one for inbound events, queued and then written out
+static void bench_log_payload(void) {
+    const size_t len = sizeof(COMMAND_EVENT_JSON) - 1;
+    iotcl_log(IOTCL_LOG_LEVEL_INFO, "event>>> %.*s%s", IOTCL_LOG_PAYLOAD(len), COMMAND_EVENT_JSON,
+              len > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? "..." : "");
+    iotcl_log_flush(1);
+}
+
+/////////////////////////////////////////////////////////
+// discovery and sync
+
+static void bench_sync_parse(void) {
+    IotclSyncResponse *sr = iotcl_discovery_parse_sync_response(SYNC_RESPONSE_JSON);
+    sink = (size_t) sr->ds;
+    iotcl_discovery_free_sync_response(sr);
+}
+
+static void bench_discovery_parse(void) {
+    IotclDiscoveryResponse *dr = iotcl_discovery_parse_discovery_response(
+            "{\"baseUrl\":\"https://discovery.iotconnect.io/api/2.0/agent/bench\",\"log:\":{\"hb\":{},\"log\":{}}}");
+    sink = strlen(dr->host);
+    iotcl_discovery_free_discovery_response(dr);
+}
+
+static const Benchmark benchmarks[] = {
+        {"telemetry_create", NULL, bench_telemetry_create, NULL, 56},
+        {"telemetry_create_arena", setup_arena, bench_telemetry_create, teardown_arena, 1},
+        {"telemetry_serialize", setup_prepared_message, bench_telemetry_serialize, teardown_prepared_message, 3},
+        {"telemetry_serialize_into", setup_prepared_message, bench_telemetry_serialize_into, teardown_prepared_message, 0},
+        {"telemetry_writer", NULL, bench_telemetry_writer, NULL, 0},
+        {"telemetry_schema", NULL, bench_telemetry_schema, NULL, 0},
+        {"number_format", NULL, bench_number_format, NULL, 0},
+        {"event_parse", NULL, bench_event_parse, NULL, 1},
+        {"event_parse_with_length", NULL, bench_event_parse_with_length, NULL, 1},
+        {"event_parse_and_ack", NULL, bench_event_parse_and_ack, NULL, 2},
+        {"event_parse_and_ack_into", NULL, bench_event_parse_and_ack_into, NULL, 1},
+        {"ack_create", NULL, bench_ack_create, NULL, 1},
+        {"ack_create_into", NULL, bench_ack_create_into, NULL, 0},
+        {"command_route", setup_router, bench_command_route, teardown_router, 0},
+        {"timestamp_now", NULL, bench_timestamp_now, NULL, 0},
+        {"timestamp_clock", setup_clock, bench_timestamp_clock, NULL, 0},
+        {"log_payload", setup_log, bench_log_payload, teardown_log, 0},
+        {"sync_parse", NULL, bench_sync_parse, NULL, 102},
+        {"discovery_parse", NULL, bench_discovery_parse, NULL, 15},
+};
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static unsigned long long time_iterations(const Benchmark *b, unsigned long iterations) {
+    unsigned long long start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        b->run();
+    }
+    return now_ns() - start;
+}
+
+// Prints the subsystems that allocated during one operation
+static void print_mem_report(const IotclMemStats *before, const IotclMemStats *after) {
+    for (int i = 0; i < IOTCL_MEM_NUM_SUBSYSTEMS; i++) {
+        const IotclMemUsage *b = &before->subsystems[i];
+        const IotclMemUsage *a = &after->subsystems[i];
+        if (a->allocs == b->allocs) {
+            continue;
+        }
+        printf("    %-24s %10lu allocs %8zu peak bytes %8zu largest %+8ld held\n",
+               iotcl_mem_subsystem_name((IotclMemSubsystem) i),
+               a->allocs - b->allocs,
+               a->peak_bytes - b->current_bytes,
+               a->largest,
+               (long) a->current_bytes - (long) b->current_bytes
+        );
+    }
+}
+
+// Returns false if the benchmark exceeded its allocation budget.
+static bool run_benchmark(const Benchmark *b, unsigned long iterations) {
+    BenchAllocStats s;
+
+    if (b->setup) b->setup();
+    b->run(); // warm up lazily initialized state
+
+    // measure heap usage in a separate pass, so that the accounting is exact
+    IotclMemStats mem_before;
+    IotclMemStats mem_after;
+    iotcl_mem_reset_peaks();
+    iotcl_mem_get_stats(&mem_before);
+    bench_alloc_reset();
+    size_t baseline = 0;
+    bench_alloc_get_stats(&s);
+    baseline = s.live_bytes;
+    b->run();
+    bench_alloc_get_stats(&s);
+    iotcl_mem_get_stats(&mem_after);
+    unsigned long allocs = s.allocs;
+    size_t peak = s.peak_bytes - baseline;
+
+    if (0 == iterations) {
+        // calibrate to run for about TARGET_RUN_NS
+        unsigned long n = 1;
+        unsigned long long elapsed;
+        while ((elapsed = time_iterations(b, n)) < TARGET_RUN_NS / 10 && n < (1UL << 30)) {
+            n *= 2;
+        }
+        iterations = (unsigned long) ((double) n * TARGET_RUN_NS / (double) (elapsed ? elapsed : 1));
+        if (iterations < n) iterations = n;
+    }
+
+    unsigned long long elapsed = time_iterations(b, iterations);
+    if (b->teardown) b->teardown();
+
+    bool ok = allocs <= b->max_allocs_per_op;
+    printf("%-28s %12.1f %10lu %10zu %10lu%s\n",
+           b->name,
+           (double) elapsed / (double) iterations,
+           allocs,
+           peak,
+           iterations,
+           ok ? "" : "  OVER BUDGET"
+    );
+    if (mem_report) {
+        print_mem_report(&mem_before, &mem_after);
+    }
+    return ok;
+}
+
+static void print_header(void) {
+    printf("%-28s %12s %10s %10s %10s\n", "benchmark", "ns/op", "allocs/op", "peak heap", "iterations");
+}
+
+// Returns the number of benchmarks that exceeded their allocation budget.
+static int run_benchmarks(const Benchmark *list, size_t count, unsigned long iterations, const char *filter) {
+    int failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (filter && !strstr(list[i].name, filter)) {
+            continue;
+        }
+        if (!run_benchmark(&list[i], iterations)) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long iterations = 0; // calibrate
+    const char *filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--quick")) {
+            iterations = QUICK_ITERATIONS;
+        } else if (0 == strcmp(argv[i], "--mem")) {
+            mem_report = true;
+        } else if (0 == strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = strtoul(argv[++i], NULL, 10);
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    // the SDK initializes the library for the end to end benchmarks, so run those first
+    int failures = 0;
+    if (!bench_e2e_init()) {
+        fprintf(stderr, "Failed to initialize the SDK with the loopback transport\n");
+        return 2;
+    }
+    size_t num_e2e;
+    const Benchmark *e2e = bench_e2e_get_benchmarks(&num_e2e);
+    print_header();
+    failures += run_benchmarks(e2e, num_e2e, iterations, filter);
+    bench_e2e_deinit();
+
+    memset(&lib_config, 0, sizeof(lib_config));
+    lib_config.device.cpid = "BENCHCPID";
+    lib_config.device.duid = "bench-device";
+    lib_config.device.env = "bench";
+    lib_config.telemetry.dtg = "5a913fef-428b-4a41-9927-6e0f4a1602ba";
+    lib_config.telemetry.schema = schema;
+    lib_config.telemetry.schema_size = SCHEMA_SIZE;
+    if (!iotcl_init(&lib_config)) {
+        fprintf(stderr, "Failed to initialize the library\n");
+        return 2;
+    }
+    failures += run_benchmarks(benchmarks, sizeof(benchmarks) / sizeof(benchmarks[0]), iterations, filter);
+
+    iotcl_deinit();
+    if (failures) {
+        printf("%d benchmark(s) exceeded the allocation budget\n", failures);
+        return 1;
+    }
+    return 0;
+}
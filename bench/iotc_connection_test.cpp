@@ -0,0 +1,209 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Checks the connection state machine of the SDK over the loopback transport:
+// a lost connection is retried, a disconnect requested by the cloud leaves the SDK idle
+// until the application initializes it again, and reconnects that keep failing with cached
+// broker information fall back to discovery and sync.
+//
+// Usage: iotc_connection_test
+// The exit code is non-zero if any check failed.
+// iotc_transport_millis is wrapped, so that reconnect backoff delays pass without waiting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "IoTConnectSDK.h"
+#include "iotc_transport_loopback.h"
+#include "iotconnect_log.h"
+
+#define ON_CLOSE_EVENT "{\"cmdType\":\"0x99\",\"data\":{\"ackId\":\"close\"}}"
+
+// longer than the max reconnect backoff
+#define LOOP_INTERVAL_MS 120000UL
+
+static IotcTransport transport;
+static IotcLoopbackTransport loopback;
+static int failures = 0;
+static unsigned long now_ms = 0;
+static char *persisted = NULL;
+
+extern "C" unsigned long __wrap_iotc_transport_millis(void) {
+    return now_ms;
+}
+
+static char *persistence_load(void *ctx) {
+    (void) ctx;
+    return persisted ? strdup(persisted) : NULL;
+}
+
+static void persistence_save(void *ctx, const char *data) {
+    (void) ctx;
+    free(persisted);
+    persisted = data ? strdup(data) : NULL;
+}
+
+static IotConnectPersistence persistence = {NULL, persistence_load, persistence_save};
+
+static const char *state_name(IotConnectConnectionState state) {
+    switch (state) {
+        case IOTC_CONN_STATE_IDLE:
+            return "IDLE";
+        case IOTC_CONN_STATE_CONNECTED:
+            return "CONNECTED";
+        case IOTC_CONN_STATE_BACKOFF:
+            return "BACKOFF";
+        default:
+            return "unknown";
+    }
+}
+
+static void check_state(const char *name, IotConnectConnectionState state, IotConnectConnectionState expected) {
+    if (state != expected) {
+        printf("FAIL %s: state is %s, expected %s\n", name, state_name(state), state_name(expected));
+        failures++;
+    }
+}
+
+static void check_number(const char *name, const char *what, unsigned long expected, unsigned long actual) {
+    if (expected != actual) {
+        printf("FAIL %s: %s is %lu, expected %lu\n", name, what, actual, expected);
+        failures++;
+    }
+}
+
+static void quiet_log_sink(int level, const char *line, size_t len, void *ctx) {
+    (void) level;
+    (void) line;
+    (void) len;
+    (void) ctx;
+}
+
+static void configure(IotConnectClientConfig *config) {
+    config->cpid = (char *) "TESTCPID";
+    config->env = (char *) "test";
+    config->duid = (char *) "test-device";
+    config->auth_info.type = IOTC_AT_TOKEN;
+    config->transport = &transport;
+}
+
+static bool init_sdk(void) {
+    configure(iotconnect_sdk_init_and_get_config());
+    return 0 == iotconnect_sdk_init();
+}
+
+static IotConnectContext init_cached_context(void) {
+    IotConnectContext ctx = iotconnect_sdk_create_context();
+    if (!ctx) {
+        return NULL;
+    }
+    IotConnectClientConfig *config = iotconnect_sdk_init_and_get_config_ctx(ctx);
+    configure(config);
+    config->persistence = &persistence;
+    if (0 != iotconnect_sdk_init_ctx(ctx)) {
+        iotconnect_sdk_destroy_context(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void loop_ctx(IotConnectContext ctx, int times) {
+    for (int i = 0; i < times; i++) {
+        now_ms += LOOP_INTERVAL_MS;
+        iotconnect_sdk_loop_ctx(ctx);
+    }
+}
+
+static void check_connection_lost(void) {
+    const char *name = "connection lost";
+    if (!init_sdk()) {
+        printf("FAIL %s: iotconnect_sdk_init()\n", name);
+        failures++;
+        return;
+    }
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_CONNECTED);
+    loopback.connected = false;
+    iotconnect_sdk_loop();
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_BACKOFF);
+    iotconnect_sdk_disconnect();
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_IDLE);
+}
+
+// ON_CLOSE disconnects from inside the poll of the transport, which then reports the connection as down
+static void check_on_close(void) {
+    const char *name = "ON_CLOSE";
+    if (!init_sdk()) {
+        printf("FAIL %s: iotconnect_sdk_init()\n", name);
+        failures++;
+        return;
+    }
+    unsigned long connects = loopback.stats.connects;
+    iotc_transport_loopback_inject(&loopback, ON_CLOSE_EVENT);
+    iotconnect_sdk_loop();
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_IDLE);
+    check_number(name, "delivered", 1, loopback.stats.delivered);
+    for (int i = 0; i < 3; i++) {
+        iotconnect_sdk_loop();
+    }
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_IDLE);
+    check_number(name, "connects after close", connects, loopback.stats.connects);
+
+    if (!init_sdk()) {
+        printf("FAIL %s: iotconnect_sdk_init() after close\n", name);
+        failures++;
+        return;
+    }
+    check_state(name, iotconnect_sdk_get_connection_state(), IOTC_CONN_STATE_CONNECTED);
+    iotconnect_sdk_disconnect();
+}
+
+// The broker stops taking the cached credentials while the device is running from the cache
+static void check_cached_reconnect(void) {
+    const char *name = "cached reconnect";
+    IotConnectContext ctx = init_cached_context(); // runs discovery and sync, and caches the responses
+    iotconnect_sdk_destroy_context(ctx);
+    unsigned long http_requests = loopback.stats.http_requests;
+    ctx = init_cached_context();
+    if (!ctx || !persisted) {
+        printf("FAIL %s: iotconnect_sdk_init_ctx()\n", name);
+        failures++;
+        iotconnect_sdk_destroy_context(ctx);
+        return;
+    }
+    check_number(name, "HTTP requests with the cache", http_requests, loopback.stats.http_requests);
+    check_state(name, iotconnect_sdk_get_connection_state_ctx(ctx), IOTC_CONN_STATE_CONNECTED);
+
+    loopback.connected = false;
+    loopback.fail_connects = 100;
+    loop_ctx(ctx, 3); // the connection is lost, and two reconnects fail
+    check_number(name, "HTTP requests after two failed reconnects", http_requests, loopback.stats.http_requests);
+    loop_ctx(ctx, 1);
+    check_number(name, "HTTP requests after three failed reconnects", http_requests + 2, loopback.stats.http_requests);
+    check_state(name, iotconnect_sdk_get_connection_state_ctx(ctx), IOTC_CONN_STATE_BACKOFF);
+
+    // fresh responses are not refreshed again, however long the outage lasts
+    loop_ctx(ctx, 5);
+    check_number(name, "HTTP requests with fresh responses", http_requests + 2, loopback.stats.http_requests);
+    loopback.fail_connects = 0;
+    loop_ctx(ctx, 1);
+    check_state(name, iotconnect_sdk_get_connection_state_ctx(ctx), IOTC_CONN_STATE_CONNECTED);
+    iotconnect_sdk_destroy_context(ctx);
+    free(persisted);
+    persisted = NULL;
+}
+
+int main(void) {
+    iotcl_log_set_sink(quiet_log_sink, NULL);
+    iotc_transport_loopback_init(&transport, &loopback);
+    check_connection_lost();
+    check_on_close();
+    check_cached_reconnect();
+    iotc_transport_loopback_deinit(&loopback);
+    iotcl_log_flush(0);
+    iotcl_log_set_sink(NULL, NULL);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
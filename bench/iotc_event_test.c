@@ -0,0 +1,337 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Checks that the event decoder extracts the same fields as the original cJSON based implementation,
+// and that the acks are byte-identical to what that implementation printed with cJSON.
+// The expected values were taken from the cJSON based implementation with the same corpus.
+//
+// Usage: iotc_event_test
+// The exit code is non-zero if any check failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+#include "iotconnect_common.h"
+#include "iotconnect_lib.h"
+#include "iotconnect_event.h"
+
+#define MAX_URLS 24
+#define MAX_TEST_DEPTH 1001
+
+#define DEVICE_CPID "TEST\"CPID"
+#define DEVICE_DUID "test\\device"
+#define DEVICE_ENV "env\n"
+
+#define DATA_PREFIX "{\"cmdType\":\"0x01\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\","
+
+typedef struct {
+    const char *name;
+    const char *json;
+    bool accepted;
+    const char *command;
+    const char *ack_id;
+    const char *sw_version;
+    const char *hw_version;
+    size_t num_urls;
+    const char *urls[MAX_URLS]; // NULL for elements that are not usable URLs
+} EventCase;
+
+static const EventCase cases[] = {
+        {
+                "command",
+                DATA_PREFIX "\"command\":\"led on\",\"ackId\":\"a1\"}}",
+                true, "led on", "a1"
+        },
+        {
+                "escapes",
+                DATA_PREFIX "\"command\":\"a\\u00e9\\u4E2D\\/\\n\\t\\\"\\\\\",\"ackId\":\"\\u0041\\u00ff\"}}",
+                true, "a\xc3\xa9\xe4\xb8\xad/\n\t\"\\", "A\xc3\xbf"
+        },
+        {
+                "surrogate pair",
+                DATA_PREFIX "\"command\":\"\\ud83d\\ude00!\",\"ackId\":\"a\"}}",
+                true, "\xf0\x9f\x98\x80!", "a"
+        },
+        {
+                "lone low surrogate",
+                DATA_PREFIX "\"command\":\"x\\udc00\",\"ackId\":\"a\"}}",
+                false
+        },
+        {
+                "high surrogate without low surrogate",
+                DATA_PREFIX "\"command\":\"x\\ud83dy\",\"ackId\":\"a\"}}",
+                false
+        },
+        {
+                "invalid hex digits decode as zero",
+                DATA_PREFIX "\"command\":\"x\\u00zzy\",\"ackId\":\"a\"}}",
+                true, "x", "a"
+        },
+        {
+                "escaped null",
+                DATA_PREFIX "\"command\":\"ab\\u0000cd\",\"ackId\":\"a\"}}",
+                true, "ab", "a"
+        },
+        {
+                "invalid escape",
+                DATA_PREFIX "\"ackId\":\"a\\q\"}}",
+                false
+        },
+        {
+                "duplicate keys",
+                "{\"cmdType\":\"0x01\",\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\","
+                "\"command\":\"first\",\"command\":\"second\",\"ackId\":\"a1\",\"ackId\":\"a2\"},"
+                "\"data\":{\"command\":\"other\",\"ackId\":\"a3\"}}",
+                true, "first", "a1"
+        },
+        {
+                "duplicate key after a non-string value",
+                DATA_PREFIX "\"ackId\":5,\"ackId\":\"a\"}}",
+                false
+        },
+        {
+                "mixed case cpid",
+                "{\"cmdType\":\"0x01\",\"data\":{\"CPID\":\"C\",\"uniqueId\":\"d\",\"Command\":\"x\",\"AckId\":\"x\",\"ackId\":\"a\"}}",
+                true, NULL, "a"
+        },
+        {
+                "mixed case cpid after a non-string value",
+                "{\"cmdType\":\"0x01\",\"data\":{\"cpid\":1,\"CPID\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"a\"}}",
+                false
+        },
+        {
+                "mixed case uniqueId",
+                "{\"cmdType\":\"0x01\",\"data\":{\"cpId\":\"C\",\"UniqueId\":\"d\",\"ackId\":\"a\"}}",
+                false
+        },
+        {
+                "mixed case url and version",
+                "{\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"o1\","
+                "\"ver\":{\"SW\":\"1.2\",\"Hw\":\"r3\",\"sw\":\"9\"},"
+                "\"urls\":[\"http://a\",{\"URL\":\"http://b\",\"url\":\"http://c\"},{\"uRl\":\"http://d\"},{\"x\":1},5,null,\"http://g\"]}}",
+                true, NULL, "o1", "1.2", "r3",
+                7, {"http://a", "http://b", "http://d", NULL, NULL, NULL, "http://g"}
+        },
+        {
+                "url and version after non-string values",
+                "{\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"a\",\"command\":{\"x\":1},\"command\":\"c\","
+                "\"ver\":{\"sw\":1,\"SW\":\"2\",\"hw\":null},\"urls\":[{\"url\":1,\"URL\":\"x\"},{\"Url\":\"y\",\"url\":\"z\"}]}}",
+                true, NULL, "a", NULL, NULL,
+                2, {NULL, "y"}
+        },
+        {
+                "urls and version of the wrong type",
+                "{\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"o2\",\"ver\":\"1.0\",\"urls\":{\"url\":\"http://a\"}}}",
+                true, NULL, "o2"
+        },
+        {
+                "more than 8 urls",
+                "{\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"o3\",\"urls\":["
+                "\"u0\",\"u1\",{\"url\":\"u2\"},\"u3\",\"u4\",\"u5\",\"u6\",\"u7\",\"u8\",{\"url\":\"u9\"},"
+                "\"u10\",\"u11\",\"u12\",\"u13\",\"u14\",\"u15\",\"u16\",\"u17\",\"u18\",\"u19\"]}}",
+                true, NULL, "o3", NULL, NULL,
+                20, {"u0", "u1", "u2", "u3", "u4", "u5", "u6", "u7", "u8", "u9",
+                     "u10", "u11", "u12", "u13", "u14", "u15", "u16", "u17", "u18", "u19"}
+        },
+        {
+                "duplicate urls and version",
+                "{\"cmdType\":\"0x02\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"o4\","
+                "\"urls\":[\"u0\",\"u1\"],\"urls\":[\"v0\"],\"ver\":{\"sw\":\"1\"},\"ver\":{\"sw\":\"2\"}}}",
+                true, NULL, "o4", "1", NULL,
+                2, {"u0", "u1"}
+        },
+        {
+                "truncated",
+                DATA_PREFIX "\"command\":\"trunc\",\"ackId\":\"a\"}",
+                false
+        },
+        {
+                "truncated string",
+                DATA_PREFIX "\"command\":\"tr",
+                false
+        },
+        {
+                "whitespace and other values",
+                " \r\n\x0b{ \"cmdType\" : \"0x01\" ,\t\"data\" : { \"cpid\" : \"C\" , \"uniqueId\" : \"d\" , \"ackId\" : \"a\" ,"
+                " \"n\" : [ -1.5e+3 , 1. , -.5 , 007 , 2E-3 ] , \"b\" : [ true , false , null , { } , [ ] ] } } \n",
+                true, NULL, "a"
+        },
+        {
+                "trailing data",
+                DATA_PREFIX "\"ackId\":\"a\"}} trailing",
+                true, NULL, "a"
+        },
+        {"number without digits", DATA_PREFIX "\"ackId\":\"a\",\"n\":-}}", false},
+        {"number with a plus sign", DATA_PREFIX "\"ackId\":\"a\",\"n\":+1}}", false},
+        {"number with two dots", DATA_PREFIX "\"ackId\":\"a\",\"n\":1.2.3}}", false},
+        {"exponent without digits", DATA_PREFIX "\"ackId\":\"a\",\"n\":1e}}", false},
+        {"invalid literal", DATA_PREFIX "\"ackId\":\"a\",\"x\":tru}}", false},
+        {"trailing comma", DATA_PREFIX "\"ackId\":\"a\",\"x\":{\"a\":1,}}}", false},
+        {"mismatched bracket", DATA_PREFIX "\"ackId\":\"a\",\"x\":[1,2}}}", false},
+        {"non-string key", DATA_PREFIX "\"ackId\":\"a\",\"x\":{1:2}}}", false},
+        {"short cmdType", "{\"cmdType\":\"0x1\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"a\"}}", false},
+        {"unsupported cmdType", "{\"cmdType\":\"0x00\",\"data\":{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"a\"}}", false},
+        {"missing cpid", "{\"cmdType\":\"0x01\",\"data\":{\"uniqueId\":\"d\",\"ackId\":\"a\"}}", false},
+        {"other event type without cpid", "{\"cmdType\":\"0x10\",\"data\":{\"ackId\":\"a\"}}", true, NULL, "a"},
+        {"root array", "[{\"cmdType\":\"0x01\"}]", false},
+        {"data array", "{\"cmdType\":\"0x01\",\"data\":[{\"cpid\":\"C\",\"uniqueId\":\"d\",\"ackId\":\"a\"}]}", false},
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static IotclEventData last_event = NULL;
+static IotConnectEventType last_type;
+static int failures = 0;
+
+static void on_event(IotclEventData data, IotConnectEventType type) {
+    last_event = data;
+    last_type = type;
+}
+
+static void fail(const char *name, const char *what, const char *expected, const char *actual) {
+    printf("FAIL %s: %s is \"%s\", expected \"%s\"\n", name, what, actual ? actual : "(null)", expected ? expected : "(null)");
+    failures++;
+}
+
+// Compares and frees the actual value
+static void check_string(const char *name, const char *what, const char *expected, char *actual) {
+    if ((expected == NULL) != (actual == NULL) || (expected && 0 != strcmp(expected, actual))) {
+        fail(name, what, expected, actual);
+    }
+    free(actual);
+}
+
+// Same as create_ack() of the cJSON based implementation, with the time taken from the ack that is checked
+static char *reference_ack(bool success, const char *message, IotConnectEventType type, const char *ack_id, const char *time) {
+    int status = 4;
+    if (success && type == DEVICE_COMMAND) status = 6;
+    if (success && type == DEVICE_OTA) status = 7;
+
+    cJSON *ack_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(ack_json, "mt", type == DEVICE_COMMAND ? 5 : 11);
+    cJSON_AddStringToObject(ack_json, "t", time);
+    cJSON_AddStringToObject(ack_json, "uniqueId", DEVICE_DUID);
+    cJSON_AddStringToObject(ack_json, "cpId", DEVICE_CPID);
+    cJSON *sdk_info = cJSON_AddObjectToObject(ack_json, "sdk");
+    cJSON_AddStringToObject(sdk_info, "l", CONFIG_IOTCONNECT_SDK_NAME);
+    cJSON_AddStringToObject(sdk_info, "v", CONFIG_IOTCONNECT_SDK_VERSION);
+    cJSON_AddStringToObject(sdk_info, "e", DEVICE_ENV);
+    cJSON *ack_data = cJSON_AddObjectToObject(ack_json, "d");
+    cJSON_AddStringToObject(ack_data, "ackId", ack_id);
+    cJSON_AddStringToObject(ack_data, "msg", message ? message : "");
+    cJSON_AddNumberToObject(ack_data, "st", status);
+    char *result = cJSON_PrintUnformatted(ack_json);
+    cJSON_Delete(ack_json);
+    return result;
+}
+
+// Compares the ack with the reference
+static void check_ack(const char *name, const char *ack, bool success, const char *message, IotConnectEventType type, const char *ack_id) {
+    if (!ack) {
+        fail(name, "ack", "an ack", NULL);
+        return;
+    }
+    cJSON *parsed = cJSON_Parse(ack);
+    const cJSON *time = parsed ? cJSON_GetObjectItemCaseSensitive(parsed, "t") : NULL;
+    if (!cJSON_IsString(time)) {
+        fail(name, "ack", "an ack with a timestamp", ack);
+    } else {
+        char *expected = reference_ack(success, message, type, ack_id, time->valuestring);
+        if (0 != strcmp(expected, ack)) {
+            fail(name, "ack", expected, ack);
+        }
+        cJSON_free(expected);
+    }
+    cJSON_Delete(parsed);
+}
+
+static void check_acks(const EventCase *c, IotclEventData event) {
+    static const char message[] = "ok \"quoted\" \x01 \xc3\xa9\n";
+    const char *ack_id = c->ack_id ? c->ack_id : "";
+    IotConnectEventType type = last_type;
+    char buffer[512];
+    if (0 == iotcl_create_ack_into(buffer, sizeof(buffer), event, false, NULL)) {
+        fail(c->name, "ack", "an ack", NULL);
+    } else {
+        check_ack(c->name, buffer, false, NULL, type, ack_id);
+    }
+    char *ack = iotcl_create_ack_string_and_destroy_event(event, true, message);
+    check_ack(c->name, ack, true, message, type, ack_id);
+    free(ack);
+}
+
+static void check_case(const EventCase *c) {
+    last_event = NULL;
+    bool accepted = iotcl_process_event_with_length(c->json, strlen(c->json));
+    if (accepted != c->accepted || accepted != (last_event != NULL)) {
+        printf("FAIL %s: %s\n", c->name, accepted ? "accepted" : "rejected");
+        failures++;
+        if (last_event) {
+            iotcl_destroy_event(last_event);
+        }
+        return;
+    }
+    if (!accepted) {
+        return;
+    }
+    IotclEventData e = last_event;
+    check_string(c->name, "command", c->command, iotcl_clone_command(e));
+    check_string(c->name, "ackId", c->ack_id, iotcl_clone_ack_id(e));
+    check_string(c->name, "sw version", c->sw_version, iotcl_clone_sw_version(e));
+    check_string(c->name, "hw version", c->hw_version, iotcl_clone_hw_version(e));
+    for (size_t i = 0; i <= c->num_urls; i++) {
+        char what[16];
+        snprintf(what, sizeof(what), "url %u", (unsigned int) i);
+        check_string(c->name, what, i < c->num_urls ? c->urls[i] : NULL, iotcl_clone_download_url(e, i));
+    }
+    check_acks(c, e);
+}
+
+// The value of "x" is nested in arrays, so that the deepest array is at the given depth. The root object is at depth 1.
+static void check_depth(int depth, bool accepted) {
+    static char json[sizeof(DATA_PREFIX) + 2 * MAX_TEST_DEPTH + 64];
+    char name[32];
+    char *p = json + sprintf(json, DATA_PREFIX "\"ackId\":\"a\",\"x\":");
+    for (int i = 2; i < depth; i++) *p++ = '[';
+    for (int i = 2; i < depth; i++) *p++ = ']';
+    strcpy(p, "}}");
+    snprintf(name, sizeof(name), "nesting depth %d", depth);
+    EventCase c = {name, json, accepted, NULL, "a"};
+    check_case(&c);
+}
+
+int main(void) {
+    IotclConfig config;
+    memset(&config, 0, sizeof(config));
+    config.device.cpid = DEVICE_CPID;
+    config.device.duid = DEVICE_DUID;
+    config.device.env = DEVICE_ENV;
+    config.event_functions.msg_cb = on_event;
+    if (!iotcl_init(&config)) {
+        printf("FAIL: iotcl_init()\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_CASES; i++) {
+        check_case(&cases[i]);
+    }
+    // cJSON allowed 1000 levels of nesting
+    check_depth(33, true);
+    check_depth(1000, true);
+    check_depth(MAX_TEST_DEPTH, false);
+
+    char *ota_ack = iotcl_create_ota_ack_response("ota\"1", false, NULL);
+    check_ack("OTA failure ack", ota_ack, false, NULL, DEVICE_OTA, "ota\"1");
+    free(ota_ack);
+    ota_ack = iotcl_create_ota_ack_response("ota2", true, "done");
+    check_ack("OTA success ack", ota_ack, true, "done", DEVICE_OTA, "ota2");
+    free(ota_ack);
+
+    iotcl_deinit();
+    printf("%s: %u cases\n", failures ? "FAILED" : "OK", (unsigned int) NUM_CASES + 3);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Checks the store-and-forward buffer: wrapping of the RAM ring, spilling from RAM to the file backend,
+// the replay order, reloading records from the file, recovery from a damaged file header,
+// and dropping of messages that fail to send.
+//
+// Usage: iotc_offline_store_test
+// The file backend uses iotc_offline_store_test.bin in the working directory.
+// The exit code is non-zero if any check failed.
+
+#include <stdio.h>
+#include <string.h>
+#include "iotc_offline_store.h"
+
+#define TEST_FILE "iotc_offline_store_test.bin"
+#define TEST_FILE_MAX_SIZE 4096
+
+// Each message is a two digit id padded with dots, so that records of a known size can be made
+#define MESSAGE_LEN 7
+#define RECORD_SIZE (2 + MESSAGE_LEN + 1) // RAM records have a 2 byte length and a terminator
+
+static int failures = 0;
+
+// what the send function does, and what it has sent
+static char sent_ids[256];
+static bool send_busy = false;
+static int fail_id = -1;
+static int fail_result = -1;
+static unsigned int send_attempts = 0;
+
+static void fail(const char *name, const char *what, const char *expected, const char *actual) {
+    printf("FAIL %s: %s is \"%s\", expected \"%s\"\n", name, what, actual, expected);
+    failures++;
+}
+
+static void check_string(const char *name, const char *what, const char *expected, const char *actual) {
+    if (0 != strcmp(expected, actual)) {
+        fail(name, what, expected, actual);
+    }
+}
+
+static void check_number(const char *name, const char *what, unsigned long expected, unsigned long actual) {
+    if (expected != actual) {
+        char e[24];
+        char a[24];
+        snprintf(e, sizeof(e), "%lu", expected);
+        snprintf(a, sizeof(a), "%lu", actual);
+        fail(name, what, e, a);
+    }
+}
+
+static void push_message(IotcOfflineStore *store, int id) {
+    char message[MESSAGE_LEN + 1];
+    snprintf(message, sizeof(message), "%02d.....", id);
+    iotc_offline_store_push(store, message, MESSAGE_LEN);
+}
+
+// Records the ids of the sent messages, like "00,01,"
+static int record_send(const char *data, size_t len, void *user_data) {
+    (void) user_data;
+    int id = -1;
+    send_attempts++;
+    if (send_busy) {
+        return IOTC_STORE_SEND_BUSY;
+    }
+    if (len != MESSAGE_LEN || strlen(data) != len || 1 != sscanf(data, "%d", &id)) {
+        failures++;
+        printf("FAIL: stored message \"%.*s\" was damaged\n", (int) len, data);
+        return IOTC_STORE_SEND_REJECTED;
+    }
+    if (id == fail_id) {
+        return fail_result;
+    }
+    size_t used = strlen(sent_ids);
+    snprintf(&sent_ids[used], sizeof(sent_ids) - used, "%02d,", id);
+    return 0;
+}
+
+static void reset_send(void) {
+    sent_ids[0] = 0;
+    send_busy = false;
+    fail_id = -1;
+    fail_result = -1;
+    send_attempts = 0;
+}
+
+static void check_stats(const char *name, IotcOfflineStore *store, size_t queued, unsigned long replayed, unsigned long dropped) {
+    IotcOfflineStoreStats stats;
+    iotc_offline_store_get_stats(store, &stats);
+    check_number(name, "queued", queued, stats.queued);
+    check_number(name, "replayed", replayed, stats.replayed);
+    check_number(name, "dropped", dropped, stats.dropped);
+}
+
+// Three records fill all but the last few bytes of the ring, so the fourth one wraps to the start,
+// over the oldest record. With 2 bytes left, a wrap marker is written at the tail. With 1 byte left, it is not.
+static void check_wrap(const char *name, size_t ram_size) {
+    IotcOfflineStore store;
+    reset_send();
+    if (!iotc_offline_store_init(&store, ram_size, NULL)) {
+        fail(name, "init", "true", "false");
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        push_message(&store, i);
+    }
+    check_number(name, "drained", 3, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_string(name, "replay order", "01,02,03,", sent_ids);
+    check_stats(name, &store, 0, 3, 1);
+
+    // head and tail in the middle of the ring, with records on both sides of the wrap
+    reset_send();
+    for (int i = 4; i < 6; i++) {
+        push_message(&store, i);
+    }
+    check_number(name, "drained one", 1, iotc_offline_store_drain(&store, 1, record_send, NULL));
+    for (int i = 6; i < 8; i++) {
+        push_message(&store, i);
+    }
+    check_number(name, "drained rest", 3, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_string(name, "replay order after wrap", "04,05,06,07,", sent_ids);
+    check_stats(name, &store, 0, 7, 1);
+    iotc_offline_store_deinit(&store);
+}
+
+// RAM holds three records. Older ones move to the file and are replayed before the newer ones in RAM.
+static void check_spill(void) {
+    const char *name = "spill";
+    IotcStoreBackend backend;
+    IotcFileStoreContext file;
+    IotcOfflineStore store;
+    reset_send();
+    remove(TEST_FILE);
+    if (!iotc_offline_store_file_backend_init(&backend, &file, TEST_FILE, TEST_FILE_MAX_SIZE)
+        || !iotc_offline_store_init(&store, 3 * RECORD_SIZE, &backend)) {
+        fail(name, "init", "true", "false");
+        return;
+    }
+    for (int i = 0; i < 6; i++) {
+        push_message(&store, i);
+    }
+    IotcOfflineStoreStats stats;
+    iotc_offline_store_get_stats(&store, &stats);
+    check_number(name, "spilled", 3, stats.spilled);
+    check_number(name, "records in the file", 3, backend.count(backend.ctx));
+
+    check_number(name, "drained", 2, iotc_offline_store_drain(&store, 2, record_send, NULL));
+    // RAM is still full, so 03 goes to the file behind 02
+    push_message(&store, 6);
+    check_number(name, "drained rest", 5, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_string(name, "replay order", "00,01,02,03,04,05,06,", sent_ids);
+    check_stats(name, &store, 0, 7, 0);
+    check_number(name, "records in the file", 0, backend.count(backend.ctx));
+
+    iotc_offline_store_deinit(&store);
+    iotc_offline_store_file_backend_deinit(&file);
+    remove(TEST_FILE);
+}
+
+// Records in the file survive a restart, and a file with a damaged header is started over
+static void check_reload(void) {
+    const char *name = "reload";
+    IotcStoreBackend backend;
+    IotcFileStoreContext file;
+    IotcOfflineStore store;
+    reset_send();
+    remove(TEST_FILE);
+    if (!iotc_offline_store_file_backend_init(&backend, &file, TEST_FILE, TEST_FILE_MAX_SIZE)) {
+        fail(name, "init", "true", "false");
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        char message[MESSAGE_LEN + 1];
+        snprintf(message, sizeof(message), "%02d.....", i);
+        backend.push(backend.ctx, message, MESSAGE_LEN);
+    }
+    backend.pop(backend.ctx);
+    iotc_offline_store_file_backend_deinit(&file);
+
+    if (!iotc_offline_store_file_backend_init(&backend, &file, TEST_FILE, TEST_FILE_MAX_SIZE)
+        || !iotc_offline_store_init(&store, 3 * RECORD_SIZE, &backend)) {
+        fail(name, "init after restart", "true", "false");
+        return;
+    }
+    check_number(name, "records after restart", 3, iotc_offline_store_count(&store));
+    push_message(&store, 4);
+    check_number(name, "drained", 4, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_string(name, "replay order", "01,02,03,04,", sent_ids);
+    iotc_offline_store_deinit(&store);
+
+    // a head offset past the end of the file
+    backend.push(backend.ctx, "99.....", MESSAGE_LEN);
+    iotc_offline_store_file_backend_deinit(&file);
+    FILE *fp = fopen(TEST_FILE, "r+b");
+    if (fp) {
+        static const unsigned char bad_head[4] = {0xFF, 0xFF, 0, 0};
+        fseek(fp, 4, SEEK_SET);
+        fwrite(bad_head, sizeof(bad_head), 1, fp);
+        fclose(fp);
+    }
+    if (!iotc_offline_store_file_backend_init(&backend, &file, TEST_FILE, TEST_FILE_MAX_SIZE)) {
+        fail(name, "init with a damaged header", "true", "false");
+        return;
+    }
+    check_number(name, "records with a damaged header", 0, backend.count(backend.ctx));
+    iotc_offline_store_file_backend_deinit(&file);
+
+    // not a store file at all
+    fp = fopen(TEST_FILE, "wb");
+    if (fp) {
+        fputs("not a store file", fp);
+        fclose(fp);
+    }
+    if (!iotc_offline_store_file_backend_init(&backend, &file, TEST_FILE, TEST_FILE_MAX_SIZE)) {
+        fail(name, "init with a foreign file", "true", "false");
+        return;
+    }
+    check_number(name, "records in a foreign file", 0, backend.count(backend.ctx));
+    iotc_offline_store_file_backend_deinit(&file);
+    remove(TEST_FILE);
+}
+
+// A busy transport leaves everything stored. A failing message is dropped after the max number of failures,
+// and a rejected one right away, so that the messages behind it are sent.
+static void check_send_failures(void) {
+    const char *name = "send failures";
+    IotcOfflineStore store;
+    reset_send();
+    if (!iotc_offline_store_init(&store, 256, NULL)) {
+        fail(name, "init", "true", "false");
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        push_message(&store, i);
+    }
+    send_busy = true;
+    check_number(name, "drained while busy", 0, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_stats(name, &store, 3, 0, 0);
+
+    send_busy = false;
+    fail_id = 1;
+    check_number(name, "drained before the failing message", 1, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    for (int i = 2; i < IOTC_OFFLINE_STORE_MAX_SEND_FAILURES; i++) {
+        check_number(name, "drained with the failing message", 0, iotc_offline_store_drain(&store, 10, record_send, NULL));
+        // a busy transport in between does not count as a failure
+        send_busy = true;
+        iotc_offline_store_drain(&store, 10, record_send, NULL);
+        send_busy = false;
+    }
+    check_stats(name, &store, 2, 1, 0);
+    check_number(name, "drained after the last failure", 1, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_string(name, "sent", "00,02,", sent_ids);
+    check_stats(name, &store, 0, 2, 1);
+
+    reset_send();
+    push_message(&store, 3);
+    push_message(&store, 4);
+    fail_id = 3;
+    fail_result = IOTC_STORE_SEND_REJECTED;
+    check_number(name, "drained with a rejected message", 1, iotc_offline_store_drain(&store, 10, record_send, NULL));
+    check_number(name, "attempts with a rejected message", 2, send_attempts);
+    check_string(name, "sent", "04,", sent_ids);
+    check_stats(name, &store, 0, 3, 2);
+    iotc_offline_store_deinit(&store);
+}
+
+int main(void) {
+    check_wrap("wrap with a marker", 3 * RECORD_SIZE + 2);
+    check_wrap("wrap without a marker", 3 * RECORD_SIZE + 1);
+    check_spill();
+    check_reload();
+    check_send_failures();
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
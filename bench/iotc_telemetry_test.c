@@ -0,0 +1,444 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Checks that the streaming telemetry writer and the fixed schema templates produce byte-identical output
+// to the message handle API, and that all of them match a message built with cJSON the way that
+// the original cJSON based implementation built it. Covers nested paths, numbers, nulls and escaping.
+//
+// Usage: iotc_telemetry_test
+// The exit code is non-zero if any check failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cJSON.h"
+#include "iotconnect_common.h"
+#include "iotconnect_lib.h"
+#include "iotconnect_telemetry.h"
+
+#define MAX_FIELDS 16
+#define MAX_DEPTH 8
+#define MESSAGE_BUFFER_SIZE 4096
+
+#define DEVICE_CPID "TEST\"CPID"
+#define DEVICE_DUID "test\\device"
+#define DEVICE_ENV "env\n"
+#define DEVICE_DTG "dtg\t/1"
+
+#define TIME_1 "2020-03-31T21:18:05.000Z"
+#define TIME_2 "2020-03-31T21:18:06.500Z"
+#define EPOCH_1 1585689485
+
+typedef struct {
+    const char *path;
+    IotclAttributeType type;
+    double number;
+    const char *string;
+    bool boolean;
+    bool is_null;
+} Field;
+
+typedef struct {
+    const char *name;
+    Field fields[MAX_FIELDS]; // up to the first field without a path
+} TelemetryCase;
+
+#define NUMBER(path, value) {path, IOTCL_ATTR_NUMBER, value, NULL, false, false}
+#define STRING(path, value) {path, IOTCL_ATTR_STRING, 0, value, false, false}
+#define BOOL(path, value) {path, IOTCL_ATTR_BOOL, 0, NULL, value, false}
+#define NULL_VALUE(path, type) {path, type, 0, NULL, false, true}
+
+static const TelemetryCase cases[] = {
+        {
+                "flat",
+                {
+                        NUMBER("cpu", 3.123),
+                        STRING("version", "1.0"),
+                        BOOL("on", true),
+                        BOOL("off", false),
+                        NULL_VALUE("missing", IOTCL_ATTR_NUMBER),
+                }
+        },
+        {
+                "nested paths",
+                {
+                        NUMBER("count", 7),
+                        NUMBER("env.temp", 22.5),
+                        NUMBER("env.humidity", 41),
+                        STRING("env.room.name", "lab"),
+                        NUMBER("env.room.floor", 2),
+                        NULL_VALUE("env.room.door", IOTCL_ATTR_BOOL),
+                        NUMBER("env.pressure", 1013.25),
+                        NUMBER("power.volts", 229.87),
+                        STRING("power.phase.a.state", "ok"),
+                        BOOL("last", true),
+                }
+        },
+        {
+                "integers",
+                {
+                        NUMBER("zero", 0),
+                        NUMBER("negative zero", -0.0),
+                        NUMBER("one", 1),
+                        NUMBER("negative", -42),
+                        NUMBER("int32 max", 2147483647.0),
+                        NUMBER("uint32 overflow", 4294967296.0),
+                        NUMBER("below 1e15", 999999999999999.0),
+                        NUMBER("1e15", 1e15),
+                        NUMBER("2^53", 9007199254740992.0),
+                        NUMBER("1e21", 1e21),
+                }
+        },
+        {
+                "fractions",
+                {
+                        NUMBER("tenth", 0.1),
+                        NUMBER("third", 1.0 / 3.0),
+                        NUMBER("two thirds", -2.0 / 3.0),
+                        NUMBER("sum", 0.1 + 0.2),
+                        NUMBER("1e-5", 1e-5),
+                        NUMBER("1e-7", 1.5e-7),
+                        NUMBER("pi", 3.141592653589793),
+                        NUMBER("tiny", -2.5e-300),
+                        NUMBER("denormal", 5e-324),
+                        NUMBER("max", 1.7976931348623157e308),
+                        NUMBER("nan", NAN),
+                        NUMBER("inf", INFINITY),
+                        NUMBER("negative inf", -INFINITY),
+                }
+        },
+        {
+                "escaping",
+                {
+                        STRING("quote", "say \"hi\""),
+                        STRING("backslash", "C:\\temp\\"),
+                        STRING("controls", "\b\f\n\r\t\x01\x1f"),
+                        STRING("slash", "a/b"),
+                        STRING("utf-8", "\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80"),
+                        STRING("high ascii", "\x7f"),
+                        STRING("empty", ""),
+                        STRING("key \"quoted\"\\", "v"),
+                        STRING("nested.key\ttab", "v"),
+                }
+        },
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static int failures = 0;
+
+static void fail(const char *name, const char *what, const char *expected, const char *actual) {
+    printf("FAIL %s: %s is\n  %s\nexpected\n  %s\n", name, what, actual ? actual : "(null)", expected ? expected : "(null)");
+    failures++;
+}
+
+static void check_output(const char *name, const char *what, const char *expected, const char *actual) {
+    if (!expected || !actual || 0 != strcmp(expected, actual)) {
+        fail(name, what, expected, actual);
+    }
+}
+
+static size_t num_fields(const TelemetryCase *c) {
+    size_t n = 0;
+    while (n < MAX_FIELDS && c->fields[n].path) n++;
+    return n;
+}
+
+/////////////////////////////////////////////////////////
+// reference
+
+static cJSON *reference_value(const Field *f) {
+    if (f->is_null) return cJSON_CreateNull();
+    switch (f->type) {
+        case IOTCL_ATTR_NUMBER:
+            return cJSON_CreateNumber(f->number);
+        case IOTCL_ATTR_STRING:
+            return cJSON_CreateString(f->string);
+        default:
+            return cJSON_CreateBool(f->boolean);
+    }
+}
+
+// Same as json_object_dotset_locate() of the cJSON based implementation, followed by adding the leaf
+static void reference_set(cJSON *object, const Field *f) {
+    char path[256];
+    strcpy(path, f->path);
+    char *token = strtok(path, ".");
+    char *next = strtok(NULL, ".");
+    while (next) {
+        cJSON *child = cJSON_GetObjectItem(object, token);
+        object = child ? child : cJSON_AddObjectToObject(object, token);
+        token = next;
+        next = strtok(NULL, ".");
+    }
+    cJSON_AddItemToObject(object, token, reference_value(f));
+}
+
+static cJSON *reference_message(void) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "cpid", DEVICE_CPID);
+    cJSON_AddStringToObject(root, "dtg", DEVICE_DTG);
+    cJSON_AddNumberToObject(root, "mt", 0);
+    cJSON *sdk = cJSON_AddObjectToObject(root, "sdk");
+    cJSON_AddStringToObject(sdk, "l", CONFIG_IOTCONNECT_SDK_NAME);
+    cJSON_AddStringToObject(sdk, "v", CONFIG_IOTCONNECT_SDK_VERSION);
+    cJSON_AddStringToObject(sdk, "e", DEVICE_ENV);
+    cJSON_AddArrayToObject(root, "d");
+    return root;
+}
+
+// Same as iotcl_telemetry_add_with_iso_time and iotcl_telemetry_add_with_epoch_time of the cJSON based implementation
+static cJSON *reference_data_set(cJSON *root, const char *iso_time, time_t epoch_time) {
+    cJSON *set = cJSON_CreateObject();
+    cJSON_AddStringToObject(set, "id", DEVICE_DUID);
+    cJSON_AddStringToObject(set, "tg", "");
+    cJSON *values = cJSON_CreateObject();
+    cJSON_AddItemToArray(cJSON_AddArrayToObject(set, "d"), values);
+    cJSON_AddItemToArray(cJSON_GetObjectItem(root, "d"), set);
+    if (iso_time) {
+        cJSON_AddStringToObject(set, "dt", iso_time);
+        if (!cJSON_HasObjectItem(root, "t")) cJSON_AddStringToObject(root, "t", iso_time);
+    } else {
+        cJSON_AddNumberToObject(set, "ts", (double) epoch_time);
+        if (!cJSON_HasObjectItem(root, "ts")) cJSON_AddNumberToObject(root, "ts", (double) epoch_time);
+    }
+    return values;
+}
+
+static char *print_and_delete(cJSON *root) {
+    char *result = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return result;
+}
+
+/////////////////////////////////////////////////////////
+// message handle
+
+// Sets the value with the precompiled path, or with the dotted path string if path is NULL
+static void message_set(IotclMessageHandle msg, const Field *f, IotclTelemetryPath path) {
+    if (path) {
+        if (f->is_null) {
+            iotcl_telemetry_set_null_at(msg, path);
+        } else if (f->type == IOTCL_ATTR_NUMBER) {
+            iotcl_telemetry_set_number_at(msg, path, f->number);
+        } else if (f->type == IOTCL_ATTR_STRING) {
+            iotcl_telemetry_set_string_at(msg, path, f->string);
+        } else {
+            iotcl_telemetry_set_bool_at(msg, path, f->boolean);
+        }
+    } else if (f->is_null) {
+        iotcl_telemetry_set_null(msg, f->path);
+    } else if (f->type == IOTCL_ATTR_NUMBER) {
+        iotcl_telemetry_set_number(msg, f->path, f->number);
+    } else if (f->type == IOTCL_ATTR_STRING) {
+        iotcl_telemetry_set_string(msg, f->path, f->string);
+    } else {
+        iotcl_telemetry_set_bool(msg, f->path, f->boolean);
+    }
+}
+
+/////////////////////////////////////////////////////////
+// writer
+
+// Opens and closes nested objects as the dotted paths of consecutive fields change
+typedef struct {
+    char names[MAX_DEPTH][64];
+    size_t depth;
+} WriterPath;
+
+static void writer_set(IotclTelemetryWriter *w, WriterPath *open, const Field *f) {
+    char path[256];
+    char *segments[MAX_DEPTH + 1];
+    size_t num_segments = 0;
+    strcpy(path, f->path);
+    for (char *token = strtok(path, "."); token && num_segments <= MAX_DEPTH; token = strtok(NULL, ".")) {
+        segments[num_segments++] = token;
+    }
+    size_t common = 0;
+    while (common < open->depth && common + 1 < num_segments && 0 == strcmp(open->names[common], segments[common])) {
+        common++;
+    }
+    while (open->depth > common) {
+        iotcl_telemetry_writer_end_object(w);
+        open->depth--;
+    }
+    while (open->depth + 1 < num_segments) {
+        strcpy(open->names[open->depth], segments[open->depth]);
+        iotcl_telemetry_writer_begin_object(w, segments[open->depth]);
+        open->depth++;
+    }
+    const char *leaf = segments[num_segments - 1];
+    if (f->is_null) {
+        iotcl_telemetry_writer_set_null(w, leaf);
+    } else if (f->type == IOTCL_ATTR_NUMBER) {
+        iotcl_telemetry_writer_set_number(w, leaf, f->number);
+    } else if (f->type == IOTCL_ATTR_STRING) {
+        iotcl_telemetry_writer_set_string(w, leaf, f->string);
+    } else {
+        iotcl_telemetry_writer_set_bool(w, leaf, f->boolean);
+    }
+}
+
+static void writer_set_all(IotclTelemetryWriter *w, const TelemetryCase *c) {
+    WriterPath open = {{{0}}, 0};
+    for (size_t i = 0; i < num_fields(c); i++) {
+        writer_set(w, &open, &c->fields[i]);
+    }
+}
+
+/////////////////////////////////////////////////////////
+// checks
+
+static void init_config(IotclConfig *config) {
+    memset(config, 0, sizeof(IotclConfig));
+    config->device.cpid = DEVICE_CPID;
+    config->device.duid = DEVICE_DUID;
+    config->device.env = DEVICE_ENV;
+    config->telemetry.dtg = DEVICE_DTG;
+}
+
+static void check_case(const TelemetryCase *c) {
+    static char buffer[MESSAGE_BUFFER_SIZE];
+    const size_t n = num_fields(c);
+
+    cJSON *root = reference_message();
+    cJSON *values = reference_data_set(root, TIME_1, 0);
+    for (size_t i = 0; i < n; i++) {
+        reference_set(values, &c->fields[i]);
+    }
+    char *expected = print_and_delete(root);
+
+    IotclTelemetryPath paths[MAX_FIELDS];
+    for (size_t i = 0; i < n; i++) {
+        paths[i] = iotcl_telemetry_path_create(c->fields[i].path);
+    }
+    for (int precompiled = 0; precompiled < 2; precompiled++) {
+        IotclMessageHandle msg = iotcl_telemetry_create();
+        iotcl_telemetry_add_with_iso_time(msg, TIME_1);
+        for (size_t i = 0; i < n; i++) {
+            message_set(msg, &c->fields[i], precompiled ? paths[i] : NULL);
+        }
+        const char *serialized = iotcl_create_serialized_string(msg, false);
+        check_output(c->name, precompiled ? "message with precompiled paths" : "message", expected, serialized);
+        iotcl_destroy_serialized(serialized);
+        if (iotcl_telemetry_serialize_into(msg, buffer, sizeof(buffer), false)) {
+            check_output(c->name, "message serialized into a buffer", expected, buffer);
+        } else {
+            fail(c->name, "message serialized into a buffer", expected, NULL);
+        }
+        iotcl_telemetry_destroy(msg);
+    }
+    for (size_t i = 0; i < n; i++) {
+        iotcl_telemetry_path_destroy(paths[i]);
+    }
+
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init(&w, buffer, sizeof(buffer));
+    iotcl_telemetry_writer_add_with_iso_time(&w, TIME_1);
+    writer_set_all(&w, c);
+    check_output(c->name, "writer", expected, iotcl_telemetry_writer_finish(&w) ? buffer : NULL);
+
+    // a schema with the attributes of the case, in its own context
+    IotclTelemetryAttribute schema[MAX_FIELDS];
+    IotclTelemetryValue schema_values[MAX_FIELDS];
+    for (size_t i = 0; i < n; i++) {
+        schema[i].name = c->fields[i].path;
+        schema[i].type = c->fields[i].type;
+        schema[i].decimals = 0;
+        schema_values[i].is_null = c->fields[i].is_null;
+        if (c->fields[i].type == IOTCL_ATTR_NUMBER) {
+            schema_values[i].v.number = c->fields[i].number;
+        } else if (c->fields[i].type == IOTCL_ATTR_STRING) {
+            schema_values[i].v.string = c->fields[i].string;
+        } else {
+            schema_values[i].v.boolean = c->fields[i].boolean;
+        }
+    }
+    struct IotclContextTag schema_context;
+    IotclConfig config;
+    memset(&schema_context, 0, sizeof(schema_context));
+    init_config(&config);
+    config.telemetry.schema = schema;
+    config.telemetry.schema_size = n;
+    if (!iotcl_context_init(&schema_context, &config)) {
+        fail(c->name, "schema", expected, NULL);
+    } else {
+        size_t len = iotcl_telemetry_render_schema_ctx(&schema_context, schema_values, n, TIME_1, buffer, sizeof(buffer));
+        check_output(c->name, "schema", expected, len ? buffer : NULL);
+        iotcl_context_deinit(&schema_context);
+    }
+    cJSON_free(expected);
+}
+
+// Several data sets, with ISO and epoch timestamps in either order. Schemas only have a single data set.
+static void check_data_sets(const char *name, const char *first_iso, time_t first_epoch, const char *second_iso, time_t second_epoch) {
+    static char buffer[MESSAGE_BUFFER_SIZE];
+    const TelemetryCase *c = &cases[1];
+    const size_t n = num_fields(c);
+
+    cJSON *root = reference_message();
+    cJSON *values = reference_data_set(root, first_iso, first_epoch);
+    reference_set(values, &c->fields[0]);
+    values = reference_data_set(root, second_iso, second_epoch);
+    for (size_t i = 0; i < n; i++) {
+        reference_set(values, &c->fields[i]);
+    }
+    char *expected = print_and_delete(root);
+
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    IotclTelemetryWriter w;
+    iotcl_telemetry_writer_init(&w, buffer, sizeof(buffer));
+    if (first_iso) {
+        iotcl_telemetry_add_with_iso_time(msg, first_iso);
+        iotcl_telemetry_writer_add_with_iso_time(&w, first_iso);
+    } else {
+        iotcl_telemetry_add_with_epoch_time(msg, first_epoch);
+        iotcl_telemetry_writer_add_with_epoch_time(&w, first_epoch);
+    }
+    message_set(msg, &c->fields[0], NULL);
+    WriterPath open = {{{0}}, 0};
+    writer_set(&w, &open, &c->fields[0]);
+    if (second_iso) {
+        iotcl_telemetry_add_with_iso_time(msg, second_iso);
+        iotcl_telemetry_writer_add_with_iso_time(&w, second_iso);
+    } else {
+        iotcl_telemetry_add_with_epoch_time(msg, second_epoch);
+        iotcl_telemetry_writer_add_with_epoch_time(&w, second_epoch);
+    }
+    for (size_t i = 0; i < n; i++) {
+        message_set(msg, &c->fields[i], NULL);
+    }
+    writer_set_all(&w, c);
+
+    const char *serialized = iotcl_create_serialized_string(msg, false);
+    check_output(name, "message", expected, serialized);
+    iotcl_destroy_serialized(serialized);
+    iotcl_telemetry_destroy(msg);
+    check_output(name, "writer", expected, iotcl_telemetry_writer_finish(&w) ? buffer : NULL);
+    cJSON_free(expected);
+}
+
+int main(void) {
+    IotclConfig config;
+    init_config(&config);
+    if (!iotcl_init(&config)) {
+        printf("FAIL: iotcl_init()\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_CASES; i++) {
+        check_case(&cases[i]);
+    }
+    check_data_sets("two ISO data sets", TIME_1, 0, TIME_2, 0);
+    check_data_sets("ISO then epoch data sets", TIME_1, 0, NULL, EPOCH_1);
+    check_data_sets("epoch then ISO data sets", NULL, EPOCH_1, TIME_2, 0);
+    check_data_sets("two epoch data sets", NULL, EPOCH_1, NULL, EPOCH_1 + 1);
+
+    iotcl_deinit();
+    printf("%s: %u cases\n", failures ? "FAILED" : "OK", (unsigned int) NUM_CASES + 4);
+    return failures ? 1 : 0;
+}
@@ -12,8 +12,19 @@
 #include "iotconnect_event.h"
 #include "iotconnect_telemetry.h"
 #include "iotconnect_lib.h"
+#include "iotc_offline_store.h"
+#include "iotc_event_queue.h"
+#include "iotc_command_router.h"
+#include "iotc_transport.h"
+#include "iotc_tls_session_cache.h"
+#include "iotconnect_mem.h"
+#include "iotconnect_log.h"
+#ifdef ARDUINO
 #include "Arduino.h"
 #include "WiFiClientSecure.h"
+#else
+class WiFiClientSecure; // host builds must configure a transport
+#endif
 
 
 typedef enum {
@@ -41,8 +52,43 @@ typedef enum {
     IOTC_CS_MQTT_DISCONNECTED
 } IotConnectConnectionStatus;
 
+// State of the MQTT connection state machine driven by iotconnect_sdk_loop()
+typedef enum {
+    IOTC_CONN_STATE_IDLE, // Not initialized, or disconnected by the application or the cloud. Requires iotconnect_sdk_init().
+    IOTC_CONN_STATE_CONNECTED,
+    IOTC_CONN_STATE_BACKOFF // Connection was lost or an attempt failed. Waiting to retry from iotconnect_sdk_loop().
+} IotConnectConnectionState;
+
 typedef void (*IotConnectStatusCallback)(IotConnectConnectionStatus data);
 
+// An SDK instance for one device identity, with its own lib context, MQTT connection, batching and queues.
+// The functions without a context argument use the default context. Processes that act as many devices,
+// like a Linux gateway or a load test, can create a context for each device and call the *_ctx functions.
+// Contexts are independent, but each one should only be used by one thread at a time.
+// The log queue, the memory statistics, the timestamp clock and the telemetry arena hooks are shared.
+typedef struct IotConnectContextTag *IotConnectContext;
+
+// Same as IotConnectStatusCallback, but tells which context the status is for
+typedef void (*IotConnectContextStatusCallback)(IotConnectContext ctx, IotConnectConnectionStatus status);
+
+// Writes the values of one telemetry sample. @see iotconnect_sdk_batch_add_sample
+typedef void (*IotConnectSampleCallback)(IotclTelemetryWriter *writer, void *user_data);
+
+typedef struct {
+    unsigned long sent; // batches sent, or stored for store-and-forward
+    unsigned long dropped; // batches lost because they could neither be sent nor stored
+    unsigned long dropped_samples; // samples in the dropped batches
+} IotcBatchStats;
+
+// Persistent storage for the discovery and sync response cache, like NVS (Preferences) or a file.
+typedef struct {
+    void *ctx; // passed to each function
+    // Returns a malloc-ed copy of the stored data, or NULL if nothing is stored. The SDK frees the returned string.
+    char *(*load)(void *ctx);
+    // Replaces the stored data. If data is NULL, the stored data should be erased.
+    void (*save)(void *ctx, const char *data);
+} IotConnectPersistence;
+
 typedef struct {
     IotConnectAuthType type;
     union {
@@ -56,26 +102,54 @@ typedef struct {
 
 typedef struct {
     WiFiClientSecure *net; // TODO: Check ethernet support
+    IotcTransport *transport; // Optional. If NULL, PubSubClient and HTTPClient are used over net. Required in host builds and for each additional context.
     size_t mqtt_buffer_size; // Buffer size for PubSubClient MQTT implementation. if set to 0 (default) it will be 2048
     char *env;    // Settings -> Key Vault -> CPID.
     char *cpid;   // Settings -> Key Vault -> Evnironment.
     char *duid;   // Name of the device.
-    int qos; // QOS for outbound messages. Default 1.
+    int qos; // QoS for iotconnect_sdk_send_packet(). 0 (default) or 1. @see iotconnect_sdk_send_packet_qos
+    size_t mqtt_inflight_window; // Max QoS 1 messages waiting for acknowledgement. Default 4 if 0.
     IotConnectAuthInfo auth_info;
     IotclOtaCallback ota_cb; // callback for OTA events.
-    IotclCommandCallback cmd_cb; // callback for command events.
+    IotclCommandCallback cmd_cb; // callback for command events. Not called if command_routes are configured.
     IotclMessageCallback msg_cb; // callback for ALL messages, including the specific ones like cmd or ota callback.
     IotConnectStatusCallback status_cb; // callback for connection status
+    IotConnectContextStatusCallback context_status_cb; // Optional. Callback for connection status, with the context.
+    void *user_data; // Optional. Application data for this device. @see iotconnect_sdk_get_user_data
+    const IotclTelemetryAttribute *telemetry_schema; // Optional. Fixed telemetry schema. @see iotcl_telemetry_render_schema
+    size_t telemetry_schema_size; // Number of attributes in telemetry_schema
+    size_t telemetry_arena_size; // Bytes allocated at once for each iotcl_telemetry_create() message. 0 (default) allocates each JSON node separately.
+    size_t batch_max_samples; // Max samples coalesced into one message by iotconnect_sdk_batch_add_sample. 0 or 1 sends each sample right away.
+    unsigned long batch_max_latency_ms; // Max time the first sample in a batch waits before the batch is sent. Default 1000 if 0.
+    size_t offline_buffer_size; // RAM for messages that could not be sent while offline. 0 (default) disables store-and-forward.
+    IotcStoreBackend *offline_backend; // Optional. Takes the oldest stored messages when RAM is full. @see iotc_offline_store_file_backend_init
+    size_t offline_drain_per_loop; // Max stored messages replayed per iotconnect_sdk_loop() call. Default 5 if 0.
+    unsigned long offline_drain_interval_ms; // Minimum time between replays of stored messages. Default 100 if 0.
+    IotConnectPersistence *persistence; // Optional. Caches discovery and sync responses across reboots.
+    unsigned long cache_ttl_s; // Max age of the cached responses in seconds. Default 86400 (one day) if 0.
+    size_t tls_session_cache_size; // Max size of the cached MQTT TLS session, for resuming it on reconnects. 0 (default) disables the cache.
+    IotcTlsSessionStore *tls_session_store; // Optional. Persists the cached TLS session across reboots.
+    const IotcCommandRoute *command_routes; // Optional. Handlers by command name. The SDK sends the command acks.
+    size_t num_command_routes; // Number of entries in command_routes
+    size_t event_queue_size; // Max events waiting for iotconnect_sdk_dispatch(). 0 (default) runs callbacks right away from iotconnect_sdk_loop().
 } IotConnectClientConfig;
 
 
 IotConnectClientConfig *iotconnect_sdk_init_and_get_config();
 
 // call iotconnect_sdk_init_and_get_config first and configure the SDK before calling iotconnect_sdk_init()
+// A single MQTT connection attempt is made. If it fails, iotconnect_sdk_loop() will keep retrying in the background.
+// If persistence is configured and holds unexpired responses, HTTP discovery and sync are skipped.
+// Should the connection with the cached broker information fail, the cache is discarded
+// and the connection is attempted again after running discovery and sync.
+// The same is done by iotconnect_sdk_loop() after a few failed reconnects with the cached information.
+// If discovery or sync fail then, the state becomes IOTC_CONN_STATE_IDLE.
 int iotconnect_sdk_init();
 
 bool iotconnect_sdk_is_connected();
 
+IotConnectConnectionState iotconnect_sdk_get_connection_state();
+
 // Can be used to pass to telemetry functions
 IotclConfig *iotconnect_sdk_get_lib_config();
 
@@ -84,13 +158,152 @@ IotclConfig *iotconnect_sdk_get_lib_config();
 void iotconnect_sdk_receive();
 
 // allow mqtt to do work (keepalive and c2d message processing)
+// If the connection is lost, this function will reconnect with exponential backoff.
+// Only one connection attempt is made per call and no call waits for the backoff to expire.
+// A few queued SDK log lines are written at the end of each call. @see iotconnect_log.h
 void iotconnect_sdk_loop();
 
 // blocks until sent and returns 0 if successful.
 // data is a null-terminated string
+// If store-and-forward is enabled, the message is stored when it cannot be sent right away,
+// or when older stored messages are still waiting to be replayed. In that case 1 is returned.
+// A message too large for the MQTT buffer is not stored. -1 is returned.
 int iotconnect_sdk_send_packet(const char *data);
 
+// Same as iotconnect_sdk_send_packet, but the data does not need to be null-terminated.
+int iotconnect_sdk_send_packet_len(const char *data, size_t len);
+
+// Returns a buffer where the next message can be written in place, for example with iotcl_telemetry_writer_init(),
+// and sets size to the space available. Send the message with iotconnect_sdk_commit_packet().
+// With QoS 0 and while connected, the buffer is the transmit buffer of the transport, so the message is
+// neither allocated nor copied. Otherwise, an SDK buffer is returned and the message is sent like
+// with iotconnect_sdk_send_packet_len().
+// No other SDK function should be called between reserving and committing. Not committing drops the message.
+// Returns NULL if the SDK is not initialized.
+char *iotconnect_sdk_reserve_packet(size_t *size);
+
+// Sends len bytes written into the reserved buffer. Returns the same values as iotconnect_sdk_send_packet().
+// Returns -1 without sending if len is 0 or larger than the reserved size.
+int iotconnect_sdk_commit_packet(size_t len);
+
+// Same as iotconnect_sdk_send_packet, but with the given QoS instead of the configured one.
+// QoS 0 is the fast path, meant for high rate telemetry. QoS 1 is meant for acks and alerts.
+// A QoS 1 message is sent again until the broker acknowledges it, but 0 is returned once it is first sent.
+// If too many QoS 1 messages are waiting for acknowledgement, -3 is returned, unless the message is stored.
+// If the transport does not report PUBACKs, like the Arduino transport, a QoS 1 message is sent once and not again.
+// If the transport does not support QoS 1 at all, the message is sent with QoS 0 and a warning is logged once.
+// Command acks sent by the SDK use QoS 1.
+int iotconnect_sdk_send_packet_qos(const char *data, int qos);
+
+// QoS counters, in-flight depth and retransmits
+void iotconnect_sdk_get_publish_stats(IotcPublishStats *stats);
+
+// Runs the callbacks of queued cloud events, if event_queue_size is configured.
+// Returns after max_events events or after the callbacks take max_us microseconds in total. Zero means no limit.
+// A callback that has started is never interrupted, so the time budget can be exceeded by the last callback.
+// While events are queued, the MQTT keep-alive is not held up by slow callbacks.
+// If the queue is full, a new command or OTA event is rejected with a failure ack.
+// Returns the number of events dispatched.
+size_t iotconnect_sdk_dispatch(size_t max_events, unsigned long max_us);
+
+// Queue depth and callback latency. All values are zero if event_queue_size was not configured.
+void iotconnect_sdk_get_event_queue_stats(IotcEventQueueStats *stats);
+
+// Number and duration of TLS handshakes for HTTP and MQTT.
+// HTTP values are zero if the transport does not report them.
+// MQTT resumption requires a TLS session cache and a transport that can export and import sessions.
+void iotconnect_sdk_get_tls_stats(IotcTlsStats *stats);
+
+// Heap used by the SDK per subsystem: current and peak bytes, allocation count and the largest allocation.
+// Use the peaks to size mqtt_buffer_size, the offline buffer and the queues for the application.
+// All values are zero if the SDK was built with CONFIG_IOTCONNECT_MEM_STATS defined as 0. @see iotconnect_mem.h
+void iotconnect_sdk_get_mem_stats(IotclMemStats *stats);
+
+// Counters for store-and-forward. All values are zero if offline_buffer_size was not configured.
+void iotconnect_sdk_get_offline_stats(IotcOfflineStoreStats *stats);
+
+// Writes the current time as an ISO 8601 timestamp with milliseconds, like "2021-06-24T12:34:56.789Z".
+// Cheaper than iotcl_iso_timestamp_now_into(), because the time is taken from the transport millisecond counter,
+// which is mapped to the system time by iotconnect_sdk_loop() once a minute. Returns the length of the string.
+size_t iotconnect_sdk_timestamp(char buffer[IOTCL_ISO_TIMESTAMP_SIZE]);
+
+// Adds a telemetry sample with the given ISO timestamp (or current time if NULL) to the pending batch.
+// write_values is called to write the sample values with the iotcl_telemetry_writer_set_* functions.
+// Samples are coalesced into one message, up to the MQTT buffer size and the configured batch limits.
+// If the sample does not fit into the pending batch, the batch is sent first and write_values is called again.
+// Returns 0 if the sample was queued or sent.
+int iotconnect_sdk_batch_add_sample(const char *iso_time, IotConnectSampleCallback write_values, void *user_data);
+
+// Sends the pending batch right away, if there is one. iotconnect_sdk_loop() sends it when it exceeds its latency budget.
+int iotconnect_sdk_batch_flush();
+
+// Counters for telemetry batches. A batch that fails to send is dropped and logged,
+// unless store-and-forward is enabled. @see iotconnect_sdk_batch_flush
+void iotconnect_sdk_get_batch_stats(IotcBatchStats *stats);
+
 void iotconnect_sdk_disconnect();
 
+// Creates a context for another device identity. Configure it with iotconnect_sdk_init_and_get_config_ctx().
+// Each context needs its own transport. Returns NULL if memory could not be allocated.
+IotConnectContext iotconnect_sdk_create_context();
+
+// Disconnects and frees everything that the context holds, including stored and queued messages.
+// The default context cannot be destroyed.
+void iotconnect_sdk_destroy_context(IotConnectContext ctx);
+
+IotConnectContext iotconnect_sdk_get_default_context();
+
+// Returns the context that received the event, for event callbacks that are shared by several contexts.
+IotConnectContext iotconnect_sdk_get_event_context(IotclEventData data);
+
+// Returns the user_data of the context configuration
+void *iotconnect_sdk_get_user_data(IotConnectContext ctx);
+
+// The lib context of the device, for the iotcl_*_ctx functions like iotcl_telemetry_create_ctx().
+// NULL until iotconnect_sdk_init_ctx() configures it.
+IotclContext iotconnect_sdk_get_lib_context(IotConnectContext ctx);
+
+// Same as the functions above, but for the given context
+IotConnectClientConfig *iotconnect_sdk_init_and_get_config_ctx(IotConnectContext ctx);
+
+int iotconnect_sdk_init_ctx(IotConnectContext ctx);
+
+bool iotconnect_sdk_is_connected_ctx(IotConnectContext ctx);
+
+IotConnectConnectionState iotconnect_sdk_get_connection_state_ctx(IotConnectContext ctx);
+
+IotclConfig *iotconnect_sdk_get_lib_config_ctx(IotConnectContext ctx);
+
+// Only flushes as many log lines as iotconnect_sdk_loop(), so call iotcl_log_flush() as well if there are many contexts.
+void iotconnect_sdk_loop_ctx(IotConnectContext ctx);
+
+int iotconnect_sdk_send_packet_ctx(IotConnectContext ctx, const char *data);
+
+int iotconnect_sdk_send_packet_len_ctx(IotConnectContext ctx, const char *data, size_t len);
+
+char *iotconnect_sdk_reserve_packet_ctx(IotConnectContext ctx, size_t *size);
+
+int iotconnect_sdk_commit_packet_ctx(IotConnectContext ctx, size_t len);
+
+int iotconnect_sdk_send_packet_qos_ctx(IotConnectContext ctx, const char *data, int qos);
+
+void iotconnect_sdk_get_publish_stats_ctx(IotConnectContext ctx, IotcPublishStats *stats);
+
+size_t iotconnect_sdk_dispatch_ctx(IotConnectContext ctx, size_t max_events, unsigned long max_us);
+
+void iotconnect_sdk_get_event_queue_stats_ctx(IotConnectContext ctx, IotcEventQueueStats *stats);
+
+void iotconnect_sdk_get_tls_stats_ctx(IotConnectContext ctx, IotcTlsStats *stats);
+
+void iotconnect_sdk_get_offline_stats_ctx(IotConnectContext ctx, IotcOfflineStoreStats *stats);
+
+int iotconnect_sdk_batch_add_sample_ctx(IotConnectContext ctx, const char *iso_time, IotConnectSampleCallback write_values, void *user_data);
+
+int iotconnect_sdk_batch_flush_ctx(IotConnectContext ctx);
+
+void iotconnect_sdk_get_batch_stats_ctx(IotConnectContext ctx, IotcBatchStats *stats);
+
+void iotconnect_sdk_disconnect_ctx(IotConnectContext ctx);
+
 
 #endif
\ No newline at end of file
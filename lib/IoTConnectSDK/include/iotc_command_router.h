@@ -0,0 +1,83 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Routes command lines like "set-led-frequency 100" to handlers registered by command name.
+ * Names are looked up through a perfect hash table that is built once at init, so a lookup
+ * hashes the name once and compares it against a single candidate.
+ * Arguments are passed as slices of the command line. Nothing is copied or allocated per command.
+ * This module has no Arduino dependencies.
+ */
+
+#ifndef IOTC_COMMAND_ROUTER_H
+#define IOTC_COMMAND_ROUTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTC_COMMAND_MAX_ARGS 8
+
+// A part of a string. Not null-terminated.
+typedef struct {
+    const char *data;
+    size_t len;
+} IotcSlice;
+
+typedef struct {
+    IotcSlice name;
+    // Space separated arguments after the command name. Extra arguments are only available through rest.
+    IotcSlice values[IOTC_COMMAND_MAX_ARGS];
+    size_t count;
+    IotcSlice rest; // everything after the command name, without leading spaces
+} IotcCommandArgs;
+
+// Executes a command. Returns true if successful.
+// The handler can point message to a string that will be sent in the ack. The string must outlive the call.
+// The slices are valid only during the call.
+typedef bool (*IotcCommandHandler)(const IotcCommandArgs *args, const char **message, void *user_data);
+
+typedef struct {
+    const char *name; // command name, the first word of the command line
+    IotcCommandHandler handler;
+    void *user_data; // passed to the handler
+} IotcCommandRoute;
+
+// The struct should be treated as private.
+typedef struct {
+    const IotcCommandRoute *routes;
+    size_t num_routes;
+    uint16_t *slots; // route index + 1 for each hash slot. 0 means empty.
+    size_t slot_mask;
+    uint32_t seed;
+} IotcCommandRouter;
+
+// Builds the hash table. The routes array must remain valid while the router is in use.
+// Returns false if the names are not unique or if out of memory.
+bool iotc_command_router_init(IotcCommandRouter *router, const IotcCommandRoute *routes, size_t num_routes);
+
+void iotc_command_router_deinit(IotcCommandRouter *router);
+
+// Returns the route for the name, or NULL if there is none.
+const IotcCommandRoute *iotc_command_router_find(const IotcCommandRouter *router, const char *name, size_t name_len);
+
+// Splits the command line into the name and arguments.
+void iotc_command_parse(const char *command_line, IotcCommandArgs *args);
+
+// Parses the command line and runs the matching handler. Returns the handler's result,
+// or false if there is no handler for the command. message is set to the handler's message,
+// or to a default message if the handler did not set one.
+bool iotc_command_router_execute(const IotcCommandRouter *router, const char *command_line, const char **message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_COMMAND_ROUTER_H
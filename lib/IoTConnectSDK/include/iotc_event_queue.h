@@ -0,0 +1,83 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Bounded FIFO of decoded cloud events, so that event callbacks can run outside of the MQTT receive path.
+ * The receive path only pushes the event. The application dispatches queued events with a budget
+ * on the number of events and the time spent in the handlers.
+ * This module has no Arduino dependencies.
+ */
+
+#ifndef IOTC_EVENT_QUEUE_H
+#define IOTC_EVENT_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "iotconnect_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t depth; // events currently waiting to be dispatched
+    size_t peak_depth; // highest depth since init
+    unsigned long queued; // events pushed since init
+    unsigned long dispatched; // events passed to the handler
+    unsigned long dropped; // events rejected because the queue was full
+    unsigned long max_wait_us; // longest time an event waited in the queue
+    unsigned long max_handler_us; // longest time spent in the handler for a single event
+    unsigned long long total_handler_us; // time spent in the handler for all events. Divide by dispatched for the average.
+} IotcEventQueueStats;
+
+typedef struct {
+    IotclEventData data;
+    IotConnectEventType type;
+    unsigned long queued_at_us;
+} IotcQueuedEvent;
+
+// The struct should be treated as private.
+typedef struct {
+    IotcQueuedEvent *entries;
+    size_t capacity;
+    size_t head; // index of the oldest event
+    size_t count;
+    IotcEventQueueStats stats;
+} IotcEventQueue;
+
+// Takes ownership of the event, the same way an event callback does.
+typedef void (*IotcEventHandler)(IotclEventData data, IotConnectEventType type, void *user_data);
+
+// Allocates room for capacity events.
+bool iotc_event_queue_init(IotcEventQueue *queue, size_t capacity);
+
+// Destroys all events that are still queued.
+void iotc_event_queue_deinit(IotcEventQueue *queue);
+
+// Returns false if the queue is full. The caller keeps ownership of the event in that case.
+bool iotc_event_queue_push(IotcEventQueue *queue, IotclEventData data, IotConnectEventType type);
+
+size_t iotc_event_queue_count(IotcEventQueue *queue);
+
+// Passes queued events to the handler, oldest first, until max_events are dispatched
+// or max_us microseconds are spent. Zero means no limit for either value.
+// At least one event is dispatched if any are queued, because a running handler cannot be interrupted.
+// Returns the number of events dispatched.
+size_t iotc_event_queue_dispatch(
+        IotcEventQueue *queue,
+        size_t max_events,
+        unsigned long max_us,
+        IotcEventHandler handler,
+        void *user_data
+);
+
+void iotc_event_queue_get_stats(IotcEventQueue *queue, IotcEventQueueStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_EVENT_QUEUE_H
@@ -8,6 +8,10 @@
 
 #include <Client.h>
 
+// Max response body collected by iotconnect_https_request. Larger responses fail.
+#ifndef IOTC_HTTP_MAX_RESPONSE_SIZE
+#define IOTC_HTTP_MAX_RESPONSE_SIZE 8192
+#endif
 
 typedef struct IotConnectHttpResponse {
     char *data; // add flexibility for future, but at this point we only have response data
@@ -24,5 +28,33 @@ int iotconnect_https_request(
 
 void iotconnect_free_https_response(IotConnectHttpResponse* response);
 
+typedef struct {
+    unsigned long requests;
+    unsigned long handshakes; // requests that needed a new TLS connection
+    unsigned long reused; // requests sent over a kept-alive connection
+    unsigned long handshake_ms; // total time spent connecting
+    unsigned long last_handshake_ms;
+} IotConnectHttpStats;
+
+// Receives consecutive pieces of the response body as they arrive. Chunked transfer encoding is already removed.
+// Return false to abort the transfer.
+typedef bool (*IotConnectHttpBodyCallback)(const char *data, size_t len, void *user_data);
+
+// Same as iotconnect_https_request, but the body is passed to on_body as it is received, instead of being collected.
+int iotconnect_https_request_streaming(
+        Client* net, // network client (WiFiClientSecure for example)
+        const char *url,
+        const char *send_str,
+        IotConnectHttpBodyCallback on_body,
+        void *user_data
+);
+
+// The connection is kept open after a request, if the server allows it, and it is reused
+// by the next request to the same host. Call this when no more requests are expected,
+// to free the memory held by the TLS connection.
+void iotconnect_https_close();
+
+void iotconnect_https_get_stats(IotConnectHttpStats *stats);
+
 
 #endif // IOTC_DISCOVERY_CLIENT_H
\ No newline at end of file
@@ -7,31 +7,105 @@
 #ifndef IOTC_MQTT_CLIENT_H
 #define IOTC_MQTT_CLIENT_H
 
-#include "Arduino.h"
-#include "Client.h"
 #include "iotconnect_discovery.h"
+#include "iotc_transport.h"
+#include "iotc_tls_session_cache.h"
 #include "IoTConnectSDK.h"
 
 
-typedef void (*IotConnectC2dCallback)(unsigned char* message, size_t message_len);
+#define IOTC_MQTT_DEFAULT_BUFFER_SIZE 2048
+
+// PubSubClient buffer holds the fixed header (up to 5 bytes) and the topic length (2 bytes) along with the topic and payload
+#define IOTC_MQTT_PUBLISH_OVERHEAD (5 + 2)
+
+// A QoS 1 PUBLISH also carries the packet id between the topic and the payload
+#define IOTC_MQTT_PACKET_ID_SIZE 2
+
+// Reconnect backoff. The delay doubles with each failed attempt, with up to half of it randomized.
+#define IOTC_MQTT_BACKOFF_MIN_MS 1000
+#define IOTC_MQTT_BACKOFF_MAX_MS 60000
+
+// QoS 1 messages that are not acknowledged in time are sent again, up to the max number of times
+#define IOTC_MQTT_DEFAULT_INFLIGHT_WINDOW 4
+#define IOTC_MQTT_RETRANSMIT_MS 10000
+#define IOTC_MQTT_MAX_RETRANSMITS 3
+
+typedef void (*IotConnectC2dCallback)(const unsigned char* message, size_t message_len, void *user_data);
+
+typedef void (*IotcMqttStatusCallback)(IotConnectConnectionStatus status, void *user_data);
 
 typedef struct {
     IotclSyncResponse* sr;
     IotConnectAuthInfo *auth; // Pointer to IoTConnect auth configuration
     IotConnectC2dCallback c2d_msg_cb; // callback for inbound messages
-    IotConnectStatusCallback status_cb; // callback for connection status
-    Client* net;
-    size_t mqtt_buffer_size; // Buffer size for PubSubClient MQTT implementation. 2048, if set to 0 (default)
+    IotcMqttStatusCallback status_cb; // callback for connection status
+    void *user_data; // passed to the callbacks
+    IotcTransport *transport;
+    IotcTlsSessionCache *session_cache; // Optional. TLS session to resume on reconnects.
+    size_t inflight_window; // Max QoS 1 messages waiting for PUBACK. Default IOTC_MQTT_DEFAULT_INFLIGHT_WINDOW if 0.
 } IotConnectMqttClientConfig;
 
-int iotc_mqtt_client_init(IotConnectMqttClientConfig *c);
+// A QoS 1 message waiting for PUBACK. A slot with NULL data is free.
+typedef struct {
+    char *data;
+    size_t len;
+    unsigned short packet_id;
+    unsigned long sent_ms;
+    unsigned int retransmits;
+} IotcInflightMessage;
+
+// One MQTT connection and its reconnect and QoS 1 state. Each SDK instance has its own client.
+// The struct should be zero-initialized before first use. Fields should be treated as private.
+// The transport must not be shared with another client, because it holds the message callbacks.
+typedef struct {
+    IotcTransport *transport;
+    char *publish_topic;
+    IotclSyncResponse *sr; // broker credentials for reconnects
+    IotConnectC2dCallback c2d_msg_cb;
+    IotcMqttStatusCallback status_cb;
+    void *user_data;
+    IotcTlsSessionCache *session_cache;
+    IotcTlsStats tls_stats; // only the mqtt counters are used. Kept across re-initialization.
+    IotcInflightMessage *inflight;
+    size_t inflight_window;
+    unsigned short next_packet_id;
+    IotcPublishStats publish_stats; // kept across re-initialization
+    IotConnectConnectionState state;
+    unsigned long backoff_ms;
+    unsigned long next_attempt_ms;
+    unsigned int failed_connects; // connection attempts that failed in a row
+} IotcMqttClient;
+
+// The sync response in the config must remain valid until the client is disconnected.
+// Returns 0 if the client was set up, even if the first connection attempt failed.
+int iotc_mqtt_client_init(IotcMqttClient *client, IotConnectMqttClientConfig *c);
+
+IotConnectConnectionState iotc_mqtt_client_get_state(IotcMqttClient *client);
+
+// Number of connection attempts that failed since the client last connected or was initialized
+unsigned int iotc_mqtt_client_get_failed_connects(IotcMqttClient *client);
+
+int iotc_mqtt_client_disconnect(IotcMqttClient *client);
+
+bool iotc_mqtt_client_is_connected(IotcMqttClient *client);
+
+void iotc_mqtt_client_loop(IotcMqttClient *client);
+
+// Publishes with QoS 0 or 1. A QoS 1 message is kept until the broker acknowledges it, and is sent again
+// if the acknowledgement does not arrive in time, or after a reconnect.
+// Returns 0 if sent, -3 if the QoS 1 in-flight window is full, or another negative value on error.
+int iotc_mqtt_client_send_message(IotcMqttClient *client, const char *message, size_t len, int qos);
 
-int iotc_mqtt_client_disconnect();
+// Returns a buffer for the payload of the next QoS 0 message in the transport's transmit buffer,
+// or NULL if the transport does not support it. @see IotcTransport
+char *iotc_mqtt_client_reserve(IotcMqttClient *client, size_t *size);
 
-bool iotc_mqtt_client_is_connected();
+// Publishes len bytes written into the reserved buffer with QoS 0. Returns 0 if sent.
+int iotc_mqtt_client_commit(IotcMqttClient *client, size_t len);
 
-void iotc_mqtt_client_loop();
+void iotc_mqtt_client_get_publish_stats(IotcMqttClient *client, IotcPublishStats *stats);
 
-int iotc_mqtt_client_send_message(const char *message);
+// Fills in the mqtt_* counters. Other values are not changed.
+void iotc_mqtt_client_get_tls_stats(IotcMqttClient *client, IotcTlsStats *stats);
 
-#endif // IOTC_MQTT_CLIENT_H
\ No newline at end of file
+#endif // IOTC_MQTT_CLIENT_H
@@ -0,0 +1,123 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Store-and-forward buffer for outbound messages that could not be sent while disconnected.
+ * Messages are kept in a bounded RAM ring buffer. If a storage backend is supplied, the oldest messages
+ * spill into it when RAM is full, instead of being dropped. Messages are replayed oldest first.
+ * This module has no Arduino dependencies.
+ */
+
+#ifndef IOTC_OFFLINE_STORE_H
+#define IOTC_OFFLINE_STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A FIFO log of records in persistent storage, like flash.
+typedef struct {
+    void *ctx; // passed to each function
+
+    // Appends a record at the tail of the log. Returns 0 on success, or non-zero if the storage is full.
+    int (*push)(void *ctx, const char *data, size_t len);
+
+    // Copies the oldest record into the buffer. Returns the record length, 0 if the log is empty, or negative on error.
+    int (*peek)(void *ctx, char *buffer, size_t buffer_size);
+
+    // Removes the oldest record. Returns 0 on success.
+    int (*pop)(void *ctx);
+
+    // Returns the number of records in the log.
+    size_t (*count)(void *ctx);
+} IotcStoreBackend;
+
+typedef struct {
+    size_t queued; // messages currently waiting in RAM and in the backend
+    unsigned long stored; // messages stored since init
+    unsigned long spilled; // messages moved from RAM to the backend
+    unsigned long replayed; // stored messages that were successfully sent
+    unsigned long dropped; // messages lost because RAM and the backend were full, the message was too large, or it could not be sent
+} IotcOfflineStoreStats;
+
+// A stored message that fails to send this many times in a row is dropped, so that it does not block the rest
+#define IOTC_OFFLINE_STORE_MAX_SEND_FAILURES 3
+
+// Results of IotcStoreSendFunction, besides 0 for sent and other values for a failed attempt
+#define IOTC_STORE_SEND_BUSY 1 // cannot be sent right now, like while disconnected. Not counted as a failure.
+#define IOTC_STORE_SEND_REJECTED 2 // can never be sent, like when it is too large for the transport. Dropped right away.
+
+// The struct should be treated as private.
+typedef struct {
+    char *ram; // ring buffer of records. Each record is a 2 byte length, the data and a terminating zero.
+    size_t ram_size;
+    size_t head; // read offset
+    size_t tail; // write offset
+    size_t ram_count;
+    char *scratch; // used for reading backend records
+    IotcStoreBackend *backend;
+    unsigned int send_failures; // failed attempts to send the oldest message
+    IotcOfflineStoreStats stats;
+} IotcOfflineStore;
+
+// Sends one message. Returns 0 if the message was sent, or one of the IOTC_STORE_SEND_* values or any other value if not.
+typedef int (*IotcStoreSendFunction)(const char *data, size_t len, void *user_data);
+
+// Allocates ram_size bytes for the RAM buffer and the same amount for reading backend records.
+// Messages larger than about ram_size cannot be stored. The backend is optional and can be NULL.
+bool iotc_offline_store_init(IotcOfflineStore *store, size_t ram_size, IotcStoreBackend *backend);
+
+void iotc_offline_store_deinit(IotcOfflineStore *store);
+
+// Stores a copy of the message. Returns false if the message had to be dropped.
+bool iotc_offline_store_push(IotcOfflineStore *store, const char *data, size_t len);
+
+// Number of messages in RAM and in the backend.
+size_t iotc_offline_store_count(IotcOfflineStore *store);
+
+// Sends up to max_messages stored messages in order, oldest first. Stops at the first send failure,
+// leaving the failed message stored, unless it was rejected or failed IOTC_OFFLINE_STORE_MAX_SEND_FAILURES times.
+// Such a message is dropped and the drain goes on with the next one. Returns the number of messages sent.
+size_t iotc_offline_store_drain(IotcOfflineStore *store, size_t max_messages, IotcStoreSendFunction send, void *user_data);
+
+void iotc_offline_store_get_stats(IotcOfflineStore *store, IotcOfflineStoreStats *stats);
+
+/////////////////////////////////////////////////////////
+// File backend
+//
+// Uses a single file through stdio, so it works with a plain file on Linux and with
+// SPIFFS, LittleFS or FAT on ESP32 through the VFS (for example "/spiffs/iotc_offline.bin").
+// Records survive reboots. The file is truncated whenever it is fully drained.
+/////////////////////////////////////////////////////////
+
+typedef struct {
+    const char *path; // must remain valid while the backend is in use
+    FILE *fp;
+    size_t max_size; // maximum file size in bytes
+    size_t count;
+    size_t head; // file offset of the oldest record
+    size_t end; // file offset past the newest record
+} IotcFileStoreContext;
+
+// Opens or creates the file and sets up the backend functions. Existing records in the file are kept.
+bool iotc_offline_store_file_backend_init(
+        IotcStoreBackend *backend,
+        IotcFileStoreContext *ctx,
+        const char *path,
+        size_t max_size
+);
+
+void iotc_offline_store_file_backend_deinit(IotcFileStoreContext *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_OFFLINE_STORE_H
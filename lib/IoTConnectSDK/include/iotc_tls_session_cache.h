@@ -0,0 +1,66 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Holds the TLS session of the last MQTT connection, so that a reconnect to the same broker
+ * can resume the session with an abbreviated handshake instead of a full one.
+ * The session is kept in RAM and can optionally be persisted, so that it survives a reboot.
+ * Sessions are opaque to the cache. The transport exports and imports them. @see IotcTransport
+ * This module has no Arduino dependencies.
+ */
+
+#ifndef IOTC_TLS_SESSION_CACHE_H
+#define IOTC_TLS_SESSION_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Persistent storage for the cached session, like NVS. The stored data holds session secrets,
+// so the storage should be encrypted or otherwise protected where possible.
+typedef struct {
+    void *ctx; // passed to each function
+
+    // Copies the stored record into the buffer. Returns its length, or 0 if nothing is stored or it does not fit.
+    size_t (*load)(void *ctx, unsigned char *buffer, size_t buffer_size);
+
+    // Replaces the stored record. If len is 0, the stored record should be erased.
+    void (*save)(void *ctx, const unsigned char *data, size_t len);
+} IotcTlsSessionStore;
+
+// The struct should be treated as private.
+typedef struct {
+    // record: 1 byte host length, host, 2 byte port and the session
+    unsigned char *record;
+    size_t record_size;
+    size_t record_len; // 0 if there is no session
+    bool loaded; // whether the store was read
+    IotcTlsSessionStore *store;
+} IotcTlsSessionCache;
+
+// Allocates max_session_size bytes for the session, plus room for the host name. The store is optional and can be NULL.
+bool iotc_tls_session_cache_init(IotcTlsSessionCache *cache, size_t max_session_size, IotcTlsSessionStore *store);
+
+void iotc_tls_session_cache_deinit(IotcTlsSessionCache *cache);
+
+// Returns the length of the cached session for the host and port and points session to it, or 0 if there is none.
+// The session is valid until the cache is changed.
+size_t iotc_tls_session_cache_get(IotcTlsSessionCache *cache, const char *host, int port, const unsigned char **session);
+
+// Replaces the cached session. Sessions that are too large are not cached.
+void iotc_tls_session_cache_put(IotcTlsSessionCache *cache, const char *host, int port, const unsigned char *session, size_t len);
+
+// Discards the cached session, in RAM and in the store.
+void iotc_tls_session_cache_clear(IotcTlsSessionCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TLS_SESSION_CACHE_H
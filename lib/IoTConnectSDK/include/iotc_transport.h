@@ -0,0 +1,138 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Network transport used by the SDK for HTTP discovery/sync and MQTT.
+ * The default backend on Arduino uses PubSubClient and HTTPClient over WiFiClientSecure. @see iotc_transport_arduino.h
+ * An in-process loopback backend is available for testing and benchmarking. @see iotc_transport_loopback.h
+ */
+
+#ifndef IOTC_TRANSPORT_H
+#define IOTC_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Connection setup counters, so that the effect of connection reuse can be verified
+typedef struct {
+    unsigned long http_requests;
+    unsigned long http_handshakes; // HTTP requests that needed a new TLS connection
+    unsigned long http_reused; // HTTP requests sent over a kept-alive connection
+    unsigned long http_handshake_ms; // total time spent setting up HTTP connections
+    unsigned long http_last_handshake_ms;
+    unsigned long mqtt_handshakes; // MQTT connections with a full TLS handshake
+    unsigned long mqtt_resumed; // MQTT connections that resumed a cached TLS session
+    unsigned long mqtt_connect_ms; // total time of successful MQTT connection attempts, including the MQTT CONNECT
+    unsigned long mqtt_last_connect_ms;
+} IotcTlsStats;
+
+// Outbound message counters by QoS
+typedef struct {
+    unsigned long published_qos0;
+    unsigned long published_qos1; // first transmissions of QoS 1 messages
+    unsigned long acked; // QoS 1 messages acknowledged by the broker
+    unsigned long retransmits; // QoS 1 messages sent again because they were not acknowledged in time
+    unsigned long expired; // QoS 1 messages given up on after the max number of retransmits, or dropped on disconnect
+    unsigned long rejected; // QoS 1 messages rejected because the in-flight window was full
+    unsigned long untracked; // QoS 1 messages sent once, because the transport does not report PUBACKs
+    unsigned long downgraded; // QoS 1 messages sent with QoS 0, because the transport does not support QoS 1
+    size_t in_flight; // QoS 1 messages currently waiting for an acknowledgement
+    size_t peak_in_flight;
+} IotcPublishStats;
+
+typedef void (*IotcTransportMessageCallback)(const unsigned char *payload, size_t len, void *user_data);
+
+typedef void (*IotcTransportPubackCallback)(unsigned short packet_id, void *user_data);
+
+typedef struct {
+    void *ctx; // passed to each function
+
+    // Connects to the MQTT broker over TLS. Makes a single attempt. Returns true if connected.
+    bool (*mqtt_connect)(
+            void *ctx,
+            const char *host,
+            int port,
+            const char *client_id,
+            const char *user_name,
+            const char *pass
+    );
+
+    void (*mqtt_disconnect)(void *ctx);
+
+    bool (*mqtt_is_connected)(void *ctx);
+
+    bool (*mqtt_subscribe)(void *ctx, const char *topic);
+
+    // Publishes with QoS 0.
+    bool (*mqtt_publish)(void *ctx, const char *topic, const char *data, size_t len);
+
+    // Optional. Returns a buffer for the payload of the next QoS 0 publish to the topic, so that the payload
+    // can be written in place, and sets size to the space available. Returns NULL if there is no room.
+    char *(*mqtt_reserve)(void *ctx, const char *topic, size_t *size);
+
+    // Optional. Required with mqtt_reserve. Publishes len bytes of payload written into the reserved buffer.
+    // Returns false if len exceeds the size returned by mqtt_reserve.
+    bool (*mqtt_commit)(void *ctx, size_t len);
+
+    // Optional. Publishes with QoS 1 and the given packet id. dup is set when the message is sent again.
+    // Without it, QoS 1 messages are published with QoS 0.
+    bool (*mqtt_publish_qos1)(
+            void *ctx,
+            const char *topic,
+            const char *data,
+            size_t len,
+            unsigned short packet_id,
+            bool dup
+    );
+
+    // Optional. The callback is called from mqtt_poll for each PUBACK. Without it, QoS 1 messages
+    // are published once with mqtt_publish_qos1 and never sent again, as their delivery cannot be confirmed.
+    void (*mqtt_set_puback_callback)(void *ctx, IotcTransportPubackCallback cb, void *user_data);
+
+    // Handles keepalive and delivers inbound messages to the message callback.
+    // Returns false if the connection was lost.
+    bool (*mqtt_poll)(void *ctx);
+
+    void (*mqtt_set_message_callback)(void *ctx, IotcTransportMessageCallback cb, void *user_data);
+
+    // Optional. Offers a TLS session to resume on the next mqtt_connect. A zero length clears it.
+    // If the broker does not accept it, the transport falls back to a full handshake.
+    void (*mqtt_set_tls_session)(void *ctx, const unsigned char *session, size_t len);
+
+    // Optional. Returns the length of the TLS session of the current MQTT connection and points session to it,
+    // or 0 if it cannot be exported. The session is valid until the next mqtt_connect.
+    // resumed is set to whether the connection resumed the offered session.
+    size_t (*mqtt_get_tls_session)(void *ctx, const unsigned char **session, bool *resumed);
+
+    // Runs an HTTPS GET request, or a POST with JSON content if post_data is not NULL.
+    // Returns 0 on success, in which case *response is a malloc-ed response body that the caller must free.
+    int (*http_request)(void *ctx, const char *url, const char *post_data, char **response);
+
+    // Optional. Closes a kept-alive HTTP connection. Called once discovery and sync are done.
+    void (*http_close)(void *ctx);
+
+    // Optional. Reports connection setup counters.
+    void (*get_tls_stats)(void *ctx, IotcTlsStats *stats);
+} IotcTransport;
+
+// Milliseconds since an arbitrary point in time, like Arduino millis(). Wraps around.
+unsigned long iotc_transport_millis(void);
+
+// Microseconds since an arbitrary point in time, like Arduino micros(). Wraps around.
+unsigned long iotc_transport_micros(void);
+
+// Random number in the range [0, max), like Arduino random(max).
+long iotc_transport_random(long max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TRANSPORT_H
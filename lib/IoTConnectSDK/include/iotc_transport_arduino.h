@@ -0,0 +1,18 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_TRANSPORT_ARDUINO_H
+#define IOTC_TRANSPORT_ARDUINO_H
+
+#include "WiFiClientSecure.h"
+#include "iotc_transport.h"
+
+// Returns the transport backed by PubSubClient for MQTT and HTTPClient for HTTP, over the given network client.
+// There is a single instance. Calling this function again reconfigures it.
+// mqtt_buffer_size is the PubSubClient buffer size. IOTC_MQTT_DEFAULT_BUFFER_SIZE is used if it is 0.
+IotcTransport *iotc_transport_arduino_get(WiFiClientSecure *net, size_t mqtt_buffer_size);
+
+#endif // IOTC_TRANSPORT_ARDUINO_H
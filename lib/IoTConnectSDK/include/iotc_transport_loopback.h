@@ -0,0 +1,92 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * In-process transport that mimics the IoTConnect discovery and sync HTTP endpoints and an MQTT broker.
+ * Nothing leaves the process, so the full SDK can be tested and benchmarked without network access.
+ * Discovery points to IOTC_LOOPBACK_HOST. Sync accepts any cpid and duid and returns
+ * the IoTHub style topics for them. Published messages are counted and passed to an optional callback,
+ * and C2D messages can be injected with iotc_transport_loopback_inject.
+ */
+
+#ifndef IOTC_TRANSPORT_LOOPBACK_H
+#define IOTC_TRANSPORT_LOOPBACK_H
+
+#include "iotc_transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTC_LOOPBACK_HOST "loopback.iotconnect.local"
+#define IOTC_LOOPBACK_DTG "00000000-0000-0000-0000-000000000000"
+#define IOTC_LOOPBACK_C2D_QUEUE_SIZE 8
+#define IOTC_LOOPBACK_SESSION_SIZE 32
+#define IOTC_LOOPBACK_PUBACK_QUEUE_SIZE 16
+#define IOTC_LOOPBACK_TX_BUFFER_SIZE 2048 // used by mqtt_reserve and mqtt_commit, if max_message_size is 0
+
+typedef void (*IotcLoopbackPublishCallback)(const char *topic, const char *data, size_t len, void *user_data);
+
+typedef struct {
+    unsigned long http_requests;
+    unsigned long connects;
+    unsigned long failed_connects;
+    unsigned long resumed_connects; // connects that resumed the last issued TLS session
+    unsigned long published;
+    unsigned long published_bytes;
+    unsigned long published_qos1; // included in published
+    unsigned long duplicates; // QoS 1 messages published with the dup flag
+    unsigned long delivered; // C2D messages delivered to the client
+} IotcLoopbackStats;
+
+typedef struct {
+    // configuration. Can be changed at any time.
+    size_t max_message_size; // Publishes with a larger topic and payload fail, like with a small PubSubClient buffer. 0 is unlimited.
+    unsigned int fail_connects; // Number of upcoming connection attempts that will fail
+    IotcLoopbackPublishCallback on_publish; // Optional. Called for each published message.
+    void *on_publish_user_data;
+    bool no_session_resumption; // The broker does not issue resumable TLS sessions.
+    unsigned int drop_pubacks; // Number of upcoming QoS 1 publishes that will not be acknowledged
+
+    // state. Should be treated as private, except for stats.
+    bool connected;
+    bool subscribed;
+    unsigned char offered_session[IOTC_LOOPBACK_SESSION_SIZE];
+    size_t offered_session_len;
+    unsigned char issued_session[IOTC_LOOPBACK_SESSION_SIZE];
+    size_t issued_session_len;
+    unsigned long sessions_issued;
+    bool resumed;
+    char *c2d_queue[IOTC_LOOPBACK_C2D_QUEUE_SIZE];
+    size_t c2d_head;
+    size_t c2d_count;
+    IotcTransportMessageCallback message_cb;
+    void *message_cb_user_data;
+    char *tx_buffer; // allocated on the first mqtt_reserve
+    size_t tx_buffer_size;
+    const char *tx_topic;
+    unsigned short pubacks[IOTC_LOOPBACK_PUBACK_QUEUE_SIZE]; // packet ids to acknowledge on the next poll
+    size_t puback_count;
+    IotcTransportPubackCallback puback_cb;
+    void *puback_cb_user_data;
+    IotcLoopbackStats stats;
+} IotcLoopbackTransport;
+
+// Sets up the transport functions to use the loopback instance.
+void iotc_transport_loopback_init(IotcTransport *transport, IotcLoopbackTransport *loopback);
+
+// Frees any undelivered C2D messages and the transmit buffer.
+void iotc_transport_loopback_deinit(IotcLoopbackTransport *loopback);
+
+// Queues a C2D message, which will be delivered by the next poll while the client is connected and subscribed.
+// Returns false if the queue is full.
+bool iotc_transport_loopback_inject(IotcLoopbackTransport *loopback, const char *message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TRANSPORT_LOOPBACK_H
@@ -0,0 +1,60 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Bump allocator for the cJSON trees of telemetry messages.
+ * Each message gets one block of memory. The JSON nodes and strings of the message are carved from that block
+ * and the whole message is released with a single free, instead of allocating and freeing each node separately.
+ * If the block runs out, another block of the same size is chained to it.
+ * The allocator plugs into cJSON through cJSON_InitHooks(), so cJSON hooks cannot be used for anything else
+ * while arenas are enabled. @see IotclTelemetryConfig arena_size
+ */
+
+#ifndef IOTCONNECT_ARENA_H
+#define IOTCONNECT_ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct IotclArenaTag *IotclArena;
+
+typedef struct {
+    unsigned long arenas; // arenas created since the hooks were installed
+    unsigned long extra_blocks; // blocks chained because the arena size was too small
+    size_t peak_used; // most bytes used by a single arena. Useful for choosing the arena size.
+} IotclArenaStats;
+
+// Routes cJSON allocations through the arena selected with iotcl_arena_select().
+// Resets the stats.
+void iotcl_arena_install_hooks(void);
+
+// Restores the default cJSON allocator. All arenas should be destroyed first.
+void iotcl_arena_uninstall_hooks(void);
+
+// Allocates an arena with block_size bytes of space. Returns NULL if out of memory.
+IotclArena iotcl_arena_create(size_t block_size);
+
+// Returns memory from the arena, aligned for any type. Returns NULL if out of memory.
+void *iotcl_arena_alloc(IotclArena arena, size_t size);
+
+// Makes cJSON allocate from the arena, or from the heap if arena is NULL. Returns the previously selected arena,
+// which should be selected again once done. Memory of the selected arena is never freed by cJSON.
+IotclArena iotcl_arena_select(IotclArena arena);
+
+// Frees all memory of the arena at once, including any memory returned by iotcl_arena_alloc().
+void iotcl_arena_destroy(IotclArena arena);
+
+void iotcl_arena_get_stats(IotclArenaStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTCONNECT_ARENA_H
@@ -8,20 +8,74 @@
 #define IOTCONNECT_COMMON_H
 
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Configuration and pre-rendered data of one device identity. @see iotconnect_lib.h
+typedef struct IotclContextTag *IotclContext;
+
+// Large enough for any number printed by iotcl_format_number, including the string terminator
+#define IOTCL_NUMBER_BUFFER_SIZE 26
+
 char *iotcl_strdup(const char *str);
 
-// NOTE: This function is not thread-safe
+// Prints the shortest JSON number text that parses back to the same value, without using printf.
+// NaN and infinity are printed as null. Returns the length of the null-terminated string.
+size_t iotcl_format_number(char buffer[IOTCL_NUMBER_BUFFER_SIZE], double value);
+
+// Rounds the value to the given number of decimal places (0-9), so that it is printed with at most that many decimals.
+double iotcl_round_to_decimals(double value, int decimals);
+
+// Size of an ISO 8601 UTC timestamp like "2011-10-08T07:07:01.123Z", including the string terminator
+#define IOTCL_ISO_TIMESTAMP_SIZE 25
+
+// NOTE: This function is not thread-safe. @see iotcl_format_iso_timestamp
 const char *iotcl_to_iso_timestamp(time_t timestamp);
 
-// NOTE: This function is not thread-safe
+// NOTE: This function is not thread-safe. @see iotcl_iso_timestamp_now_into
 const char *iotcl_iso_timestamp_now();
 
+// Formats milliseconds since the unix epoch as an ISO 8601 UTC timestamp with millisecond precision.
+// Uses only integer arithmetic and is reentrant. Returns the length of the null-terminated string.
+size_t iotcl_format_iso_timestamp(char buffer[IOTCL_ISO_TIMESTAMP_SIZE], long long utc_ms);
+
+// Current system time in milliseconds since the unix epoch
+long long iotcl_utc_ms_now(void);
+
+// Reentrant version of iotcl_iso_timestamp_now(). Returns the length of the null-terminated string.
+size_t iotcl_iso_timestamp_now_into(char buffer[IOTCL_ISO_TIMESTAMP_SIZE]);
+
+// Maps a monotonic millisecond counter, like Arduino millis(), to UTC, so that samples can be timestamped
+// without reading the system time. The date of the last timestamp is cached, so formatting a timestamp
+// on the same day only needs to format the time of day.
+// The counter can wrap around, but the clock must be used at least once per wrap period.
+// Zero-initialize before use. Each task should use its own clock. Fields should be treated as private.
+typedef struct {
+    long long utc_ms; // UTC time at last_monotonic_ms
+    unsigned long last_monotonic_ms;
+    bool synced;
+    bool date_valid;
+    long date_day; // days since the epoch of the cached date
+    char date[sizeof("2011-10-08T") - 1]; // not terminated
+} IotclClock;
+
+// Sets the UTC time at the given point of the monotonic counter, typically iotcl_utc_ms_now() at millis().
+void iotcl_clock_sync(IotclClock *clock, long long utc_ms, unsigned long monotonic_ms);
+
+bool iotcl_clock_is_synced(const IotclClock *clock);
+
+// Returns milliseconds since the unix epoch at the given point of the monotonic counter.
+// The counter must not go back in time.
+long long iotcl_clock_utc_ms(IotclClock *clock, unsigned long monotonic_ms);
+
+// Same as iotcl_format_iso_timestamp() for iotcl_clock_utc_ms(). Returns the length of the null-terminated string.
+size_t iotcl_clock_timestamp(IotclClock *clock, unsigned long monotonic_ms, char buffer[IOTCL_ISO_TIMESTAMP_SIZE]);
+
 // Internal function
 void iotcl_oom_error();
 
@@ -16,6 +16,8 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include <time.h>
 #include "iotconnect_lib_config.h"
 
 #ifndef IOTCONNECT_DISCOVERY_HOSTNAME
@@ -102,6 +104,25 @@ IotclSyncResponse *iotcl_discovery_parse_sync_response(const char *response_data
 
 void iotcl_discovery_free_sync_response(IotclSyncResponse *response);
 
+// Version of the cache format produced by iotcl_discovery_create_cache. Caches with a different version are rejected.
+#define IOTCL_DISCOVERY_CACHE_VERSION 1
+
+// Serializes the discovery and sync responses into a compact JSON string that can be stored in persistent storage
+// and restored with iotcl_discovery_parse_cache, to avoid the HTTP discovery and sync calls on the next boot.
+// saved_at is the wall clock time of the sync, used to expire the cache.
+// The user must free the returned string. NULL is returned in case of allocation failure.
+char *iotcl_discovery_create_cache(const IotclDiscoveryResponse *dr, const IotclSyncResponse *sr, time_t saved_at);
+
+// Restores the responses from a string created by iotcl_discovery_create_cache.
+// On success, the user must free the returned responses as if they were returned by the parse functions.
+// Returns false if the cache is invalid, in which case nothing needs to be freed.
+bool iotcl_discovery_parse_cache(
+        const char *cache_data,
+        IotclDiscoveryResponse **dr,
+        IotclSyncResponse **sr,
+        time_t *saved_at
+);
+
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "iotconnect_common.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,10 +51,29 @@ typedef struct {
 // If return value is false, there was an error during processing.
 bool iotcl_process_event(const char *event);
 
+// Same as iotcl_process_event, but the event does not need to be null-terminated.
+// This allows the event to be parsed directly from the receive buffer of the MQTT client, without making a copy.
+// The buffer is not referenced after the function returns.
+bool iotcl_process_event_with_length(const char *event, size_t event_len);
+
+// Same as iotcl_process_event and iotcl_process_event_with_length, but for the device identity of the given context.
+// The callbacks of that context's configuration are invoked. @see iotcl_context_init
+bool iotcl_process_event_ctx(IotclContext ctx, const char *event);
+
+bool iotcl_process_event_with_length_ctx(IotclContext ctx, const char *event, size_t event_len);
+
+// Returns the context that processed the event, so that callbacks shared by several contexts
+// can tell the devices apart. @see IotclConfig user_data
+IotclContext iotcl_event_get_context(IotclEventData data);
+
 // Returns a malloc-ed copy of the command line message parameter.
 // The user must manually free the returned string when it is no longer needed.
 char *iotcl_clone_command(IotclEventData data);
 
+// Same as iotcl_clone_command, but returns the command line stored in the event, without making a copy.
+// The returned string is valid until the event is destroyed. Returns NULL if the event has no command.
+const char *iotcl_get_command(IotclEventData data);
+
 // Returns a malloc-ed copy of the OTA download URL with a given zero-based index.
 // The user must manually free the returned string when it is no longer needed.
 char *iotcl_clone_download_url(IotclEventData data, size_t index);
@@ -99,10 +120,53 @@ char *iotcl_create_ota_ack_response(
         const char *message
 );
 
+// Same as iotcl_create_ota_ack_response, but for the device identity of the given context.
+char *iotcl_create_ota_ack_response_ctx(
+        IotclContext ctx,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+);
+
+// Renders an OTA or a command ack json with optional message (can be NULL) into the buffer.
+// Nothing is allocated. The event is not destroyed, so iotcl_destroy_event must be called once the ack is rendered.
+// Returns the length of the null-terminated ack, which can be published without strlen,
+// or zero if the buffer was too small.
+size_t iotcl_create_ack_into(
+        char *buffer,
+        size_t buffer_size,
+        IotclEventData data,
+        bool success,
+        const char *message
+);
+
+// Same as iotcl_create_ota_ack_response, but renders the ack into the buffer. @see iotcl_create_ack_into
+size_t iotcl_create_ota_ack_into(
+        char *buffer,
+        size_t buffer_size,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+);
+
+size_t iotcl_create_ota_ack_into_ctx(
+        IotclContext ctx,
+        char *buffer,
+        size_t buffer_size,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+);
+
 // Call this is no ack is sent.
 // This function frees up all resources taken by the message.
 void iotcl_destroy_event(IotclEventData data);
 
+// Internal functions. Called when a context is configured and cleared. @see iotcl_init
+bool iotcl_event_init(IotclContext ctx);
+
+void iotcl_event_deinit(IotclContext ctx);
+
 #ifdef __cplusplus
 }
 #endif
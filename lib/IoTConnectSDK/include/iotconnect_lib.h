@@ -39,14 +39,43 @@ typedef struct {
     IotclDeviceConfig device;
     IotclTelemetryConfig telemetry;
     IotclEventFunctions event_functions; // Event callbacks for the event library. @see iotconnect_event.h
+    void *user_data; // Optional. Application data for the event callbacks. @see iotcl_event_get_context
 } IotclConfig;
 
+// A device identity: its configuration and the parts of messages that are pre-rendered from it.
+// iotcl_init() configures the default context, which is used by all functions without a context argument.
+// A process that acts as many devices, like a gateway or a load test, can create a context for each one.
+// Contexts are independent, but a context should only be used by one thread at a time.
+// Events hold a reference to their context, so they must be destroyed before the context is deinitialized.
+// Fields should be treated as private.
+struct IotclContextTag {
+    IotclConfig config;
+    bool config_is_valid;
+    bool uses_arena_hooks; // the cJSON hooks are shared by all contexts with telemetry arena_size
+    char *ack_device_part; // @see iotcl_event_init
+    size_t ack_device_part_len;
+    struct IotclSchemaTemplateTag *schema_template; // NULL if there is no telemetry schema
+};
+
 bool iotcl_init(IotclConfig *c);
 
 IotclConfig *iotcl_get_config(void);
 
 void iotcl_deinit();
 
+IotclContext iotcl_get_default_context(void);
+
+// Configures a context for another device identity. The configuration is checked and copied like with iotcl_init(),
+// so the strings that it points to must remain valid until the context is deinitialized.
+// The struct should be zero-initialized before first use. A configured context can be configured again.
+// Returns false if the configuration is invalid or if memory could not be allocated.
+bool iotcl_context_init(IotclContext ctx, IotclConfig *c);
+
+void iotcl_context_deinit(IotclContext ctx);
+
+// Returns NULL if the context is not configured.
+IotclConfig *iotcl_context_get_config(IotclContext ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,10 +21,38 @@ extern "C" {
 // IoTHub max device id is 128, which is "<CPID>-<DUID>" (with a dash)
 #define CONFIG_IOTCONNECT_CPID_MAX_LEN (CONFIG_IOTCONNECT_CLIENTID_MAX_LEN - 1 - CONFIG_IOTCONNECT_DUID_MAX_LEN)
 
+#define IOTCL_LOG_LEVEL_NONE 0
+#define IOTCL_LOG_LEVEL_ERROR 1
+#define IOTCL_LOG_LEVEL_WARN 2
+#define IOTCL_LOG_LEVEL_INFO 3
+#define IOTCL_LOG_LEVEL_DEBUG 4 // includes dumps of inbound messages
+
+// Log messages above this level are compiled out. @see iotconnect_log.h
+#ifndef CONFIG_IOTCONNECT_LOG_LEVEL
+#define CONFIG_IOTCONNECT_LOG_LEVEL IOTCL_LOG_LEVEL_INFO
+#endif
+
+// Number of log lines buffered until iotcl_log_flush() writes them out. 0 writes each line right away.
+// Must be a power of two.
+#ifndef CONFIG_IOTCONNECT_LOG_QUEUE_SIZE
+#define CONFIG_IOTCONNECT_LOG_QUEUE_SIZE 16
+#endif
+
+// Longer log lines are truncated
+#ifndef CONFIG_IOTCONNECT_LOG_LINE_MAX
+#define CONFIG_IOTCONNECT_LOG_LINE_MAX 160
+#endif
+
+// Max bytes of a message payload or a server response included in a log line. @see IOTCL_LOG_PAYLOAD
+#ifndef CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX
+#define CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX 64
+#endif
+
+// Library messages are errors. Define CONFIG_IOTCONNECT_LIB_LOG as a printf-like function to handle them instead.
 #ifdef CONFIG_IOTCONNECT_LIB_LOG
 #define IOTCL_LOG CONFIG_IOTCONNECT_LIB_LOG
 #elif !defined(IOTCL_LOG)
-#define IOTCL_LOG (void)// noop
+#define IOTCL_LOG IOTCL_ERROR
 #endif
 
 #ifdef CONFIG_IOTCONNECT_LIB_LOG_NEWLINE
@@ -33,6 +61,12 @@ extern "C" {
 #define IOTCL_NL // noop
 #endif
 
+// Tracks the heap used by the SDK per subsystem. @see iotconnect_mem.h
+// Each tracked allocation carries a small header. Define as 0 to compile the tracking out.
+#ifndef CONFIG_IOTCONNECT_MEM_STATS
+#define CONFIG_IOTCONNECT_MEM_STATS 1
+#endif
+
 #ifndef CONFIG_IOTCONNECT_SDK_NAME
 #define CONFIG_IOTCONNECT_SDK_NAME "M_C"
 #endif
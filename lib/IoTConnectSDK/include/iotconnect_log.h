@@ -0,0 +1,89 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Level-filtered logging for the SDK.
+ * Levels above CONFIG_IOTCONNECT_LOG_LEVEL are removed by the preprocessor, so they cost no code or time.
+ * Enabled lines are formatted into a bounded lock-free queue and written to the sink by iotcl_log_flush(),
+ * which iotconnect_sdk_loop() calls after its work is done, so that a slow serial port does not hold up
+ * MQTT processing. Any task can log. Only one task should flush. If the queue is full, lines are dropped and counted.
+ * Lines are truncated at CONFIG_IOTCONNECT_LOG_LINE_MAX and payloads at CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX.
+ * @see iotconnect_lib_config.h
+ */
+
+#ifndef IOTCONNECT_LOG_H
+#define IOTCONNECT_LOG_H
+
+#include <stddef.h>
+
+#ifndef ITOTCONNECT_LIB_CONFIG_HEADER
+
+#include "iotconnect_lib_config.h"
+
+#else
+#include ITOTCONNECT_LIB_CONFIG_HEADER
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writes one log line. The line is null-terminated and does not end with a newline.
+typedef void (*IotclLogSink)(int level, const char *line, size_t len, void *ctx);
+
+typedef struct {
+    unsigned long logged; // lines written to the sink
+    unsigned long dropped; // lines lost because the queue was full
+    unsigned long truncated; // lines cut at CONFIG_IOTCONNECT_LOG_LINE_MAX
+} IotclLogStats;
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void iotcl_log(int level, const char *format, ...);
+
+// Writes up to max_lines queued lines to the sink, or all of them if max_lines is 0.
+// Returns the number of lines written.
+size_t iotcl_log_flush(size_t max_lines);
+
+// Replaces the default sink, which prints each line with printf. A NULL sink restores the default.
+void iotcl_log_set_sink(IotclLogSink sink, void *ctx);
+
+void iotcl_log_get_stats(IotclLogStats *stats);
+
+// Length argument for "%.*s" that limits a payload to CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX bytes
+#define IOTCL_LOG_PAYLOAD(len) \
+    ((int) ((len) > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX : (len)))
+
+#if CONFIG_IOTCONNECT_LOG_LEVEL >= IOTCL_LOG_LEVEL_ERROR
+#define IOTCL_ERROR(...) iotcl_log(IOTCL_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define IOTCL_ERROR(...) do {} while (0)
+#endif
+
+#if CONFIG_IOTCONNECT_LOG_LEVEL >= IOTCL_LOG_LEVEL_WARN
+#define IOTCL_WARN(...) iotcl_log(IOTCL_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define IOTCL_WARN(...) do {} while (0)
+#endif
+
+#if CONFIG_IOTCONNECT_LOG_LEVEL >= IOTCL_LOG_LEVEL_INFO
+#define IOTCL_INFO(...) iotcl_log(IOTCL_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define IOTCL_INFO(...) do {} while (0)
+#endif
+
+#if CONFIG_IOTCONNECT_LOG_LEVEL >= IOTCL_LOG_LEVEL_DEBUG
+#define IOTCL_DEBUG(...) iotcl_log(IOTCL_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define IOTCL_DEBUG(...) do {} while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTCONNECT_LOG_H
@@ -0,0 +1,105 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Heap accounting for the SDK. Allocations that the SDK makes and frees itself go through these functions
+ * and are counted per subsystem: current and peak bytes, number of allocations and the largest allocation.
+ * cJSON allocations are counted against the subsystem selected with iotcl_mem_select().
+ * Memory that is handed over to the application or allocated by the application or a transport,
+ * like strings returned by iotcl_clone_* or HTTP response bodies, is allocated with plain malloc
+ * so that it can be freed with free(). Where the SDK holds on to such memory, it is counted with iotcl_mem_track().
+ * If CONFIG_IOTCONNECT_MEM_STATS is 0, the functions map to the plain heap functions and all stats are zero.
+ * This module is not thread safe, like the rest of the SDK.
+ */
+
+#ifndef IOTCONNECT_MEM_H
+#define IOTCONNECT_MEM_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "iotconnect_common.h"
+
+#ifndef ITOTCONNECT_LIB_CONFIG_HEADER
+
+#include "iotconnect_lib_config.h"
+
+#else
+#include ITOTCONNECT_LIB_CONFIG_HEADER
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    IOTCL_MEM_TELEMETRY, // telemetry messages, batching and the schema template
+    IOTCL_MEM_EVENTS, // cloud events, the event queue and the command router
+    IOTCL_MEM_DISCOVERY, // HTTP discovery and sync, and their responses
+    IOTCL_MEM_TRANSPORT, // MQTT buffers, in-flight messages, the offline store and the TLS session cache
+    IOTCL_MEM_NUM_SUBSYSTEMS
+} IotclMemSubsystem;
+
+typedef struct {
+    size_t current_bytes;
+    size_t peak_bytes;
+    unsigned long allocs; // calls to the allocation functions, including reallocations
+    size_t largest; // largest single allocation
+} IotclMemUsage;
+
+typedef struct {
+    IotclMemUsage total;
+    IotclMemUsage subsystems[IOTCL_MEM_NUM_SUBSYSTEMS];
+} IotclMemStats;
+
+#if CONFIG_IOTCONNECT_MEM_STATS
+
+void *iotcl_mem_malloc(IotclMemSubsystem subsystem, size_t size);
+
+void *iotcl_mem_calloc(IotclMemSubsystem subsystem, size_t count, size_t size);
+
+// The memory is counted against the new subsystem after reallocation.
+void *iotcl_mem_realloc(IotclMemSubsystem subsystem, void *pointer, size_t size);
+
+// The pointer must have been returned by one of the functions above, or be NULL.
+void iotcl_mem_free(void *pointer);
+
+char *iotcl_mem_strdup(IotclMemSubsystem subsystem, const char *str);
+
+#else
+
+#define iotcl_mem_malloc(subsystem, size) malloc(size)
+#define iotcl_mem_calloc(subsystem, count, size) calloc(count, size)
+#define iotcl_mem_realloc(subsystem, pointer, size) realloc(pointer, size)
+#define iotcl_mem_free(pointer) free(pointer)
+#define iotcl_mem_strdup(subsystem, str) iotcl_strdup(str)
+
+#endif
+
+// Counts memory that was allocated elsewhere, but is held by the SDK.
+void iotcl_mem_track(IotclMemSubsystem subsystem, size_t size);
+
+// Reverses iotcl_mem_track() before the memory is released.
+void iotcl_mem_untrack(IotclMemSubsystem subsystem, size_t size);
+
+// Selects the subsystem that cJSON allocations are counted against. Returns the previously selected one,
+// which should be selected again once done. IOTCL_MEM_TELEMETRY is selected by default.
+IotclMemSubsystem iotcl_mem_select(IotclMemSubsystem subsystem);
+
+IotclMemSubsystem iotcl_mem_get_selected(void);
+
+void iotcl_mem_get_stats(IotclMemStats *stats);
+
+// Sets the peak of each subsystem to its current bytes and clears the largest allocation,
+// so that the next operation can be measured.
+void iotcl_mem_reset_peaks(void);
+
+const char *iotcl_mem_subsystem_name(IotclMemSubsystem subsystem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTCONNECT_MEM_H
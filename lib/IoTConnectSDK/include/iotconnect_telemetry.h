@@ -8,16 +8,56 @@
 #define IOTCONNECT_TELEMETRY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 
+#include "iotconnect_common.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef enum {
+    IOTCL_ATTR_NUMBER = 1,
+    IOTCL_ATTR_STRING,
+    IOTCL_ATTR_BOOL
+} IotclAttributeType;
+
+// Describes one attribute of a fixed telemetry schema. @see iotcl_telemetry_render_schema
+typedef struct {
+    const char *name; // Attribute name. Dotted notation like "env.temp" can be used for nested objects.
+    IotclAttributeType type;
+    int decimals; // Optional. Round numbers to this many decimal places (1-9). Zero sends the full precision.
+} IotclTelemetryAttribute;
+
+// A value for a schema attribute slot. The member matching the attribute type must be set.
+typedef struct {
+    union {
+        double number;
+        const char *string;
+        bool boolean;
+    } v;
+    bool is_null; // Send null instead of the value to indicate lack of available data.
+} IotclTelemetryValue;
+
 typedef struct {
     // Can be copied at the device page. Can be obtained via REST Sync call.
     // Device template GUID required to send telemetry data.
     const char *dtg;
+
+    // Optional fixed telemetry schema. If set, the message template is pre-rendered at iotcl_init()
+    // so that iotcl_telemetry_render_schema() only needs to format values into their slots.
+    // Attributes within the same nested object must be declared next to each other. A name cannot repeat,
+    // and a value cannot also be used as a nested object, like "env" and "env.temp".
+    // The array must remain valid while the library is initialized.
+    const IotclTelemetryAttribute *schema;
+    size_t schema_size;
+
+    // Optional. Bytes of memory for each iotcl_telemetry_create() message. The JSON tree of the message is allocated
+    // from this block and freed at once by iotcl_telemetry_destroy(), which avoids heap fragmentation.
+    // If a message outgrows the block, another block of the same size is chained to it. @see iotconnect_arena.h
+    // 0 (default) allocates each JSON node from the heap.
+    size_t arena_size;
 } IotclTelemetryConfig;
 
 
@@ -30,6 +70,9 @@ typedef struct IotclMessageHandleTag *IotclMessageHandle;
  */
 IotclMessageHandle iotcl_telemetry_create();
 
+// Same as iotcl_telemetry_create, but for the device identity of the given context. @see iotcl_context_init
+IotclMessageHandle iotcl_telemetry_create_ctx(IotclContext ctx);
+
 /*
  * Destroys the IoTConnect message handle.
  */
@@ -82,10 +125,169 @@ bool iotcl_telemetry_set_bool(IotclMessageHandle message, const char *path, bool
  */
 bool iotcl_telemetry_set_null(IotclMessageHandle message, const char *path);
 
+// Maximum length of a single name in a dotted path like "env.temp"
+#define IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN 63
+
+/*
+ * A precompiled dotted path handle. Registering frequently used paths once avoids parsing the path string
+ * on every set call and the keys are referenced by the message instead of being copied.
+ * The handle must remain valid until all messages that used it are serialized and destroyed.
+ * Typically, handles are created once at startup and never destroyed.
+ */
+typedef struct IotclTelemetryPathTag *IotclTelemetryPath;
+
+/*
+ * Creates a path handle from a dotted notation path like "env.temp" or a simple name like "cpu".
+ * Returns NULL if the path is invalid or if memory could not be allocated.
+ */
+IotclTelemetryPath iotcl_telemetry_path_create(const char *path);
+
+void iotcl_telemetry_path_destroy(IotclTelemetryPath path);
+
+/*
+ * Same as the iotcl_telemetry_set_* functions above, but with a precompiled path.
+ */
+bool iotcl_telemetry_set_number_at(IotclMessageHandle message, IotclTelemetryPath path, double value);
+
+bool iotcl_telemetry_set_string_at(IotclMessageHandle message, IotclTelemetryPath path, const char *value);
+
+bool iotcl_telemetry_set_bool_at(IotclMessageHandle message, IotclTelemetryPath path, bool value);
+
+bool iotcl_telemetry_set_null_at(IotclMessageHandle message, IotclTelemetryPath path);
+
 const char *iotcl_create_serialized_string(IotclMessageHandle message, bool pretty);
 
 void iotcl_destroy_serialized(const char *serialized_string);
 
+/*
+ * Serializes the message into a caller supplied buffer instead of allocating a new string.
+ * Returns false if the buffer is too small. cJSON needs about 5 bytes more than the final string length.
+ */
+bool iotcl_telemetry_serialize_into(IotclMessageHandle message, char *buffer, size_t buffer_size, bool pretty);
+
+/////////////////////////////////////////////////////////
+// Streaming telemetry writer
+//
+// The writer produces the same IoTConnect 2.0 telemetry JSON as the message handle API above, but the JSON is
+// written directly into a caller supplied buffer as values are set. No heap allocations are made.
+// Unlike the message handle API, values must be written in the order in which they should appear
+// and nested objects must be opened and closed explicitly instead of using the dotted path notation.
+//
+// Example:
+//  char buffer[512];
+//  IotclTelemetryWriter w;
+//  iotcl_telemetry_writer_init(&w, buffer, sizeof(buffer));
+//  iotcl_telemetry_writer_set_number(&w, "cpu", 3.123);
+//  iotcl_telemetry_writer_begin_object(&w, "env");
+//  iotcl_telemetry_writer_set_number(&w, "temp", 22.5);
+//  iotcl_telemetry_writer_end_object(&w);
+//  size_t len = iotcl_telemetry_writer_finish(&w); // zero if the buffer was too small
+/////////////////////////////////////////////////////////
+
+// Large enough for an ISO timestamp ("2020-03-31T21:18:05.000Z") or an epoch number
+#define IOTCL_TELEMETRY_WRITER_TIME_MAX_LEN 32
+
+// The writer is a plain struct so that it can live on the stack. Fields should be treated as private.
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t len;
+    bool overflow;
+    bool set_open;        // a data set ({"id":..., "d":[{...) is currently open
+    bool need_comma;      // a value was already written at the current nesting level
+    unsigned int depth;   // nested object depth inside the current data set
+    bool set_time_is_epoch;
+    char set_time[IOTCL_TELEMETRY_WRITER_TIME_MAX_LEN]; // written as "dt" or "ts" when the data set is closed
+    bool root_epoch_first; // "ts" was set on the root before "t"
+    char root_iso_time[IOTCL_TELEMETRY_WRITER_TIME_MAX_LEN]; // "t" of the root object, if any
+    char root_epoch_time[IOTCL_TELEMETRY_WRITER_TIME_MAX_LEN]; // "ts" of the root object, if any
+    const char *duid; // written as "id" of each data set
+} IotclTelemetryWriter;
+
+/*
+ * Initializes the writer and writes the message header into the buffer.
+ * The library must be configured with iotcl_init() and the configuration must contain the dtg.
+ */
+bool iotcl_telemetry_writer_init(IotclTelemetryWriter *writer, char *buffer, size_t buffer_size);
+
+// Same as iotcl_telemetry_writer_init, but for the device identity of the given context.
+// The context must remain configured until the writer is finished.
+bool iotcl_telemetry_writer_init_ctx(IotclContext ctx, IotclTelemetryWriter *writer, char *buffer, size_t buffer_size);
+
+/*
+ * Starts a new telemetry data set with a given timestamp in ISO 8601 format. The timestamp is copied.
+ * @see iotcl_telemetry_add_with_iso_time
+ */
+bool iotcl_telemetry_writer_add_with_iso_time(IotclTelemetryWriter *writer, const char *time);
+
+/*
+ * Starts a new telemetry data set with a given timestamp in unix time format.
+ * @see iotcl_telemetry_add_with_epoch_time
+ */
+bool iotcl_telemetry_writer_add_with_epoch_time(IotclTelemetryWriter *writer, time_t time);
+
+/*
+ * Writes a value into the current data set or the currently open nested object.
+ * A data set with the current time is started if none was started previously.
+ */
+bool iotcl_telemetry_writer_set_number(IotclTelemetryWriter *writer, const char *name, double value);
+
+bool iotcl_telemetry_writer_set_string(IotclTelemetryWriter *writer, const char *name, const char *value);
+
+bool iotcl_telemetry_writer_set_bool(IotclTelemetryWriter *writer, const char *name, bool value);
+
+bool iotcl_telemetry_writer_set_null(IotclTelemetryWriter *writer, const char *name);
+
+/*
+ * Opens a nested object in the current data set. Values written after this call will be placed into the object
+ * until iotcl_telemetry_writer_end_object() is called.
+ */
+bool iotcl_telemetry_writer_begin_object(IotclTelemetryWriter *writer, const char *name);
+
+bool iotcl_telemetry_writer_end_object(IotclTelemetryWriter *writer);
+
+/*
+ * Closes any open objects and data sets and terminates the message.
+ * Returns the length of the null-terminated JSON string in the buffer or zero if the buffer was too small.
+ */
+size_t iotcl_telemetry_writer_finish(IotclTelemetryWriter *writer);
+
+/////////////////////////////////////////////////////////
+// Fixed schema telemetry
+//
+// For devices that always send the same set of attributes. The constant parts of the message are rendered once
+// when the library is initialized with IotclTelemetryConfig schema, so rendering a message only formats the values.
+/////////////////////////////////////////////////////////
+
+/*
+ * Renders a telemetry message with a single data set into the buffer.
+ * values must contain one entry per schema attribute, in the same order as the schema.
+ * time is an ISO 8601 timestamp like iotcl_iso_timestamp_now(), or NULL for current time.
+ * Returns the length of the null-terminated JSON string in the buffer or zero on error or if the buffer was too small.
+ */
+size_t iotcl_telemetry_render_schema(
+        const IotclTelemetryValue *values,
+        size_t num_values,
+        const char *time,
+        char *buffer,
+        size_t buffer_size
+);
+
+// Same as iotcl_telemetry_render_schema, but with the schema and device identity of the given context.
+size_t iotcl_telemetry_render_schema_ctx(
+        IotclContext ctx,
+        const IotclTelemetryValue *values,
+        size_t num_values,
+        const char *time,
+        char *buffer,
+        size_t buffer_size
+);
+
+// Internal functions. Called when a context is configured and cleared. @see iotcl_init
+bool iotcl_telemetry_schema_init(IotclContext ctx);
+
+void iotcl_telemetry_schema_deinit(IotclContext ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,79 +6,157 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include "Arduino.h"
-#include "Client.h"
 #include "iotconnect_lib.h"
 #include "iotconnect_telemetry.h"
 #include "iotconnect_discovery.h"
-#include "iotc_http_request.h"
+#include "iotconnect_log.h"
+#include "iotconnect_mem.h"
 #include "iotc_mqtt_client.h"
+#include "iotc_transport.h"
+#ifdef ARDUINO
+#include "iotc_transport_arduino.h"
+#endif
+#include "iotc_offline_store.h"
+#include "iotc_event_queue.h"
+#include "iotc_command_router.h"
 #include "iotconnect_certs.h"
 #include "IoTConnectSDK.h"
 
 #define HTTP_DISCOVERY_URL_FORMAT "https://%s/api/sdk/cpid/%s/lang/M_C/ver/2.0/env/%s"
 #define HTTP_SYNC_URL_FORMAT "https://%s%ssync?"
+#define DEFAULT_BATCH_MAX_LATENCY_MS 1000
+#define DEFAULT_OFFLINE_DRAIN_PER_LOOP 5
+#define DEFAULT_OFFLINE_DRAIN_INTERVAL_MS 100
+#define DEFAULT_CACHE_TTL_S 86400
+#define CACHED_MAX_FAILED_CONNECTS 3 // reconnects with cached broker information before running discovery and sync again
+#define COMMAND_ACK_BUFFER_SIZE 256
+#define LOG_FLUSH_PER_LOOP 4
+#define CLOCK_SYNC_INTERVAL_MS 60000
+#define MIN_VALID_EPOCH 1577836800 // 2020-01-01. Anything earlier means that the clock is not set yet.
 
-static IotclConfig lib_config = {0};
-static IotConnectClientConfig config = {0};
+// One device identity. The functions without a context argument use default_context.
+struct IotConnectContextTag {
+    IotclConfig lib_config;
+    IotConnectClientConfig config;
+    IotcTransport *transport;
+    IotclContext lib; // the default lib context for default_context, or else lib_context. NULL until initialized.
+    struct IotclContextTag lib_context;
+    IotcMqttClient mqtt;
 
-// cached discovery/sync response:
-static IotclDiscoveryResponse *discovery_response = NULL;
-static IotclSyncResponse *sync_response = NULL;
+    // cached discovery/sync response:
+    IotclDiscoveryResponse *discovery_response;
+    IotclSyncResponse *sync_response;
+    bool responses_cached; // restored from persistence, so the SAS token or the broker may be out of date
 
-static void dump_response(const char *message, IotConnectHttpResponse *response) {
-    printf("%s", message);
-    if (response->data) {
-        printf(" Response was:\n----\n%s\n----\n", response->data);
+    // telemetry batching. The batch is written directly into batch_buffer as samples are added.
+    char *batch_buffer;
+    size_t batch_buffer_size;
+    IotclTelemetryWriter batch_writer;
+    size_t batch_count;
+    unsigned long batch_start_ms;
+    IotcBatchStats batch_stats; // kept across re-initialization
+    size_t max_payload_size; // largest QoS 0 payload that fits into the MQTT buffer along with the topic. 0 until initialized.
+
+    // iotconnect_sdk_reserve_packet() hands out the transport transmit buffer if it can, or else packet_buffer
+    char *packet_buffer; // batch_buffer_size bytes, allocated on first use
+    char *reserved_packet;
+    size_t reserved_size;
+    bool reserved_in_transport;
+
+    // store-and-forward. Allocated once and kept across re-initialization, so that nothing is lost on reconnect.
+    IotcOfflineStore offline_store;
+    unsigned long offline_last_drain_ms;
+
+    // TLS session of the last MQTT connection. Kept across re-initialization.
+    IotcTlsSessionCache tls_session_cache;
+
+    // routes command events to the handlers in config.command_routes
+    IotcCommandRouter command_router;
+
+    // cloud events waiting for iotconnect_sdk_dispatch(). Also kept across re-initialization.
+    IotcEventQueue event_queue;
+};
+
+static struct IotConnectContextTag default_context;
+
+// maps iotc_transport_millis() to UTC for iotconnect_sdk_timestamp(). Shared by all contexts.
+// Synced from the system time periodically, in case that it was set or adjusted after init, like with SNTP.
+static IotclClock sdk_clock = {0};
+static unsigned long clock_last_sync_ms = 0;
+
+static void dump_response(const char *message, const char *response) {
+    if (response) {
+        size_t len = strlen(response);
+        (void) len; // unused if error messages are compiled out
+        IOTCL_ERROR("%s Response was (%u bytes): %.*s%s", message, (unsigned int) len,
+                    IOTCL_LOG_PAYLOAD(len), response, len > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? "..." : "");
     } else {
-        printf(" Response was empty\n");
+        IOTCL_ERROR("%s Response was empty", message);
     }
 }
 
 static void report_sync_error(IotclSyncResponse *response, const char *sync_response_str) {
     if (NULL == response) {
-        printf("Failed to obtain sync response?\n");
+        IOTCL_ERROR("Failed to obtain sync response?");
         return;
     }
     switch (response->ds) {
         case IOTCL_SR_DEVICE_NOT_REGISTERED:
-            printf("IOTC_SyncResponse error: Not registered\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Not registered");
             break;
         case IOTCL_SR_AUTO_REGISTER:
-            printf("IOTC_SyncResponse error: Auto Register\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Auto Register");
             break;
         case IOTCL_SR_DEVICE_NOT_FOUND:
-            printf("IOTC_SyncResponse error: Device not found\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Device not found");
             break;
         case IOTCL_SR_DEVICE_INACTIVE:
-            printf("IOTC_SyncResponse error: Device inactive\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Device inactive");
             break;
         case IOTCL_SR_DEVICE_MOVED:
-            printf("IOTC_SyncResponse error: Device moved\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Device moved");
             break;
         case IOTCL_SR_CPID_NOT_FOUND:
-            printf("IOTC_SyncResponse error: CPID not found\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: CPID not found");
             break;
         case IOTCL_SR_UNKNOWN_DEVICE_STATUS:
-            printf("IOTC_SyncResponse error: Unknown device status error from server\n");
+            IOTCL_ERROR("IOTC_SyncResponse error: Unknown device status error from server");
             break;
         case IOTCL_SR_ALLOCATION_ERROR:
-            printf("IOTC_SyncResponse internal error: Allocation Error\n");
+            IOTCL_ERROR("IOTC_SyncResponse internal error: Allocation Error");
             break;
         case IOTCL_SR_PARSING_ERROR:
-            printf("IOTC_SyncResponse internal error: Parsing error. Please check parameters passed to the request.\n");
+            IOTCL_ERROR("IOTC_SyncResponse internal error: Parsing error. Please check parameters passed to the request.");
             break;
         default:
-            printf("WARN: report_sync_error called, but no error returned?\n");
+            IOTCL_WARN("WARN: report_sync_error called, but no error returned?");
             break;
     }
-    printf("Raw server response was:\n--------------\n%s\n--------------\n", sync_response_str);
+    size_t len = sync_response_str ? strlen(sync_response_str) : 0;
+    (void) len; // unused if debug messages are compiled out
+    IOTCL_DEBUG("Raw server response was (%u bytes): %.*s%s", (unsigned int) len,
+                IOTCL_LOG_PAYLOAD(len), sync_response_str ? sync_response_str : "",
+                len > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? "..." : "");
 }
 
-static IotclDiscoveryResponse *run_http_discovery(Client *net, const char *cpid, const char *env) {
+// Response bodies are allocated by the transport, but counted while the SDK holds them
+static void track_response(const char *response) {
+    if (response) {
+        iotcl_mem_track(IOTCL_MEM_DISCOVERY, strlen(response) + 1);
+    }
+}
+
+static void free_response(char *response) {
+    if (response) {
+        iotcl_mem_untrack(IOTCL_MEM_DISCOVERY, strlen(response) + 1);
+    }
+    free(response);
+}
+
+static IotclDiscoveryResponse *run_http_discovery(IotConnectContext ctx, const char *cpid, const char *env) {
     char *json_start = NULL;
     IotclDiscoveryResponse *ret = NULL;
-    char *url_buff = (char *) malloc(sizeof(HTTP_DISCOVERY_URL_FORMAT) +
+    char *url_buff = (char *) iotcl_mem_malloc(IOTCL_MEM_DISCOVERY, sizeof(HTTP_DISCOVERY_URL_FORMAT) +
                             sizeof(IOTCONNECT_DISCOVERY_HOSTNAME) +
                             strlen(cpid) +
                             strlen(env) - 4 /* %s x 2 */
@@ -88,57 +166,54 @@ static IotclDiscoveryResponse *run_http_discovery(Client *net, const char *cpid,
             IOTCONNECT_DISCOVERY_HOSTNAME, cpid, env
     );
 
-    IotConnectHttpResponse response;
-    iotconnect_https_request(
-        net,
-        &response,
-        url_buff,
-        NULL
-    );
+    char *response = NULL;
+    ctx->transport->http_request(ctx->transport->ctx, url_buff, NULL, &response);
+    iotcl_mem_free(url_buff);
+    track_response(response);
 
-    if (NULL == response.data) {
-        dump_response("Unable to parse HTTP response,", &response);
+    if (NULL == response) {
+        dump_response("Unable to parse HTTP response,", response);
         goto cleanup;
     }
-    json_start = strstr(response.data, "{");
+    json_start = strstr(response, "{");
     if (NULL == json_start) {
-        dump_response("No json response from server.", &response);
+        dump_response("No json response from server.", response);
         goto cleanup;
     }
-    if (json_start != response.data) {
-        dump_response("WARN: Expected JSON to start immediately in the returned data.", &response);
+    if (json_start != response) {
+        dump_response("WARN: Expected JSON to start immediately in the returned data.", response);
     }
 
     ret = iotcl_discovery_parse_discovery_response(json_start);
     if (!ret) {
-        printf("Error: Unable to get discovery response for environment \"%s\". Please check the environment name in the key vault.\n", env);
+        IOTCL_ERROR("Error: Unable to get discovery response for environment \"%s\". Please check the environment name in the key vault.", env);
     }
 
     // fall through
     cleanup:
-    iotconnect_free_https_response(&response);
+    free_response(response);
     return ret;
 }
 
-static IotclSyncResponse *run_http_sync(Client *net, const char *cpid, const char *uniqueid) {
+static IotclSyncResponse *run_http_sync(IotConnectContext ctx, const char *cpid, const char *uniqueid) {
     char *json_start = NULL;
     IotclSyncResponse *ret = NULL;
-    char *url_buff = (char *)malloc(sizeof(HTTP_SYNC_URL_FORMAT) +
-                            strlen(discovery_response->host) +
-                            strlen(discovery_response->path)
+    char *url_buff = (char *) iotcl_mem_malloc(IOTCL_MEM_DISCOVERY, sizeof(HTTP_SYNC_URL_FORMAT) +
+                            strlen(ctx->discovery_response->host) +
+                            strlen(ctx->discovery_response->path)
     );
-    char *post_data = (char *)malloc(IOTCONNECT_DISCOVERY_PROTOCOL_POST_DATA_MAX_LEN + 1);
+    char *post_data = (char *) iotcl_mem_malloc(IOTCL_MEM_DISCOVERY, IOTCONNECT_DISCOVERY_PROTOCOL_POST_DATA_MAX_LEN + 1);
 
     if (!url_buff || !post_data) {
-        printf("run_http_sync: Out of memory!");
-        free(url_buff); // one of them could have succeeded
-        free(post_data);
+        IOTCL_ERROR("run_http_sync: Out of memory!");
+        iotcl_mem_free(url_buff); // one of them could have succeeded
+        iotcl_mem_free(post_data);
         return NULL;
     }
 
     sprintf(url_buff, HTTP_SYNC_URL_FORMAT,
-            discovery_response->host,
-            discovery_response->path
+            ctx->discovery_response->host,
+            ctx->discovery_response->path
     );
     snprintf(post_data,
              IOTCONNECT_DISCOVERY_PROTOCOL_POST_DATA_MAX_LEN, /*total length should not exceed MTU size*/
@@ -147,239 +222,917 @@ static IotclSyncResponse *run_http_sync(Client *net, const char *cpid, const cha
              uniqueid
     );
 
-    IotConnectHttpResponse response;
-    iotconnect_https_request(
-        net,
-        &response,
-        url_buff,
-        post_data
-    );
+    char *response = NULL;
+    ctx->transport->http_request(ctx->transport->ctx, url_buff, post_data, &response);
 
-    free(url_buff);
-    free(post_data);
+    iotcl_mem_free(url_buff);
+    iotcl_mem_free(post_data);
+    track_response(response);
 
-    if (NULL == response.data) {
-        dump_response("Unable to parse HTTP response.", &response);
+    if (NULL == response) {
+        dump_response("Unable to parse HTTP response.", response);
         goto cleanup;
     }
-    json_start = strstr(response.data, "{");
+    json_start = strstr(response, "{");
     if (NULL == json_start) {
-        dump_response("No json response from server.", &response);
+        dump_response("No json response from server.", response);
         goto cleanup;
     }
-    if (json_start != response.data) {
-        dump_response("WARN: Expected JSON to start immediately in the returned data.", &response);
+    if (json_start != response) {
+        dump_response("WARN: Expected JSON to start immediately in the returned data.", response);
     }
 
     ret = iotcl_discovery_parse_sync_response(json_start);
     if (!ret || ret->ds != IOTCL_SR_OK) {
-        if (config.auth_info.type == IOTC_AT_TPM && ret && ret->ds == IOTCL_SR_DEVICE_NOT_REGISTERED) {
+        if (ctx->config.auth_info.type == IOTC_AT_TPM && ret && ret->ds == IOTCL_SR_DEVICE_NOT_REGISTERED) {
             // malloc below will be freed when we iotcl_discovery_free_sync_response
-            ret->broker.client_id = (char *) malloc(strlen(uniqueid) + 1 /* - */ + strlen(cpid) + 1);
+            ret->broker.client_id = (char *) iotcl_mem_malloc(
+                    IOTCL_MEM_DISCOVERY, strlen(uniqueid) + 1 /* - */ + strlen(cpid) + 1
+            );
             sprintf(ret->broker.client_id, "%s-%s", cpid, uniqueid);
-            printf("TPM Device is not yet enrolled. Enrolling...\n");
+            IOTCL_INFO("TPM Device is not yet enrolled. Enrolling...");
         } else {
-            report_sync_error(ret, response.data);
+            report_sync_error(ret, response);
             iotcl_discovery_free_sync_response(ret);
             ret = NULL;
         }
     }
 
     cleanup:
-    iotconnect_free_https_response(&response);
+    free_response(response);
     // fall through
 
     return ret;
 }
 
-static void on_mqtt_c2d_message(unsigned char *message, size_t message_len) {
-    char *str = (char *)malloc(message_len + 1);
-    memcpy(str, message, message_len);
-    str[message_len] = 0;
-    printf("event>>> %s\n", str);
-    if (!iotcl_process_event(str)) {
-        printf("Error encountered while processing %s\n", str);
+// Frees the kept-alive HTTP connection once discovery and sync are done, before MQTT connects
+static void http_close(IotConnectContext ctx) {
+    if (ctx->transport && ctx->transport->http_close) {
+        ctx->transport->http_close(ctx->transport->ctx);
     }
-    free(str);
 }
 
-void iotconnect_sdk_disconnect() {
-    printf("Disconnecting...\n");
-    if (0 == iotc_mqtt_client_disconnect()) {
-        printf("Disconnected.\n");
+static void clock_sync() {
+    clock_last_sync_ms = iotc_transport_millis();
+    iotcl_clock_sync(&sdk_clock, iotcl_utc_ms_now(), clock_last_sync_ms);
+}
+
+size_t iotconnect_sdk_timestamp(char buffer[IOTCL_ISO_TIMESTAMP_SIZE]) {
+    if (!iotcl_clock_is_synced(&sdk_clock)) {
+        clock_sync();
     }
+    return iotcl_clock_timestamp(&sdk_clock, iotc_transport_millis(), buffer);
 }
 
-bool iotconnect_sdk_is_connected() {
-    return iotc_mqtt_client_is_connected();
+void iotconnect_sdk_get_mem_stats(IotclMemStats *stats) {
+    iotcl_mem_get_stats(stats);
 }
 
-IotConnectClientConfig *iotconnect_sdk_init_and_get_config() {
-    memset(&config, 0, sizeof(config));
-    return &config;
+void iotconnect_sdk_get_tls_stats_ctx(IotConnectContext ctx, IotcTlsStats *stats) {
+    memset(stats, 0, sizeof(IotcTlsStats));
+    if (ctx->transport && ctx->transport->get_tls_stats) {
+        ctx->transport->get_tls_stats(ctx->transport->ctx, stats);
+    }
+    iotc_mqtt_client_get_tls_stats(&ctx->mqtt, stats);
 }
 
-IotclConfig *iotconnect_sdk_get_lib_config() {
-    return iotcl_get_config();
+static void free_responses(IotConnectContext ctx) {
+    iotcl_discovery_free_discovery_response(ctx->discovery_response);
+    iotcl_discovery_free_sync_response(ctx->sync_response);
+    ctx->discovery_response = NULL;
+    ctx->sync_response = NULL;
+    ctx->responses_cached = false;
+}
+
+static void cache_save(IotConnectContext ctx) {
+    if (!ctx->config.persistence || !ctx->config.persistence->save) {
+        return;
+    }
+    char *data = iotcl_discovery_create_cache(ctx->discovery_response, ctx->sync_response, time(NULL));
+    if (!data) {
+        IOTCL_WARN("WARN: Unable to create the discovery cache.");
+        return;
+    }
+    ctx->config.persistence->save(ctx->config.persistence->ctx, data);
+    free(data);
+}
+
+static void cache_erase(IotConnectContext ctx) {
+    if (ctx->config.persistence && ctx->config.persistence->save) {
+        ctx->config.persistence->save(ctx->config.persistence->ctx, NULL);
+    }
+}
+
+// Restores the discovery and sync responses from persistent storage. Returns true if they were restored.
+static bool cache_load(IotConnectContext ctx) {
+    if (!ctx->config.persistence || !ctx->config.persistence->load) {
+        return false;
+    }
+    char *data = ctx->config.persistence->load(ctx->config.persistence->ctx);
+    if (!data) {
+        return false;
+    }
+    time_t saved_at = 0;
+    bool restored = iotcl_discovery_parse_cache(data, &ctx->discovery_response, &ctx->sync_response, &saved_at);
+    free(data);
+    if (!restored) {
+        IOTCL_WARN("Discovery cache is invalid. Discarding it.");
+        cache_erase(ctx);
+        return false;
+    }
+
+    // If the clock is not set yet, the age is unknown. The cache is tried anyway,
+    // because a failed connection will fall back to discovery and sync.
+    time_t now = time(NULL);
+    unsigned long ttl = ctx->config.cache_ttl_s ? ctx->config.cache_ttl_s : DEFAULT_CACHE_TTL_S;
+    if (now >= MIN_VALID_EPOCH && saved_at >= MIN_VALID_EPOCH && now > saved_at && (unsigned long) (now - saved_at) > ttl) {
+        IOTCL_INFO("Discovery cache expired.");
+        free_responses(ctx);
+        return false;
+    }
+    IOTCL_INFO("Using cached discovery and sync responses.");
+    ctx->responses_cached = true;
+    return true;
+}
+
+// The SDK instance that received the event. Set as the user data of the lib configuration.
+static IotConnectContext get_event_sdk_context(IotclEventData data) {
+    return (IotConnectContext) iotcl_context_get_config(iotcl_event_get_context(data))->user_data;
+}
+
+// The message is parsed straight out of the MQTT client receive buffer
+static void on_mqtt_c2d_message(const unsigned char *message, size_t message_len, void *user_data) {
+    IotConnectContext ctx = (IotConnectContext) user_data;
+    const char *str = (const char *) message;
+    IOTCL_DEBUG("event>>> %.*s%s", IOTCL_LOG_PAYLOAD(message_len), str,
+                message_len > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? "..." : "");
+    if (!iotcl_process_event_with_length_ctx(ctx->lib, str, message_len)) {
+        IOTCL_ERROR("Error encountered while processing %.*s%s", IOTCL_LOG_PAYLOAD(message_len), str,
+                    message_len > CONFIG_IOTCONNECT_LOG_PAYLOAD_MAX ? "..." : "");
+    }
+}
+
+void iotconnect_sdk_disconnect_ctx(IotConnectContext ctx) {
+    IOTCL_INFO("Disconnecting...");
+    if (0 == iotc_mqtt_client_disconnect(&ctx->mqtt)) {
+        IOTCL_INFO("Disconnected.");
+    }
+    iotcl_log_flush(0);
+}
+
+bool iotconnect_sdk_is_connected_ctx(IotConnectContext ctx) {
+    return iotc_mqtt_client_is_connected(&ctx->mqtt);
+}
+
+IotConnectConnectionState iotconnect_sdk_get_connection_state_ctx(IotConnectContext ctx) {
+    return iotc_mqtt_client_get_state(&ctx->mqtt);
+}
+
+static void on_mqtt_status(IotConnectConnectionStatus status, void *user_data) {
+    IotConnectContext ctx = (IotConnectContext) user_data;
+    if (ctx->config.status_cb) {
+        ctx->config.status_cb(status);
+    }
+    if (ctx->config.context_status_cb) {
+        ctx->config.context_status_cb(ctx, status);
+    }
+}
+
+IotConnectClientConfig *iotconnect_sdk_init_and_get_config_ctx(IotConnectContext ctx) {
+    memset(&ctx->config, 0, sizeof(ctx->config));
+    return &ctx->config;
+}
+
+IotclConfig *iotconnect_sdk_get_lib_config_ctx(IotConnectContext ctx) {
+    return iotcl_context_get_config(ctx->lib);
+}
+
+void *iotconnect_sdk_get_user_data(IotConnectContext ctx) {
+    return ctx->config.user_data;
+}
+
+IotclContext iotconnect_sdk_get_lib_context(IotConnectContext ctx) {
+    return ctx->lib;
+}
+
+IotConnectContext iotconnect_sdk_get_event_context(IotclEventData data) {
+    if (!iotcl_context_get_config(iotcl_event_get_context(data))) {
+        return NULL;
+    }
+    return get_event_sdk_context(data);
+}
+
+// Runs the handler for the command and acks the command with the handler's result
+static void route_command(IotclEventData data) {
+    IotConnectContext ctx = get_event_sdk_context(data);
+    const char *message = NULL;
+    const char *command = iotcl_get_command(data);
+    bool success = iotc_command_router_execute(&ctx->command_router, command, &message);
+    if (!success) {
+        IOTCL_ERROR("Command \"%s\" failed: %s", command ? command : "", message);
+    }
+    // acks are sent with QoS 1, so that the cloud does not miss the command result
+    char ack[COMMAND_ACK_BUFFER_SIZE];
+    if (0 != iotcl_create_ack_into(ack, sizeof(ack), data, success, message)) {
+        iotcl_destroy_event(data);
+        iotconnect_sdk_send_packet_qos_ctx(ctx, ack, 1);
+        return;
+    }
+    // large ack IDs or messages
+    char *large_ack = iotcl_create_ack_string_and_destroy_event(data, success, message);
+    if (large_ack) {
+        iotconnect_sdk_send_packet_qos_ctx(ctx, large_ack, 1);
+        free(large_ack);
+    }
+}
+
+static IotclCommandCallback get_command_callback(IotConnectContext ctx) {
+    return ctx->command_router.slots ? route_command : ctx->config.cmd_cb;
+}
+
+static void reject_event(IotConnectContext ctx, IotclEventData data, IotConnectEventType type) {
+    IOTCL_WARN("WARN: Event queue is full. Rejecting event type 0x%02x.", (unsigned int) type);
+    if (type != DEVICE_COMMAND && type != DEVICE_OTA) {
+        iotcl_destroy_event(data);
+        return;
+    }
+    // let the cloud know that the command was not executed
+    char *ack = iotcl_create_ack_string_and_destroy_event(data, false, "Device busy");
+    if (ack) {
+        iotconnect_sdk_send_packet_qos_ctx(ctx, ack, 1);
+        free(ack);
+    }
+}
+
+static void queue_event(IotConnectContext ctx, IotclEventData data, IotConnectEventType type) {
+    if (!iotc_event_queue_push(&ctx->event_queue, data, type)) {
+        reject_event(ctx, data, type);
+    }
+}
+
+// Same as what the lib does when it processes an event, but from iotconnect_sdk_dispatch()
+static void dispatch_event(IotclEventData data, IotConnectEventType type, void *user_data) {
+    IotConnectContext ctx = (IotConnectContext) user_data;
+    IotclCommandCallback cmd_cb = get_command_callback(ctx);
+    if (NULL != ctx->config.msg_cb) {
+        ctx->config.msg_cb(data, type);
+    }
+    switch (type) {
+        case DEVICE_COMMAND:
+            if (NULL != cmd_cb) {
+                cmd_cb(data);
+            }
+            break;
+        case DEVICE_OTA:
+            if (NULL != ctx->config.ota_cb) {
+                ctx->config.ota_cb(data);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+size_t iotconnect_sdk_dispatch_ctx(IotConnectContext ctx, size_t max_events, unsigned long max_us) {
+    if (!ctx->event_queue.entries) {
+        return 0;
+    }
+    return iotc_event_queue_dispatch(&ctx->event_queue, max_events, max_us, dispatch_event, ctx);
+}
+
+void iotconnect_sdk_get_event_queue_stats_ctx(IotConnectContext ctx, IotcEventQueueStats *stats) {
+    if (!ctx->event_queue.entries) {
+        memset(stats, 0, sizeof(IotcEventQueueStats));
+        return;
+    }
+    iotc_event_queue_get_stats(&ctx->event_queue, stats);
 }
 
 static void on_message_intercept(IotclEventData data, IotConnectEventType type) {
+    IotConnectContext ctx = get_event_sdk_context(data);
     switch (type) {
         case ON_FORCE_SYNC:
-            iotconnect_sdk_disconnect();
-            iotcl_discovery_free_discovery_response(discovery_response);
-            iotcl_discovery_free_sync_response(sync_response);
-            sync_response = NULL;
-            discovery_response = run_http_discovery(config.net, config.cpid, config.env);
-            if (NULL == discovery_response) {
-                printf("Unable to run HTTP discovery on ON_FORCE_SYNC\n");
+            iotconnect_sdk_disconnect_ctx(ctx);
+            free_responses(ctx);
+            cache_erase(ctx);
+            ctx->discovery_response = run_http_discovery(ctx, ctx->config.cpid, ctx->config.env);
+            if (NULL == ctx->discovery_response) {
+                http_close(ctx);
+                IOTCL_ERROR("Unable to run HTTP discovery on ON_FORCE_SYNC");
                 return;
             }
-            sync_response = run_http_sync(config.net, config.cpid, config.duid);
-            if (NULL == sync_response) {
-                printf("Unable to run HTTP sync on ON_FORCE_SYNC\n");
+            ctx->sync_response = run_http_sync(ctx, ctx->config.cpid, ctx->config.duid);
+            http_close(ctx);
+            if (NULL == ctx->sync_response) {
+                IOTCL_ERROR("Unable to run HTTP sync on ON_FORCE_SYNC");
                 return;
             }
-            printf("Got ON_FORCE_SYNC. Disconnecting.\n");
-            iotconnect_sdk_disconnect(); // client will get notification that we disconnected and will reinit
+            cache_save(ctx);
+            IOTCL_INFO("Got ON_FORCE_SYNC. Disconnecting.");
+            iotconnect_sdk_disconnect_ctx(ctx); // client will get notification that we disconnected and will reinit
 
         case ON_CLOSE:
-            printf("Got a disconnect request. Closing the mqtt connection. Device restart is required.\n");
-            iotconnect_sdk_disconnect();
+            IOTCL_WARN("Got a disconnect request. Closing the mqtt connection. Device restart is required.");
+            iotconnect_sdk_disconnect_ctx(ctx);
         default:
             break; // not handling nay other messages
     }
 
-    if (NULL != config.msg_cb) {
-        config.msg_cb(data, type);
+    if (ctx->event_queue.entries) {
+        queue_event(ctx, data, type);
+    } else if (NULL != ctx->config.msg_cb) {
+        ctx->config.msg_cb(data, type);
     }
 }
 
-int iotconnect_sdk_send_packet(const char *data) {
-    return iotc_mqtt_client_send_message(data);
+static bool payload_fits(IotConnectContext ctx, size_t len, int qos) {
+    size_t overhead = qos > 0 ? IOTC_MQTT_PACKET_ID_SIZE : 0;
+    return len + overhead <= ctx->max_payload_size;
 }
 
-void iotconnect_sdk_loop() {
-    return iotc_mqtt_client_loop();
+static int send_packet(IotConnectContext ctx, const char *data, size_t len, int qos) {
+    // a message that can never be published is not stored, as it would hold up the messages behind it
+    if (ctx->max_payload_size && !payload_fits(ctx, len, qos)) {
+        IOTCL_ERROR("iotconnect_sdk_send_packet(): Message of %u bytes is too large for the MQTT buffer!", (unsigned int) len);
+        return -1;
+    }
+    if (!ctx->offline_store.ram) {
+        return iotc_mqtt_client_send_message(&ctx->mqtt, data, len, qos);
+    }
+    // while there is a backlog, new messages go behind it to preserve the order
+    if (iotc_mqtt_client_is_connected(&ctx->mqtt) && 0 == iotc_offline_store_count(&ctx->offline_store)) {
+        if (0 == iotc_mqtt_client_send_message(&ctx->mqtt, data, len, qos)) {
+            return 0;
+        }
+    }
+    if (!iotc_offline_store_push(&ctx->offline_store, data, len)) {
+        IOTCL_WARN("iotconnect_sdk_send_packet(): Message dropped. It is too large for the offline buffer.");
+        return -1;
+    }
+    return 1;
 }
 
+int iotconnect_sdk_send_packet_ctx(IotConnectContext ctx, const char *data) {
+    return send_packet(ctx, data, strlen(data), ctx->config.qos);
+}
 
-///////////////////////////////////////////////////////////////////////////////////
-// this the Initialization os IoTConnect SDK
-int iotconnect_sdk_init() {
+int iotconnect_sdk_send_packet_len_ctx(IotConnectContext ctx, const char *data, size_t len) {
+    return send_packet(ctx, data, len, ctx->config.qos);
+}
+
+int iotconnect_sdk_send_packet_qos_ctx(IotConnectContext ctx, const char *data, int qos) {
+    return send_packet(ctx, data, strlen(data), qos);
+}
+
+char *iotconnect_sdk_reserve_packet_ctx(IotConnectContext ctx, size_t *size) {
+    ctx->reserved_packet = NULL;
+    // The transport buffer can only be used if the message will be sent right away with QoS 0.
+    // Otherwise, it would have to be copied anyway.
+    if (ctx->config.qos <= 0 && iotc_mqtt_client_is_connected(&ctx->mqtt)
+        && (!ctx->offline_store.ram || 0 == iotc_offline_store_count(&ctx->offline_store))) {
+        ctx->reserved_packet = iotc_mqtt_client_reserve(&ctx->mqtt, size);
+    }
+    ctx->reserved_in_transport = NULL != ctx->reserved_packet;
+    if (!ctx->reserved_packet) {
+        if (!ctx->packet_buffer && ctx->batch_buffer_size) {
+            ctx->packet_buffer = (char *) iotcl_mem_malloc(IOTCL_MEM_TELEMETRY, ctx->batch_buffer_size);
+        }
+        if (!ctx->packet_buffer) {
+            IOTCL_ERROR("iotconnect_sdk_reserve_packet(): SDK not initialized or out of memory!");
+            return NULL;
+        }
+        ctx->reserved_packet = ctx->packet_buffer;
+        *size = ctx->batch_buffer_size;
+    }
+    ctx->reserved_size = *size;
+    return ctx->reserved_packet;
+}
+
+int iotconnect_sdk_commit_packet_ctx(IotConnectContext ctx, size_t len) {
+    char *data = ctx->reserved_packet;
+    ctx->reserved_packet = NULL;
+    if (!data) {
+        IOTCL_ERROR("iotconnect_sdk_commit_packet(): No packet was reserved!");
+        return -2;
+    }
+    if (0 == len || len > ctx->reserved_size) {
+        IOTCL_ERROR("iotconnect_sdk_commit_packet(): Invalid length %u for a reserved size of %u!",
+                    (unsigned int) len, (unsigned int) ctx->reserved_size);
+        return -1;
+    }
+    if (ctx->reserved_in_transport && 0 == iotc_mqtt_client_commit(&ctx->mqtt, len)) {
+        return 0;
+    }
+    // The data is still in the buffer, in case that the transport failed to send it
+    return send_packet(ctx, data, len, ctx->config.qos);
+}
+
+void iotconnect_sdk_get_publish_stats_ctx(IotConnectContext ctx, IotcPublishStats *stats) {
+    iotc_mqtt_client_get_publish_stats(&ctx->mqtt, stats);
+}
+
+void iotconnect_sdk_get_offline_stats_ctx(IotConnectContext ctx, IotcOfflineStoreStats *stats) {
+    if (!ctx->offline_store.ram) {
+        memset(stats, 0, sizeof(IotcOfflineStoreStats));
+        return;
+    }
+    iotc_offline_store_get_stats(&ctx->offline_store, stats);
+}
+
+static int offline_send(const char *data, size_t len, void *user_data) {
+    IotConnectContext ctx = (IotConnectContext) user_data;
+    if (!payload_fits(ctx, len, ctx->config.qos)) {
+        // stored before the buffer size or the topic changed, or read back from the backend after a reboot
+        IOTCL_WARN("Stored message of %u bytes is too large for the MQTT buffer. Dropping it.", (unsigned int) len);
+        return IOTC_STORE_SEND_REJECTED;
+    }
+    int ret = iotc_mqtt_client_send_message(&ctx->mqtt, data, len, ctx->config.qos);
+    // -3 is a full QoS 1 in-flight window. Like a lost connection, it is not a problem with the message.
+    if (0 != ret && (-3 == ret || !iotc_mqtt_client_is_connected(&ctx->mqtt))) {
+        return IOTC_STORE_SEND_BUSY;
+    }
+    if (0 != ret) {
+        IOTCL_WARN("Failed to send a stored message of %u bytes. Error %d.", (unsigned int) len, ret);
+    }
+    return ret;
+}
+
+static void offline_drain(IotConnectContext ctx) {
+    unsigned long interval = ctx->config.offline_drain_interval_ms ? ctx->config.offline_drain_interval_ms : DEFAULT_OFFLINE_DRAIN_INTERVAL_MS;
+    size_t max_messages = ctx->config.offline_drain_per_loop ? ctx->config.offline_drain_per_loop : DEFAULT_OFFLINE_DRAIN_PER_LOOP;
+    if (!ctx->offline_store.ram || !iotc_mqtt_client_is_connected(&ctx->mqtt) || 0 == iotc_offline_store_count(&ctx->offline_store)) {
+        return;
+    }
+    if (iotc_transport_millis() - ctx->offline_last_drain_ms < interval) {
+        return;
+    }
+    ctx->offline_last_drain_ms = iotc_transport_millis();
+    iotc_offline_store_drain(&ctx->offline_store, max_messages, offline_send, ctx);
+}
+
+static void batch_deinit(IotConnectContext ctx) {
+    iotcl_mem_free(ctx->packet_buffer);
+    ctx->packet_buffer = NULL;
+    ctx->reserved_packet = NULL;
+    ctx->reserved_size = 0;
+    iotcl_mem_free(ctx->batch_buffer);
+    ctx->batch_buffer = NULL;
+    ctx->batch_buffer_size = 0;
+    ctx->batch_count = 0;
+    ctx->max_payload_size = 0;
+}
+
+static int batch_init(IotConnectContext ctx) {
+    size_t mqtt_buffer_size = ctx->config.mqtt_buffer_size ? ctx->config.mqtt_buffer_size : IOTC_MQTT_DEFAULT_BUFFER_SIZE;
+    size_t overhead = IOTC_MQTT_PUBLISH_OVERHEAD + strlen(ctx->sync_response->broker.pub_topic);
+    // so that a full batch still fits into a QoS 1 packet
+    size_t qos_overhead = ctx->config.qos > 0 ? IOTC_MQTT_PACKET_ID_SIZE : 0;
+    batch_deinit(ctx);
+    if (mqtt_buffer_size <= overhead + qos_overhead) {
+        IOTCL_ERROR("Error: MQTT buffer size is too small for the publish topic.");
+        return -1;
+    }
+    ctx->batch_buffer_size = mqtt_buffer_size - overhead - qos_overhead;
+    ctx->batch_buffer = (char *) iotcl_mem_malloc(IOTCL_MEM_TELEMETRY, ctx->batch_buffer_size);
+    if (!ctx->batch_buffer) {
+        IOTCL_ERROR("Error: Unable to allocate the telemetry batch buffer.");
+        ctx->batch_buffer_size = 0;
+        return -1;
+    }
+    ctx->max_payload_size = mqtt_buffer_size - overhead;
+    return 0;
+}
+
+int iotconnect_sdk_batch_flush_ctx(IotConnectContext ctx) {
+    size_t count = ctx->batch_count;
+    if (0 == count) {
+        return 0;
+    }
+    // The finished message cannot take more samples, so the batch is started over whether it is sent or not
+    ctx->batch_count = 0;
+    size_t len = iotcl_telemetry_writer_finish(&ctx->batch_writer);
+    int ret = len ? send_packet(ctx, ctx->batch_buffer, len, ctx->config.qos) : -1;
+    if (ret < 0) {
+        IOTCL_WARN("iotconnect_sdk_batch_flush(): Batch of %u samples dropped. Error %d.", (unsigned int) count, ret);
+        ctx->batch_stats.dropped++;
+        ctx->batch_stats.dropped_samples += count;
+        return ret;
+    }
+    ctx->batch_stats.sent++;
+    return ret;
+}
+
+void iotconnect_sdk_get_batch_stats_ctx(IotConnectContext ctx, IotcBatchStats *stats) {
+    *stats = ctx->batch_stats;
+}
+
+// Writes the sample into the batch. Returns false and leaves the batch untouched if the sample did not fit.
+static bool batch_write_sample(IotConnectContext ctx, const char *iso_time, IotConnectSampleCallback write_values, void *user_data) {
+    if (0 == ctx->batch_count) {
+        if (!iotcl_telemetry_writer_init_ctx(ctx->lib, &ctx->batch_writer, ctx->batch_buffer, ctx->batch_buffer_size)) {
+            return false;
+        }
+    }
+    IotclTelemetryWriter checkpoint = ctx->batch_writer; // the writer is a plain struct, so copying it saves its state
+    iotcl_telemetry_writer_add_with_iso_time(&ctx->batch_writer, iso_time);
+    write_values(&ctx->batch_writer, user_data);
+
+    // make sure that there is still room to close the message by finishing a copy
+    IotclTelemetryWriter probe = ctx->batch_writer;
+    if (0 == iotcl_telemetry_writer_finish(&probe)) {
+        ctx->batch_writer = checkpoint;
+        return false;
+    }
+    return true;
+}
+
+int iotconnect_sdk_batch_add_sample_ctx(IotConnectContext ctx, const char *iso_time, IotConnectSampleCallback write_values, void *user_data) {
+    if (!ctx->batch_buffer) {
+        IOTCL_ERROR("iotconnect_sdk_batch_add_sample(): SDK not initialized!");
+        return -2;
+    }
+    if (!write_values) {
+        return -1;
+    }
+    char now[IOTCL_ISO_TIMESTAMP_SIZE];
+    if (!iso_time) {
+        iotconnect_sdk_timestamp(now);
+        iso_time = now;
+    }
+    int ret = 0;
+    if (!batch_write_sample(ctx, iso_time, write_values, user_data)) {
+        if (0 == ctx->batch_count) {
+            IOTCL_ERROR("iotconnect_sdk_batch_add_sample(): Sample does not fit into the MQTT buffer!");
+            return -1;
+        }
+        // send what we have and start a new batch with this sample
+        ret = iotconnect_sdk_batch_flush_ctx(ctx);
+        if (!batch_write_sample(ctx, iso_time, write_values, user_data)) {
+            IOTCL_ERROR("iotconnect_sdk_batch_add_sample(): Sample does not fit into the MQTT buffer!");
+            return -1;
+        }
+    }
+    if (0 == ctx->batch_count) {
+        ctx->batch_start_ms = iotc_transport_millis();
+    }
+    ctx->batch_count++;
+    if (ctx->batch_count >= ctx->config.batch_max_samples) {
+        return iotconnect_sdk_batch_flush_ctx(ctx);
+    }
+    return ret; // the result of sending the previous batch, if this sample started a new one
+}
+
+static int sdk_init(IotConnectContext ctx);
+
+// The cached SAS token or broker may have expired or changed since the responses were cached
+static void refresh_cached_responses(IotConnectContext ctx) {
+    IOTCL_WARN("Unable to reconnect with the cached broker information. Running discovery and sync.");
+    if (ctx->batch_count > 0) {
+        iotconnect_sdk_batch_flush_ctx(ctx); // stored, or else dropped and counted, before the batch buffer is set up again
+    }
+    iotc_mqtt_client_disconnect(&ctx->mqtt); // the MQTT client refers to the sync response
+    free_responses(ctx);
+    cache_erase(ctx);
+    if (0 != sdk_init(ctx)) {
+        IOTCL_ERROR("Discovery and sync failed. The SDK needs to be initialized again.");
+    }
+}
+
+void iotconnect_sdk_loop_ctx(IotConnectContext ctx) {
+    if (ctx->batch_count > 0) {
+        unsigned long max_latency = ctx->config.batch_max_latency_ms ? ctx->config.batch_max_latency_ms : DEFAULT_BATCH_MAX_LATENCY_MS;
+        if (iotc_transport_millis() - ctx->batch_start_ms >= max_latency) {
+            iotconnect_sdk_batch_flush_ctx(ctx); // a failure is logged and counted in the batch stats
+        }
+    }
+    iotc_mqtt_client_loop(&ctx->mqtt);
+    if (ctx->responses_cached && iotc_mqtt_client_get_failed_connects(&ctx->mqtt) >= CACHED_MAX_FAILED_CONNECTS) {
+        refresh_cached_responses(ctx);
+    }
+    offline_drain(ctx);
+    if (iotc_transport_millis() - clock_last_sync_ms >= CLOCK_SYNC_INTERVAL_MS) {
+        clock_sync();
+    }
+    // printing to a serial port is slow, so only a few lines are written each time
+    iotcl_log_flush(LOG_FLUSH_PER_LOOP);
+}
+
+
+static bool lib_init(IotConnectContext ctx) {
+    // The default context keeps using the default lib context, so that iotcl_get_config()
+    // and the lib functions without a context work for applications with a single device.
+    ctx->lib = ctx == &default_context ? iotcl_get_default_context() : &ctx->lib_context;
+    return iotcl_context_init(ctx->lib, &ctx->lib_config);
+}
+
+static int sdk_init(IotConnectContext ctx) {
     int ret;
 
-    if (!config.net)  {
-        printf("A network interface (client) must be configured.\n");
+    ctx->transport = ctx->config.transport;
+    if (!ctx->transport) {
+#ifdef ARDUINO
+        if (!ctx->config.net)  {
+            IOTCL_ERROR("A network interface (client) must be configured.");
+            return -1;
+        }
+        if (ctx != &default_context) {
+            // the PubSubClient transport is a single instance per board
+            IOTCL_ERROR("A transport must be configured for each additional SDK context.");
+            return -1;
+        }
+        ctx->transport = iotc_transport_arduino_get(ctx->config.net, ctx->config.mqtt_buffer_size);
+#else
+        IOTCL_ERROR("A transport must be configured.");
         return -1;
+#endif
     }
-    if (config.auth_info.type == IOTC_AT_TPM)  {
-        printf("TPM authentication type is not supported by the SDK.\n");
+    if (ctx->config.auth_info.type == IOTC_AT_TPM)  {
+        IOTCL_ERROR("TPM authentication type is not supported by the SDK.");
         return -1;
     }
-    if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
-        printf("Symmetric Key authentication type is not supported by the SDK.\n");
+    if (ctx->config.auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
+        IOTCL_ERROR("Symmetric Key authentication type is not supported by the SDK.");
         return -1;
     }
 
-    if (config.auth_info.type == IOTC_AT_X509) {
-        config.net->setCertificate(config.auth_info.data.cert_info.device_cert);
-        config.net->setPrivateKey(config.auth_info.data.cert_info.device_key);
+#ifdef ARDUINO
+    if (!ctx->config.transport && ctx->config.auth_info.type == IOTC_AT_X509) {
+        ctx->config.net->setCertificate(ctx->config.auth_info.data.cert_info.device_cert);
+        ctx->config.net->setPrivateKey(ctx->config.auth_info.data.cert_info.device_key);
     }
+#endif
 
-    if (!discovery_response) {
-        discovery_response = run_http_discovery(config.net, config.cpid, config.env);
-        if (NULL == discovery_response) {
+    if (!ctx->discovery_response) {
+        ctx->discovery_response = run_http_discovery(ctx, ctx->config.cpid, ctx->config.env);
+        if (NULL == ctx->discovery_response) {
             // get_base_url will print the error
+            http_close(ctx);
             return -1;
         }
-        printf("Discovery response parsing successful.\n");
+        IOTCL_INFO("Discovery response parsing successful.");
     }
 
-    if (!sync_response) {
-        sync_response = run_http_sync(config.net, config.cpid, config.duid);
-        if (NULL == sync_response) {
+    if (!ctx->sync_response) {
+        // the sync request reuses the discovery connection, if the host is the same
+        ctx->sync_response = run_http_sync(ctx, ctx->config.cpid, ctx->config.duid);
+        http_close(ctx);
+        if (NULL == ctx->sync_response) {
             // Sync_call will print the error
             return -2;
         }
-        printf("Sync response parsing successful.\n");
+        IOTCL_INFO("Sync response parsing successful.");
+        cache_save(ctx);
     }
 
     // We want to print only first 4 characters of cpid
-    lib_config.device.env = config.env;
-    lib_config.device.cpid = config.cpid;
-    lib_config.device.duid = config.duid;
+    ctx->lib_config.device.env = ctx->config.env;
+    ctx->lib_config.device.cpid = ctx->config.cpid;
+    ctx->lib_config.device.duid = ctx->config.duid;
 
-    if (!config.env || !config.cpid || !config.duid) {
-        printf("Error: Device configuration is invalid. Configuration values for env, cpid and duid are required.\n");
+    if (!ctx->config.env || !ctx->config.cpid || !ctx->config.duid) {
+        IOTCL_ERROR("Error: Device configuration is invalid. Configuration values for env, cpid and duid are required.");
         return -1;
     }
 
-    lib_config.event_functions.ota_cb = config.ota_cb;
-    lib_config.event_functions.cmd_cb = config.cmd_cb;
-    lib_config.event_functions.msg_cb = on_message_intercept;
+    if (ctx->config.event_queue_size && !ctx->event_queue.entries) {
+        if (!iotc_event_queue_init(&ctx->event_queue, ctx->config.event_queue_size)) {
+            IOTCL_ERROR("Error: Unable to allocate the event queue.");
+            return -1;
+        }
+    }
+
+    if (ctx->config.tls_session_cache_size && !ctx->tls_session_cache.record) {
+        if (!iotc_tls_session_cache_init(&ctx->tls_session_cache, ctx->config.tls_session_cache_size, ctx->config.tls_session_store)) {
+            IOTCL_ERROR("Error: Unable to allocate the TLS session cache.");
+            return -1;
+        }
+    }
+
+    iotc_command_router_deinit(&ctx->command_router);
+    if (ctx->config.command_routes) {
+        if (!iotc_command_router_init(&ctx->command_router, ctx->config.command_routes, ctx->config.num_command_routes)) {
+            IOTCL_ERROR("Error: Invalid command routes. Command names must be unique.");
+            return -1;
+        }
+    }
+
+    // With the event queue, all callbacks are deferred to iotconnect_sdk_dispatch() by on_message_intercept
+    ctx->lib_config.event_functions.ota_cb = ctx->event_queue.entries ? NULL : ctx->config.ota_cb;
+    ctx->lib_config.event_functions.cmd_cb = ctx->event_queue.entries ? NULL : get_command_callback(ctx);
+    ctx->lib_config.event_functions.msg_cb = on_message_intercept;
+    ctx->lib_config.user_data = ctx;
 
-    lib_config.telemetry.dtg = sync_response->dtg;
+    ctx->lib_config.telemetry.dtg = ctx->sync_response->dtg;
+    ctx->lib_config.telemetry.schema = ctx->config.telemetry_schema;
+    ctx->lib_config.telemetry.schema_size = ctx->config.telemetry_schema_size;
+    ctx->lib_config.telemetry.arena_size = ctx->config.telemetry_arena_size;
 
     char cpid_buff[5];
-    strncpy(cpid_buff, config.cpid, 4);
+    strncpy(cpid_buff, ctx->config.cpid, 4);
     cpid_buff[4] = 0;
-    printf("CPID: %s***\n", cpid_buff);
-    printf("ENV:  %s\n", config.env);
+    IOTCL_INFO("CPID: %s***", cpid_buff);
+    IOTCL_INFO("ENV:  %s", ctx->config.env);
 
 
-    if (config.auth_info.type != IOTC_AT_TOKEN &&
-        config.auth_info.type != IOTC_AT_X509 &&
-        config.auth_info.type != IOTC_AT_TPM &&
-        config.auth_info.type != IOTC_AT_SYMMETRIC_KEY
+    if (ctx->config.auth_info.type != IOTC_AT_TOKEN &&
+        ctx->config.auth_info.type != IOTC_AT_X509 &&
+        ctx->config.auth_info.type != IOTC_AT_TPM &&
+        ctx->config.auth_info.type != IOTC_AT_SYMMETRIC_KEY
         ) {
-        printf("Error: Unsupported authentication type!\n");
+        IOTCL_ERROR("Error: Unsupported authentication type!");
         return -1;
     }
 
-    if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY || config.auth_info.type == IOTC_AT_TPM) {
-        printf("Error: Configuration tyoe \"SymmetricKey\" is not supported.\n");
+    if (ctx->config.auth_info.type == IOTC_AT_SYMMETRIC_KEY || ctx->config.auth_info.type == IOTC_AT_TPM) {
+        IOTCL_ERROR("Error: Configuration tyoe \"SymmetricKey\" is not supported.");
         return -1;
     }
 
-    if (config.auth_info.type == IOTC_AT_X509 && (
-            !config.auth_info.data.cert_info.device_cert ||
-            !config.auth_info.data.cert_info.device_key)) {
-        printf("Error: Configuration authentication info is invalid.\n");
+    if (ctx->config.auth_info.type == IOTC_AT_X509 && (
+            !ctx->config.auth_info.data.cert_info.device_cert ||
+            !ctx->config.auth_info.data.cert_info.device_key)) {
+        IOTCL_ERROR("Error: Configuration authentication info is invalid.");
         return -1;
     }
 
-    if (config.auth_info.type == IOTC_AT_TOKEN) {
-        if (!sync_response->broker.pass || strlen(sync_response->broker.pass) == 0) {
-            printf("Error: Unable to obtain SAS token for Token authentication.\n");
+    if (ctx->config.auth_info.type == IOTC_AT_TOKEN) {
+        if (!ctx->sync_response->broker.pass || strlen(ctx->sync_response->broker.pass) == 0) {
+            IOTCL_ERROR("Error: Unable to obtain SAS token for Token authentication.");
             return -1;
         }
     }
-    if (!iotcl_init(&lib_config)) {
-        printf("Error: Failed to initialize the IoTConnect Lib\n");
+    if (!lib_init(ctx)) {
+        IOTCL_ERROR("Error: Failed to initialize the IoTConnect Lib");
+        return -1;
+    }
+
+    if (0 != batch_init(ctx)) {
         return -1;
     }
 
+    if (ctx->config.offline_buffer_size && !ctx->offline_store.ram) {
+        if (!iotc_offline_store_init(&ctx->offline_store, ctx->config.offline_buffer_size, ctx->config.offline_backend)) {
+            IOTCL_ERROR("Error: Unable to allocate the offline message buffer.");
+            return -1;
+        }
+    }
+
+#ifdef ARDUINO
     // MQTT connection certificate setup:
-    config.net->setCACert(CERT_BALTIMORE_ROOT_CA);
-    if (config.auth_info.type == IOTC_AT_X509) {
-        config.net->setCertificate(config.auth_info.data.cert_info.device_cert);
-        config.net->setPrivateKey(config.auth_info.data.cert_info.device_key);
+    if (!ctx->config.transport) {
+        ctx->config.net->setCACert(CERT_BALTIMORE_ROOT_CA);
+        if (ctx->config.auth_info.type == IOTC_AT_X509) {
+            ctx->config.net->setCertificate(ctx->config.auth_info.data.cert_info.device_cert);
+            ctx->config.net->setPrivateKey(ctx->config.auth_info.data.cert_info.device_key);
+        }
     }
+#endif
 
     IotConnectMqttClientConfig mqtt_config;
-    mqtt_config.sr = sync_response;
-    mqtt_config.status_cb = config.status_cb;
+    mqtt_config.sr = ctx->sync_response;
+    mqtt_config.status_cb = on_mqtt_status;
     mqtt_config.c2d_msg_cb = on_mqtt_c2d_message;
-    mqtt_config.auth = &config.auth_info;
-    mqtt_config.net = config.net;
-    mqtt_config.mqtt_buffer_size = config.mqtt_buffer_size;    
-    ret = iotc_mqtt_client_init(&mqtt_config);
+    mqtt_config.user_data = ctx;
+    mqtt_config.auth = &ctx->config.auth_info;
+    mqtt_config.transport = ctx->transport;
+    mqtt_config.session_cache = ctx->tls_session_cache.record ? &ctx->tls_session_cache : NULL;
+    mqtt_config.inflight_window = ctx->config.mqtt_inflight_window;
+    ret = iotc_mqtt_client_init(&ctx->mqtt, &mqtt_config);
 
     if (ret) {
-        printf("Failed to connect!\n");
+        IOTCL_ERROR("Failed to initialize the MQTT client!");
         return ret;
     }
 
     return ret;
-}
\ No newline at end of file
+}
+///////////////////////////////////////////////////////////////////////////////////
+// this the Initialization os IoTConnect SDK
+int iotconnect_sdk_init_ctx(IotConnectContext ctx) {
+    bool cached = false;
+    if (!ctx->discovery_response && !ctx->sync_response) {
+        cached = cache_load(ctx);
+    }
+    int ret = sdk_init(ctx);
+    if (cached && (0 != ret || !iotc_mqtt_client_is_connected(&ctx->mqtt))) {
+        IOTCL_WARN("Unable to connect with the cached broker information. Running discovery and sync.");
+        iotc_mqtt_client_disconnect(&ctx->mqtt); // the MQTT client refers to the sync response
+        free_responses(ctx);
+        cache_erase(ctx);
+        ret = sdk_init(ctx);
+    }
+    iotcl_log_flush(0);
+    return ret;
+}
+
+IotConnectContext iotconnect_sdk_create_context() {
+    IotConnectContext ctx = (IotConnectContext) iotcl_mem_calloc(
+            IOTCL_MEM_TRANSPORT, 1, sizeof(struct IotConnectContextTag)
+    );
+    if (!ctx) {
+        IOTCL_ERROR("Error: Unable to allocate the SDK context.");
+    }
+    return ctx;
+}
+
+void iotconnect_sdk_destroy_context(IotConnectContext ctx) {
+    if (!ctx || ctx == &default_context) {
+        return;
+    }
+    iotc_mqtt_client_disconnect(&ctx->mqtt);
+    iotc_event_queue_deinit(&ctx->event_queue); // before the lib context that the events refer to
+    iotc_command_router_deinit(&ctx->command_router);
+    iotc_offline_store_deinit(&ctx->offline_store);
+    iotc_tls_session_cache_deinit(&ctx->tls_session_cache);
+    batch_deinit(ctx);
+    free_responses(ctx);
+    iotcl_context_deinit(&ctx->lib_context);
+    iotcl_mem_free(ctx);
+}
+
+IotConnectContext iotconnect_sdk_get_default_context() {
+    return &default_context;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// The default context
+
+IotConnectClientConfig *iotconnect_sdk_init_and_get_config() {
+    return iotconnect_sdk_init_and_get_config_ctx(&default_context);
+}
+
+int iotconnect_sdk_init() {
+    return iotconnect_sdk_init_ctx(&default_context);
+}
+
+bool iotconnect_sdk_is_connected() {
+    return iotconnect_sdk_is_connected_ctx(&default_context);
+}
+
+IotConnectConnectionState iotconnect_sdk_get_connection_state() {
+    return iotconnect_sdk_get_connection_state_ctx(&default_context);
+}
+
+IotclConfig *iotconnect_sdk_get_lib_config() {
+    return iotconnect_sdk_get_lib_config_ctx(&default_context);
+}
+
+void iotconnect_sdk_loop() {
+    iotconnect_sdk_loop_ctx(&default_context);
+}
+
+int iotconnect_sdk_send_packet(const char *data) {
+    return iotconnect_sdk_send_packet_ctx(&default_context, data);
+}
+
+int iotconnect_sdk_send_packet_len(const char *data, size_t len) {
+    return iotconnect_sdk_send_packet_len_ctx(&default_context, data, len);
+}
+
+char *iotconnect_sdk_reserve_packet(size_t *size) {
+    return iotconnect_sdk_reserve_packet_ctx(&default_context, size);
+}
+
+int iotconnect_sdk_commit_packet(size_t len) {
+    return iotconnect_sdk_commit_packet_ctx(&default_context, len);
+}
+
+int iotconnect_sdk_send_packet_qos(const char *data, int qos) {
+    return iotconnect_sdk_send_packet_qos_ctx(&default_context, data, qos);
+}
+
+void iotconnect_sdk_get_publish_stats(IotcPublishStats *stats) {
+    iotconnect_sdk_get_publish_stats_ctx(&default_context, stats);
+}
+
+size_t iotconnect_sdk_dispatch(size_t max_events, unsigned long max_us) {
+    return iotconnect_sdk_dispatch_ctx(&default_context, max_events, max_us);
+}
+
+void iotconnect_sdk_get_event_queue_stats(IotcEventQueueStats *stats) {
+    iotconnect_sdk_get_event_queue_stats_ctx(&default_context, stats);
+}
+
+void iotconnect_sdk_get_tls_stats(IotcTlsStats *stats) {
+    iotconnect_sdk_get_tls_stats_ctx(&default_context, stats);
+}
+
+void iotconnect_sdk_get_offline_stats(IotcOfflineStoreStats *stats) {
+    iotconnect_sdk_get_offline_stats_ctx(&default_context, stats);
+}
+
+void iotconnect_sdk_get_batch_stats(IotcBatchStats *stats) {
+    iotconnect_sdk_get_batch_stats_ctx(&default_context, stats);
+}
+
+int iotconnect_sdk_batch_add_sample(const char *iso_time, IotConnectSampleCallback write_values, void *user_data) {
+    return iotconnect_sdk_batch_add_sample_ctx(&default_context, iso_time, write_values, user_data);
+}
+
+int iotconnect_sdk_batch_flush() {
+    return iotconnect_sdk_batch_flush_ctx(&default_context);
+}
+
+void iotconnect_sdk_disconnect() {
+    iotconnect_sdk_disconnect_ctx(&default_context);
+}
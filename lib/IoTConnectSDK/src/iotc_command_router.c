@@ -0,0 +1,154 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_command_router.h"
+#include "iotconnect_mem.h"
+
+#define MAX_SEEDS 256 // seeds tried for each table size before the table is grown
+#define MAX_SLOTS 4096
+
+// FNV-1a, with the seed mixed into the offset basis
+static uint32_t hash_name(uint32_t seed, const char *name, size_t len) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16u);
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool name_equals(const char *name, const char *other, size_t other_len) {
+    return 0 == strncmp(name, other, other_len) && 0 == name[other_len];
+}
+
+// Tries to place all routes without collisions. Returns false on a collision.
+static bool try_seed(IotcCommandRouter *router, uint32_t seed) {
+    memset(router->slots, 0, (router->slot_mask + 1) * sizeof(uint16_t));
+    for (size_t i = 0; i < router->num_routes; i++) {
+        const char *name = router->routes[i].name;
+        size_t slot = hash_name(seed, name, strlen(name)) & router->slot_mask;
+        if (0 != router->slots[slot]) {
+            return false;
+        }
+        router->slots[slot] = (uint16_t) (i + 1);
+    }
+    router->seed = seed;
+    return true;
+}
+
+static bool has_duplicates(const IotcCommandRoute *routes, size_t num_routes) {
+    for (size_t i = 0; i < num_routes; i++) {
+        for (size_t j = i + 1; j < num_routes; j++) {
+            if (0 == strcmp(routes[i].name, routes[j].name)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool iotc_command_router_init(IotcCommandRouter *router, const IotcCommandRoute *routes, size_t num_routes) {
+    memset(router, 0, sizeof(IotcCommandRouter));
+    if (num_routes > 0 && !routes) {
+        return false;
+    }
+    for (size_t i = 0; i < num_routes; i++) {
+        if (!routes[i].name || !routes[i].handler) {
+            return false;
+        }
+    }
+    if (has_duplicates(routes, num_routes)) {
+        return false;
+    }
+    router->routes = routes;
+    router->num_routes = num_routes;
+
+    // start with a load factor of at most one half
+    size_t num_slots = 1;
+    while (num_slots < 2 * num_routes) {
+        num_slots <<= 1u;
+    }
+    for (; num_slots <= MAX_SLOTS; num_slots <<= 1u) {
+        uint16_t *slots = (uint16_t *) iotcl_mem_realloc(IOTCL_MEM_EVENTS, router->slots, num_slots * sizeof(uint16_t));
+        if (!slots) {
+            break;
+        }
+        router->slots = slots;
+        router->slot_mask = num_slots - 1;
+        for (uint32_t seed = 0; seed < MAX_SEEDS; seed++) {
+            if (try_seed(router, seed)) {
+                return true;
+            }
+        }
+    }
+    iotc_command_router_deinit(router);
+    return false;
+}
+
+void iotc_command_router_deinit(IotcCommandRouter *router) {
+    iotcl_mem_free(router->slots);
+    memset(router, 0, sizeof(IotcCommandRouter));
+}
+
+const IotcCommandRoute *iotc_command_router_find(const IotcCommandRouter *router, const char *name, size_t name_len) {
+    if (!router->slots) {
+        return NULL;
+    }
+    uint16_t index = router->slots[hash_name(router->seed, name, name_len) & router->slot_mask];
+    if (0 == index) {
+        return NULL;
+    }
+    const IotcCommandRoute *route = &router->routes[index - 1];
+    return name_equals(route->name, name, name_len) ? route : NULL;
+}
+
+// Returns the next space separated word, or a slice with zero length if there are no more.
+static IotcSlice next_word(const char **p) {
+    IotcSlice word;
+    while (is_space(**p)) (*p)++;
+    word.data = *p;
+    while (**p && !is_space(**p)) (*p)++;
+    word.len = (size_t) (*p - word.data);
+    return word;
+}
+
+void iotc_command_parse(const char *command_line, IotcCommandArgs *args) {
+    const char *p = command_line ? command_line : "";
+    memset(args, 0, sizeof(IotcCommandArgs));
+    args->name = next_word(&p);
+    while (is_space(*p)) p++;
+    args->rest.data = p;
+    args->rest.len = strlen(p);
+    while (args->count < IOTC_COMMAND_MAX_ARGS) {
+        IotcSlice word = next_word(&p);
+        if (0 == word.len) {
+            break;
+        }
+        args->values[args->count++] = word;
+    }
+}
+
+bool iotc_command_router_execute(const IotcCommandRouter *router, const char *command_line, const char **message) {
+    IotcCommandArgs args;
+    iotc_command_parse(command_line, &args);
+    const IotcCommandRoute *route = iotc_command_router_find(router, args.name.data, args.name.len);
+    *message = NULL;
+    if (!route) {
+        *message = "Not implemented";
+        return false;
+    }
+    bool success = route->handler(&args, message, route->user_data);
+    if (!*message) {
+        *message = success ? "Success" : "Failed";
+    }
+    return success;
+}
@@ -0,0 +1,97 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_transport.h"
+#include "iotc_event_queue.h"
+#include "iotconnect_mem.h"
+
+bool iotc_event_queue_init(IotcEventQueue *queue, size_t capacity) {
+    memset(queue, 0, sizeof(IotcEventQueue));
+    if (0 == capacity) {
+        return false;
+    }
+    queue->entries = (IotcQueuedEvent *) iotcl_mem_malloc(IOTCL_MEM_EVENTS, capacity * sizeof(IotcQueuedEvent));
+    if (!queue->entries) {
+        return false;
+    }
+    queue->capacity = capacity;
+    return true;
+}
+
+void iotc_event_queue_deinit(IotcEventQueue *queue) {
+    while (queue->count > 0) {
+        iotcl_destroy_event(queue->entries[queue->head].data);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    iotcl_mem_free(queue->entries);
+    memset(queue, 0, sizeof(IotcEventQueue));
+}
+
+bool iotc_event_queue_push(IotcEventQueue *queue, IotclEventData data, IotConnectEventType type) {
+    if (queue->count >= queue->capacity) {
+        queue->stats.dropped++;
+        return false;
+    }
+    IotcQueuedEvent *entry = &queue->entries[(queue->head + queue->count) % queue->capacity];
+    entry->data = data;
+    entry->type = type;
+    entry->queued_at_us = iotc_transport_micros();
+    queue->count++;
+    queue->stats.queued++;
+    if (queue->count > queue->stats.peak_depth) {
+        queue->stats.peak_depth = queue->count;
+    }
+    return true;
+}
+
+size_t iotc_event_queue_count(IotcEventQueue *queue) {
+    return queue->count;
+}
+
+size_t iotc_event_queue_dispatch(
+        IotcEventQueue *queue,
+        size_t max_events,
+        unsigned long max_us,
+        IotcEventHandler handler,
+        void *user_data
+) {
+    size_t dispatched = 0;
+    unsigned long start_us = iotc_transport_micros();
+    unsigned long now_us = start_us;
+    while (queue->count > 0) {
+        if (0 != max_events && dispatched >= max_events) break;
+        if (0 != max_us && dispatched > 0 && now_us - start_us >= max_us) break;
+
+        // dequeue first, so that the handler can push new events
+        IotcQueuedEvent entry = queue->entries[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+
+        unsigned long wait_us = now_us - entry.queued_at_us;
+        if (wait_us > queue->stats.max_wait_us) {
+            queue->stats.max_wait_us = wait_us;
+        }
+        handler(entry.data, entry.type, user_data);
+        unsigned long end_us = iotc_transport_micros();
+        unsigned long handler_us = end_us - now_us;
+        if (handler_us > queue->stats.max_handler_us) {
+            queue->stats.max_handler_us = handler_us;
+        }
+        queue->stats.total_handler_us += handler_us;
+        queue->stats.dispatched++;
+        dispatched++;
+        now_us = end_us;
+    }
+    return dispatched;
+}
+
+void iotc_event_queue_get_stats(IotcEventQueue *queue, IotcEventQueueStats *stats) {
+    *stats = queue->stats;
+    stats->depth = queue->count;
+}
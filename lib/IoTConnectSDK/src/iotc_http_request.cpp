@@ -7,57 +7,226 @@
 #include <string.h>
 #include <Arduino.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include "iotc_http_request.h"
 #include "iotconnect_certs.h"
+#include "iotconnect_log.h"
 
-int iotconnect_https_request(
+#define INITIAL_RESPONSE_BUFFER_SIZE 512
+#define HTTPS_PORT 443
+#define MAX_HOST_LEN 127
+
+// One client for all requests, so that nothing is allocated for the client itself on each request.
+static HTTPClient http;
+
+// The TLS connection is owned here, rather than by HTTPClient, so that it can be kept open between requests
+// and so that the handshake can be timed.
+static WiFiClientSecure tls;
+static char connected_host[MAX_HOST_LEN + 1] = "";
+static uint16_t connected_port = 0;
+static IotConnectHttpStats stats = {0};
+
+// HTTPClient writes the body into this stream, with the chunked transfer encoding already removed.
+// The data is passed on to the body callback as it arrives.
+class BodyStream : public Stream {
+public:
+    BodyStream(IotConnectHttpBodyCallback on_body, void *user_data) :
+            on_body(on_body), user_data(user_data), aborted(false) {}
+
+    size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        if (aborted) {
+            return 0;
+        }
+        if (!on_body((const char *) buffer, size, user_data)) {
+            aborted = true;
+            return 0;
+        }
+        return size;
+    }
+
+    // nothing to read. This stream is only written to.
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush() {}
+
+    bool is_aborted() const { return aborted; }
+
+private:
+    IotConnectHttpBodyCallback on_body;
+    void *user_data;
+    bool aborted;
+};
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} BodyBuffer;
+
+// Collects the body into a single buffer that grows up to IOTC_HTTP_MAX_RESPONSE_SIZE
+static bool append_body(const char *data, size_t len, void *user_data) {
+    BodyBuffer *b = (BodyBuffer *) user_data;
+    size_t need = b->len + len + 1;
+    if (need > b->size) {
+        if (need > IOTC_HTTP_MAX_RESPONSE_SIZE) {
+            IOTCL_ERROR("iotconnect_https_request() response is larger than %d bytes.", IOTC_HTTP_MAX_RESPONSE_SIZE);
+            return false;
+        }
+        size_t new_size = b->size ? b->size : INITIAL_RESPONSE_BUFFER_SIZE;
+        while (new_size < need) {
+            new_size *= 2;
+        }
+        if (new_size > IOTC_HTTP_MAX_RESPONSE_SIZE) {
+            new_size = IOTC_HTTP_MAX_RESPONSE_SIZE;
+        }
+        char *new_data = (char *) realloc(b->data, new_size);
+        if (!new_data) {
+            IOTCL_ERROR("iotconnect_https_request() out of memory.");
+            return false;
+        }
+        b->data = new_data;
+        b->size = new_size;
+    }
+    memcpy(&b->data[b->len], data, len);
+    b->len += len;
+    b->data[b->len] = 0;
+    return true;
+}
+
+// Extracts the host and the port from a https:// URL. Returns false if the URL is not supported.
+static bool parse_host(const char *url, char *host, uint16_t *port) {
+    const char *prefix = "https://";
+    if (0 != strncmp(url, prefix, strlen(prefix))) {
+        return false;
+    }
+    const char *start = url + strlen(prefix);
+    size_t len = strcspn(start, ":/?");
+    if (0 == len || len > MAX_HOST_LEN) {
+        return false;
+    }
+    memcpy(host, start, len);
+    host[len] = 0;
+    *port = start[len] == ':' ? (uint16_t) atoi(&start[len + 1]) : HTTPS_PORT;
+    return true;
+}
+
+// Reuses the open connection if it is to the same host. Otherwise, opens a new one.
+static bool ensure_connection(const char *host, uint16_t port) {
+    stats.requests++;
+    if (tls.connected() && port == connected_port && 0 == strcmp(host, connected_host)) {
+        stats.reused++;
+        return true;
+    }
+    iotconnect_https_close();
+    tls.setCACert(CERT_GODADDY_INT_SECURE_G2);
+    unsigned long start_ms = millis();
+    if (!tls.connect(host, port)) {
+        return false;
+    }
+    stats.handshakes++;
+    stats.last_handshake_ms = millis() - start_ms;
+    stats.handshake_ms += stats.last_handshake_ms;
+    strcpy(connected_host, host);
+    connected_port = port;
+    return true;
+}
+
+void iotconnect_https_close() {
+    tls.stop();
+    connected_host[0] = 0;
+    connected_port = 0;
+}
+
+void iotconnect_https_get_stats(IotConnectHttpStats *s) {
+    *s = stats;
+}
+
+int iotconnect_https_request_streaming(
         Client *net,
-        IotConnectHttpResponse *response,
         const char *url,
-        const char *send_str
+        const char *send_str,
+        IotConnectHttpBodyCallback on_body,
+        void *user_data
 ) {
     int ret;
-    HTTPClient *http = new HTTPClient();
-    response->data = NULL;
-    if (!http->begin(url, CERT_GODADDY_INT_SECURE_G2)) {
-        printf("iotconnect_https_request() failed to initate the HTTP connection to %s.\n", url);
+    char host[MAX_HOST_LEN + 1];
+    uint16_t port;
+    (void) net; // the MQTT connection uses net, so requests have their own connection
+    if (!parse_host(url, host, &port)) {
+        IOTCL_ERROR("iotconnect_https_request() unsupported URL %s.", url);
         return -1;
-    }    
+    }
+    http.setReuse(true);
+    if (!http.begin(tls, url)) {
+        IOTCL_ERROR("iotconnect_https_request() failed to initate the HTTP connection to %s.", url);
+        return -1;
+    }
     int tries_left = 5;
     do {
         int data_len;
-        if (NULL == send_str) {
-            data_len = http->GET();
+        if (!ensure_connection(host, port)) {
+            data_len = -1;
+        } else if (NULL == send_str) {
+            data_len = http.GET();
         } else {
-            //printf("DATA>\n%s\n<", send_str);
-            http->addHeader("Content-Type", "application/json");
-            data_len = http->POST((uint8_t *)send_str, strlen(send_str));
+            http.addHeader("Content-Type", "application/json");
+            data_len = http.POST((uint8_t *) send_str, strlen(send_str));
         }
+        tries_left--;
         if (data_len == 0) {
-            printf("iotconnect_https_request() no data from url %s.", url);
+            IOTCL_WARN("iotconnect_https_request() no data from url %s. Retries left %d...", url, tries_left);
             ret = -2;
         } else if (data_len < 0) {
-            printf("iotconnect_https_request() failed to connect to %s.", url);
+            IOTCL_WARN("iotconnect_https_request() failed to connect to %s. Retries left %d...", url, tries_left);
             ret = -3;
         } else {
             ret = 0; // all good so far..
-            break; 
+            break;
         }
-        tries_left--;
-        printf(" Retries left %d...\n", tries_left);
     } while (tries_left > 0);
 
-    if (ret < 0) { // exhausted retries
-        return ret;
+    if (0 == ret) {
+        BodyStream stream(on_body, user_data);
+        if (http.writeToStream(&stream) < 0 || stream.is_aborted()) {
+            IOTCL_ERROR("iotconnect_https_request() failed to read the response from %s.", url);
+            ret = -5;
+        }
     }
-    String payload = http->getString();     
-    //printf("REPONSE>\n%s\n<", payload.c_str());    
+    // keeps the connection open if the server allows it
+    http.end();
+    if (0 != ret) {
+        iotconnect_https_close(); // the connection is in an unknown state
+    }
+    return ret;
+}
+
+int iotconnect_https_request(
+        Client *net,
+        IotConnectHttpResponse *response,
+        const char *url,
+        const char *send_str
+) {
     if (NULL == response) {
-        printf("iotconnect_https_request() requires a valid IotConnectHttpResponse pointer.");
+        IOTCL_ERROR("iotconnect_https_request() requires a valid IotConnectHttpResponse pointer.");
         return -4;
-    }    
-    response->data = (char *) malloc(strlen(payload.c_str()) + 1);
-    strcpy(response->data, payload.c_str());
+    }
+    response->data = NULL;
+    BodyBuffer body = {NULL, 0, 0};
+    int ret = iotconnect_https_request_streaming(net, url, send_str, append_body, &body);
+    if (0 != ret) {
+        free(body.data);
+        return ret;
+    }
+    if (!body.data) {
+        IOTCL_ERROR("iotconnect_https_request() no data from url %s.", url);
+        return -2;
+    }
+    response->data = body.data;
     return 0;
 }
 
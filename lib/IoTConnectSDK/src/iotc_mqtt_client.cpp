@@ -7,136 +7,371 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
-#include <Arduino.h>
-#include <PubSubClient.h>
+#include <stdio.h>
 #include "iotc_mqtt_client.h"
+#include "iotconnect_log.h"
+#include "iotconnect_mem.h"
 
 #define MQTT_SECURE_PORT 8883
-#define DEFAULT_BUFFER_SIZE 2048
 
-static PubSubClient* client = NULL;
-static char *publish_topic = NULL;
-static IotConnectC2dCallback c2d_msg_cb = NULL; // callback for inbound messages
-static IotConnectStatusCallback status_cb = NULL; // callback for connection status
+static void free_inflight(IotcMqttClient *c, IotcInflightMessage *m) {
+    iotcl_mem_free(m->data);
+    m->data = NULL;
+    c->publish_stats.in_flight--;
+}
+
+static void inflight_deinit(IotcMqttClient *c) {
+    for (size_t i = 0; c->inflight && i < c->inflight_window; i++) {
+        if (c->inflight[i].data) {
+            free_inflight(c, &c->inflight[i]);
+            c->publish_stats.expired++;
+        }
+    }
+    iotcl_mem_free(c->inflight);
+    c->inflight = NULL;
+    c->inflight_window = 0;
+}
 
-static void mqtt_deinit() {
-    if (client) {
-        client->disconnect();
-        delete client;
+static void mqtt_deinit(IotcMqttClient *c) {
+    if (c->transport) {
+        c->transport->mqtt_disconnect(c->transport->ctx);
+        c->transport->mqtt_set_message_callback(c->transport->ctx, NULL, NULL);
+        if (c->transport->mqtt_set_puback_callback) {
+            c->transport->mqtt_set_puback_callback(c->transport->ctx, NULL, NULL);
+        }
     }
-    if (publish_topic) {
-        free(publish_topic);
+    inflight_deinit(c);
+    if (c->publish_topic) {
+        iotcl_mem_free(c->publish_topic);
     }
-    publish_topic = NULL;
-    client = NULL;    
-    c2d_msg_cb = NULL;
-    status_cb = NULL;
+    c->publish_topic = NULL;
+    c->transport = NULL;
+    c->sr = NULL;
+    c->c2d_msg_cb = NULL;
+    c->status_cb = NULL;
+    c->user_data = NULL;
+    c->session_cache = NULL;
+    c->failed_connects = 0;
+    c->state = IOTC_CONN_STATE_IDLE;
 }
 
-static void mqtt_message_callback(char* topic, byte* payload, unsigned int length) {
-    if (c2d_msg_cb) {
-        c2d_msg_cb(payload, length);
-    }    
+static void mqtt_message_callback(const unsigned char *payload, size_t length, void *user_data) {
+    IotcMqttClient *c = (IotcMqttClient *) user_data;
+    if (c->c2d_msg_cb) {
+        c->c2d_msg_cb(payload, length, c->user_data);
+    }
 }
 
-int iotc_mqtt_client_disconnect() {
-    if (client) {
-        client->disconnect();
+static void on_puback(unsigned short packet_id, void *user_data) {
+    IotcMqttClient *c = (IotcMqttClient *) user_data;
+    for (size_t i = 0; i < c->inflight_window; i++) {
+        if (c->inflight[i].data && c->inflight[i].packet_id == packet_id) {
+            free_inflight(c, &c->inflight[i]);
+            c->publish_stats.acked++;
+            return;
+        }
     }
-    mqtt_deinit();
-    return 0;
+    // not ours, or a late acknowledgement of a duplicate
 }
 
-bool iotc_mqtt_client_is_connected() {
-    if (!client) {
-        return false;
+static unsigned short next_packet_id(IotcMqttClient *c) {
+    c->next_packet_id++;
+    if (0 == c->next_packet_id) {
+        c->next_packet_id = 1; // zero is not a valid packet id
     }
-    return client->state() == MQTT_CONNECTED;
+    return c->next_packet_id;
 }
 
-int iotc_mqtt_client_send_message(const char *message) {
-    if (!client || !publish_topic) {
-        printf("iotc_mqtt_client_send_message(): Client not initialized!\n");
-        return -2;
+static bool publish_inflight(IotcMqttClient *c, IotcInflightMessage *m, bool dup) {
+    m->sent_ms = iotc_transport_millis();
+    return c->transport->mqtt_publish_qos1(c->transport->ctx, c->publish_topic, m->data, m->len, m->packet_id, dup);
+}
+
+// Sends again the QoS 1 messages that were not acknowledged in time, or all of them after a reconnect
+static void retransmit_inflight(IotcMqttClient *c, bool all) {
+    for (size_t i = 0; i < c->inflight_window; i++) {
+        IotcInflightMessage *m = &c->inflight[i];
+        if (!m->data || (!all && iotc_transport_millis() - m->sent_ms < IOTC_MQTT_RETRANSMIT_MS)) {
+            continue;
+        }
+        if (m->retransmits >= IOTC_MQTT_MAX_RETRANSMITS) {
+            IOTCL_WARN("WARN: QoS 1 message %u was not acknowledged. Dropping it.", (unsigned int) m->packet_id);
+            free_inflight(c, m);
+            c->publish_stats.expired++;
+            continue;
+        }
+        m->retransmits++;
+        c->publish_stats.retransmits++;
+        if (!publish_inflight(c, m, true)) {
+            return; // the connection is down. The next reconnect sends them all.
+        }
     }
-    return client->publish(publish_topic, message) ? 0 : -1;
 }
 
-void iotc_mqtt_client_loop() {
-    if (!client || !publish_topic) {
-        printf("iotc_mqtt_client_loop(): Client not initialized!\n");
+static void set_state(IotcMqttClient *c, IotConnectConnectionState new_state) {
+    IotConnectConnectionState old_state = c->state;
+    c->state = new_state;
+    if (!c->status_cb || old_state == new_state) {
         return;
     }
-    if (!client->connected()) {
-        if (status_cb) {
-            status_cb(IOTC_CS_MQTT_DISCONNECTED);
-        }
+    if (new_state == IOTC_CONN_STATE_CONNECTED) {
+        c->status_cb(IOTC_CS_MQTT_CONNECTED, c->user_data);
+    } else if (old_state == IOTC_CONN_STATE_CONNECTED) {
+        c->status_cb(IOTC_CS_MQTT_DISCONNECTED, c->user_data);
     }
-    client->loop();
 }
 
+static void schedule_reconnect(IotcMqttClient *c) {
+    if (0 == c->backoff_ms) {
+        c->backoff_ms = IOTC_MQTT_BACKOFF_MIN_MS;
+    } else if (c->backoff_ms < IOTC_MQTT_BACKOFF_MAX_MS / 2) {
+        c->backoff_ms *= 2;
+    } else {
+        c->backoff_ms = IOTC_MQTT_BACKOFF_MAX_MS;
+    }
+    // wait between half and the full backoff, so that a fleet of devices does not reconnect all at once
+    unsigned long delay_ms = c->backoff_ms / 2 + (unsigned long) iotc_transport_random((long) (c->backoff_ms / 2) + 1);
+    c->next_attempt_ms = iotc_transport_millis() + delay_ms;
+    IOTCL_INFO("MQTT connection attempt will be made in %lu ms", delay_ms);
+    set_state(c, IOTC_CONN_STATE_BACKOFF);
+}
 
-int iotc_mqtt_client_init(IotConnectMqttClientConfig *c) {
-    if (!c->net) {
-        printf("ERROR: Must supply a secure client in config!\n");
-        return -1;
+// Offers the cached TLS session to the transport, if the transport can resume it
+static void offer_tls_session(IotcMqttClient *c) {
+    if (!c->session_cache || !c->transport->mqtt_set_tls_session) {
+        return;
     }
-    mqtt_deinit(); // reset all locals
+    const unsigned char *session;
+    size_t len = iotc_tls_session_cache_get(c->session_cache, c->sr->broker.host, MQTT_SECURE_PORT, &session);
+    c->transport->mqtt_set_tls_session(c->transport->ctx, session, len);
+}
 
-    publish_topic = strdup(c->sr->broker.pub_topic);
-    if (!publish_topic) {
-        printf("ERROR: Unable to allocate memory for pub topic copy!\n");
-        return -1;
+// Counts the handshake and caches the session of the new connection for the next reconnect
+static void record_tls_session(IotcMqttClient *c, unsigned long connect_ms) {
+    bool resumed = false;
+    if (c->transport->mqtt_get_tls_session) {
+        const unsigned char *session = NULL;
+        size_t len = c->transport->mqtt_get_tls_session(c->transport->ctx, &session, &resumed);
+        if (c->session_cache && len > 0) {
+            iotc_tls_session_cache_put(c->session_cache, c->sr->broker.host, MQTT_SECURE_PORT, session, len);
+        }
+    }
+    if (resumed) {
+        c->tls_stats.mqtt_resumed++;
+    } else {
+        c->tls_stats.mqtt_handshakes++;
     }
+    c->tls_stats.mqtt_last_connect_ms = connect_ms;
+    c->tls_stats.mqtt_connect_ms += connect_ms;
+}
 
-    client = new PubSubClient(
+// Makes a single connection attempt. Does not wait or retry.
+static void try_connect(IotcMqttClient *c) {
+    offer_tls_session(c);
+    unsigned long start_ms = iotc_transport_millis();
+    if (c->transport->mqtt_connect(
+        c->transport->ctx,
         c->sr->broker.host,
         MQTT_SECURE_PORT,
-        *(c->net)
-    );
-    if (NULL == client) {
-        printf("ERROR: Unable to allocate memory the MQTT client!\n");
-        mqtt_deinit();
-        return -1;
+        c->sr->broker.client_id,
+        c->sr->broker.user_name,
+        c->sr->broker.pass
+    )) {
+        record_tls_session(c, iotc_transport_millis() - start_ms);
+        if (c->transport->mqtt_subscribe(c->transport->ctx, c->sr->broker.sub_topic)) {
+            c->backoff_ms = 0;
+            c->failed_connects = 0;
+            set_state(c, IOTC_CONN_STATE_CONNECTED);
+            retransmit_inflight(c, true);
+            return;
+        }
+        IOTCL_ERROR("ERROR: Unable to subscribe for C2D messages!");
+        c->transport->mqtt_disconnect(c->transport->ctx);
+    } else {
+        IOTCL_ERROR("Failed to connect to MQTT server.");
     }
+    c->failed_connects++;
+    schedule_reconnect(c);
+}
 
-    if (0 == c->mqtt_buffer_size) {
-        c->mqtt_buffer_size = DEFAULT_BUFFER_SIZE;
+int iotc_mqtt_client_disconnect(IotcMqttClient *c) {
+    mqtt_deinit(c);
+    return 0;
+}
+
+bool iotc_mqtt_client_is_connected(IotcMqttClient *c) {
+    if (!c->transport) {
+        return false;
+    }
+    return c->transport->mqtt_is_connected(c->transport->ctx);
+}
+
+IotConnectConnectionState iotc_mqtt_client_get_state(IotcMqttClient *c) {
+    return c->state;
+}
+
+unsigned int iotc_mqtt_client_get_failed_connects(IotcMqttClient *c) {
+    return c->failed_connects;
+}
+
+int iotc_mqtt_client_send_message(IotcMqttClient *c, const char *message, size_t len, int qos) {
+    if (!c->transport || !c->publish_topic) {
+        IOTCL_ERROR("iotc_mqtt_client_send_message(): Client not initialized!");
+        return -2;
+    }
+    if (qos > 0 && !c->inflight && c->transport->mqtt_publish_qos1) {
+        // the transport does not report PUBACKs, so the message can only be sent once
+        if (!c->transport->mqtt_publish_qos1(c->transport->ctx, c->publish_topic, message, len, next_packet_id(c), false)) {
+            return -1;
+        }
+        c->publish_stats.published_qos1++;
+        c->publish_stats.untracked++;
+        return 0;
+    }
+    if (qos <= 0 || !c->inflight) {
+        if (qos > 0) {
+            if (0 == c->publish_stats.downgraded) {
+                IOTCL_WARN("The transport does not support QoS 1. Messages will be sent with QoS 0.");
+            }
+            c->publish_stats.downgraded++;
+        }
+        if (!c->transport->mqtt_publish(c->transport->ctx, c->publish_topic, message, len)) {
+            return -1;
+        }
+        c->publish_stats.published_qos0++;
+        return 0;
     }
-    client->setBufferSize(c->mqtt_buffer_size);
 
-    int connect_tries = 10;
-    do   {
-        if (client->connect(
-            c->sr->broker.client_id,
-            c->sr->broker.user_name,
-            c->sr->broker.pass
-        )) {
+    IotcInflightMessage *m = NULL;
+    for (size_t i = 0; i < c->inflight_window; i++) {
+        if (!c->inflight[i].data) {
+            m = &c->inflight[i];
             break;
         }
-        printf("Failed to connect to MQTT server. Retries left %d...\n", connect_tries);
-        delay(1000);
-        connect_tries--;
-    }  while (connect_tries > 0);
-    if (connect_tries <= 0) {
-        printf("ERROR: Unable to connect the MQTT client!");
-        mqtt_deinit();
-        return -2;
     }
+    if (!m) {
+        c->publish_stats.rejected++;
+        return -3;
+    }
+    if (!c->transport->mqtt_is_connected(c->transport->ctx)) {
+        return -1;
+    }
+    m->data = (char *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, len);
+    if (!m->data) {
+        return -1;
+    }
+    memcpy(m->data, message, len);
+    m->len = len;
+    m->retransmits = 0;
+    m->packet_id = next_packet_id(c);
+    c->publish_stats.in_flight++;
+    if (c->publish_stats.in_flight > c->publish_stats.peak_in_flight) {
+        c->publish_stats.peak_in_flight = c->publish_stats.in_flight;
+    }
+    if (!publish_inflight(c, m, false)) {
+        free_inflight(c, m);
+        return -1;
+    }
+    c->publish_stats.published_qos1++;
+    return 0;
+}
+
+char *iotc_mqtt_client_reserve(IotcMqttClient *c, size_t *size) {
+    if (!c->transport || !c->publish_topic || !c->transport->mqtt_reserve || !c->transport->mqtt_commit) {
+        return NULL;
+    }
+    return c->transport->mqtt_reserve(c->transport->ctx, c->publish_topic, size);
+}
 
-    client->setCallback(mqtt_message_callback);
-    if (!client->subscribe(c->sr->broker.sub_topic)) {
-        mqtt_deinit();
-        printf("ERROR: Unable to subscribe for C2D messages!");
+int iotc_mqtt_client_commit(IotcMqttClient *c, size_t len) {
+    if (!c->transport || !c->publish_topic || !c->transport->mqtt_commit) {
+        IOTCL_ERROR("iotc_mqtt_client_commit(): Client not initialized!");
         return -2;
     }
-    
-    c2d_msg_cb = c->c2d_msg_cb;
-    status_cb = c->status_cb;
+    if (!c->transport->mqtt_commit(c->transport->ctx, len)) {
+        return -1;
+    }
+    c->publish_stats.published_qos0++;
+    return 0;
+}
 
-    if (status_cb) {
-        status_cb(IOTC_CS_MQTT_CONNECTED);
+void iotc_mqtt_client_get_publish_stats(IotcMqttClient *c, IotcPublishStats *stats) {
+    *stats = c->publish_stats;
+}
+
+void iotc_mqtt_client_get_tls_stats(IotcMqttClient *c, IotcTlsStats *stats) {
+    stats->mqtt_handshakes = c->tls_stats.mqtt_handshakes;
+    stats->mqtt_resumed = c->tls_stats.mqtt_resumed;
+    stats->mqtt_connect_ms = c->tls_stats.mqtt_connect_ms;
+    stats->mqtt_last_connect_ms = c->tls_stats.mqtt_last_connect_ms;
+}
+
+void iotc_mqtt_client_loop(IotcMqttClient *c) {
+    if (!c->transport || !c->publish_topic) {
+        IOTCL_ERROR("iotc_mqtt_client_loop(): Client not initialized!");
+        return;
     }
+    switch (c->state) {
+        case IOTC_CONN_STATE_CONNECTED: {
+            bool connected = c->transport->mqtt_poll(c->transport->ctx);
+            if (!c->transport || c->state != IOTC_CONN_STATE_CONNECTED) {
+                break; // a C2D message, like ON_CLOSE, disconnected the client from inside mqtt_poll
+            }
+            if (connected) {
+                retransmit_inflight(c, false);
+                break;
+            }
+            IOTCL_WARN("MQTT connection lost.");
+            schedule_reconnect(c);
+            break;
+        }
+        case IOTC_CONN_STATE_BACKOFF:
+            if ((long) (iotc_transport_millis() - c->next_attempt_ms) >= 0) {
+                try_connect(c);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+int iotc_mqtt_client_init(IotcMqttClient *c, IotConnectMqttClientConfig *config) {
+    if (!config->transport) {
+        IOTCL_ERROR("ERROR: Must supply a transport in config!");
+        return -1;
+    }
+    mqtt_deinit(c); // reset all locals
+
+    c->publish_topic = iotcl_mem_strdup(IOTCL_MEM_TRANSPORT, config->sr->broker.pub_topic);
+    if (!c->publish_topic) {
+        IOTCL_ERROR("ERROR: Unable to allocate memory for pub topic copy!");
+        return -1;
+    }
+
+    c->transport = config->transport;
+    c->transport->mqtt_set_message_callback(c->transport->ctx, mqtt_message_callback, c);
+    if (c->transport->mqtt_publish_qos1 && c->transport->mqtt_set_puback_callback) {
+        c->inflight_window = config->inflight_window ? config->inflight_window : IOTC_MQTT_DEFAULT_INFLIGHT_WINDOW;
+        c->inflight = (IotcInflightMessage *) iotcl_mem_calloc(
+                IOTCL_MEM_TRANSPORT, c->inflight_window, sizeof(IotcInflightMessage)
+        );
+        if (!c->inflight) {
+            IOTCL_ERROR("ERROR: Unable to allocate the QoS 1 in-flight window!");
+            c->inflight_window = 0;
+            mqtt_deinit(c);
+            return -1;
+        }
+        c->transport->mqtt_set_puback_callback(c->transport->ctx, on_puback, c);
+    }
+
+    c->sr = config->sr;
+    c->c2d_msg_cb = config->c2d_msg_cb;
+    c->status_cb = config->status_cb;
+    c->user_data = config->user_data;
+    c->session_cache = config->session_cache;
+    c->backoff_ms = 0;
 
+    try_connect(c);
     return 0;
 }
@@ -0,0 +1,320 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "iotc_offline_store.h"
+#include "iotconnect_mem.h"
+
+#define RECORD_HEADER_SIZE 2
+#define WRAP_MARKER 0xFFFFu // in place of a record length, indicates that the next record is at the start of the buffer
+
+static size_t read_len(const char *p) {
+    return (size_t) ((unsigned char) p[0] | ((unsigned char) p[1] << 8u));
+}
+
+static void write_len(char *p, size_t len) {
+    p[0] = (char) (len & 0xFFu);
+    p[1] = (char) ((len >> 8u) & 0xFFu);
+}
+
+/////////////////////////////////////////////////////////
+// RAM ring buffer
+// Records are never split at the end of the buffer. RAM records carry a string terminator after the data.
+
+// Finds a contiguous spot for a record of the given total size. Returns false if there is no room.
+static bool ram_reserve(IotcOfflineStore *s, size_t need, size_t *offset) {
+    if (0 == s->ram_count) {
+        s->head = 0;
+        s->tail = 0;
+    }
+    if (0 == s->ram_count || s->tail > s->head) {
+        // free space is at the end and before the head
+        if (s->ram_size - s->tail >= need) {
+            *offset = s->tail;
+            return true;
+        }
+        if (s->head >= need) {
+            if (s->ram_size - s->tail >= RECORD_HEADER_SIZE) {
+                write_len(&s->ram[s->tail], WRAP_MARKER);
+            }
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+    if (s->tail < s->head && s->head - s->tail >= need) {
+        *offset = s->tail;
+        return true;
+    }
+    return false; // tail == head with records means that the buffer is full
+}
+
+static void ram_normalize_head(IotcOfflineStore *s) {
+    if (s->ram_size - s->head < RECORD_HEADER_SIZE || read_len(&s->ram[s->head]) == WRAP_MARKER) {
+        s->head = 0;
+    }
+}
+
+static const char *ram_peek(IotcOfflineStore *s, size_t *len) {
+    ram_normalize_head(s);
+    *len = read_len(&s->ram[s->head]);
+    return &s->ram[s->head + RECORD_HEADER_SIZE];
+}
+
+static void ram_pop(IotcOfflineStore *s) {
+    ram_normalize_head(s);
+    s->head += RECORD_HEADER_SIZE + read_len(&s->ram[s->head]) + 1;
+    s->ram_count--;
+}
+
+static size_t backend_count(IotcOfflineStore *s) {
+    return s->backend ? s->backend->count(s->backend->ctx) : 0;
+}
+
+bool iotc_offline_store_init(IotcOfflineStore *store, size_t ram_size, IotcStoreBackend *backend) {
+    memset(store, 0, sizeof(IotcOfflineStore));
+    if (ram_size <= RECORD_HEADER_SIZE + 1) {
+        return false;
+    }
+    store->ram = (char *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, ram_size);
+    store->scratch = (char *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, ram_size + 1);
+    if (!store->ram || !store->scratch) {
+        iotc_offline_store_deinit(store);
+        return false;
+    }
+    store->ram_size = ram_size;
+    store->backend = backend;
+    return true;
+}
+
+void iotc_offline_store_deinit(IotcOfflineStore *store) {
+    iotcl_mem_free(store->ram);
+    iotcl_mem_free(store->scratch);
+    memset(store, 0, sizeof(IotcOfflineStore));
+}
+
+bool iotc_offline_store_push(IotcOfflineStore *store, const char *data, size_t len) {
+    const size_t need = RECORD_HEADER_SIZE + len + 1;
+    if (!store->ram || 0 == len || len >= WRAP_MARKER || need > store->ram_size) {
+        store->stats.dropped++;
+        return false;
+    }
+    size_t offset;
+    while (!ram_reserve(store, need, &offset)) {
+        // make room by moving the oldest record to the backend, or dropping it
+        size_t old_len;
+        const char *old = ram_peek(store, &old_len);
+        if (store->backend && 0 == store->backend->push(store->backend->ctx, old, old_len)) {
+            store->stats.spilled++;
+        } else {
+            store->stats.dropped++;
+            store->send_failures = 0;
+        }
+        ram_pop(store);
+    }
+    write_len(&store->ram[offset], len);
+    memcpy(&store->ram[offset + RECORD_HEADER_SIZE], data, len);
+    store->ram[offset + RECORD_HEADER_SIZE + len] = 0;
+    store->tail = offset + need;
+    store->ram_count++;
+    store->stats.stored++;
+    return true;
+}
+
+size_t iotc_offline_store_count(IotcOfflineStore *store) {
+    return store->ram_count + backend_count(store);
+}
+
+size_t iotc_offline_store_drain(IotcOfflineStore *store, size_t max_messages, IotcStoreSendFunction send, void *user_data) {
+    size_t sent = 0;
+    while (sent < max_messages) {
+        // the backend always holds older messages than RAM
+        const bool in_backend = backend_count(store) > 0;
+        const char *data;
+        size_t len;
+        if (in_backend) {
+            IotcStoreBackend *b = store->backend;
+            int ret = b->peek(b->ctx, store->scratch, store->ram_size);
+            if (ret <= 0) {
+                // unreadable record. Drop it so that it does not block the rest.
+                store->stats.dropped++;
+                if (0 != b->pop(b->ctx)) break;
+                continue;
+            }
+            store->scratch[ret] = 0;
+            data = store->scratch;
+            len = (size_t) ret;
+        } else if (store->ram_count > 0) {
+            data = ram_peek(store, &len);
+        } else {
+            break;
+        }
+
+        int ret = send(data, len, user_data);
+        if (IOTC_STORE_SEND_BUSY == ret) {
+            break;
+        }
+        if (0 != ret) {
+            store->send_failures++;
+            if (IOTC_STORE_SEND_REJECTED != ret && store->send_failures < IOTC_OFFLINE_STORE_MAX_SEND_FAILURES) {
+                break;
+            }
+            store->stats.dropped++;
+        } else {
+            store->stats.replayed++;
+            sent++;
+        }
+        store->send_failures = 0;
+        if (in_backend) {
+            if (0 != store->backend->pop(store->backend->ctx)) break;
+        } else {
+            ram_pop(store);
+        }
+    }
+    return sent;
+}
+
+void iotc_offline_store_get_stats(IotcOfflineStore *store, IotcOfflineStoreStats *stats) {
+    *stats = store->stats;
+    stats->queued = iotc_offline_store_count(store);
+}
+
+/////////////////////////////////////////////////////////
+// File backend
+// The file starts with a header: 4 byte magic, 4 byte head offset and 4 byte record count, all little endian.
+// Records follow, each with a 2 byte length and the data.
+
+#define FILE_MAGIC "IOTC"
+#define FILE_HEADER_SIZE 12
+
+static void put_u32(unsigned char *p, size_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char) ((v >> (8u * i)) & 0xFFu);
+    }
+}
+
+static size_t get_u32(const unsigned char *p) {
+    return (size_t) p[0] | ((size_t) p[1] << 8u) | ((size_t) p[2] << 16u) | ((size_t) p[3] << 24u);
+}
+
+static int file_write_header(IotcFileStoreContext *ctx) {
+    unsigned char header[FILE_HEADER_SIZE];
+    memcpy(header, FILE_MAGIC, 4);
+    put_u32(&header[4], ctx->head);
+    put_u32(&header[8], ctx->count);
+    if (0 != fseek(ctx->fp, 0, SEEK_SET)) return -1;
+    if (1 != fwrite(header, FILE_HEADER_SIZE, 1, ctx->fp)) return -1;
+    return fflush(ctx->fp);
+}
+
+// Truncates the file to an empty log.
+static int file_reset(IotcFileStoreContext *ctx) {
+    if (ctx->fp) {
+        fclose(ctx->fp);
+    }
+    ctx->fp = fopen(ctx->path, "w+b");
+    if (!ctx->fp) return -1;
+    ctx->head = FILE_HEADER_SIZE;
+    ctx->end = FILE_HEADER_SIZE;
+    ctx->count = 0;
+    return file_write_header(ctx);
+}
+
+static int file_push(void *c, const char *data, size_t len) {
+    IotcFileStoreContext *ctx = (IotcFileStoreContext *) c;
+    unsigned char len_bytes[RECORD_HEADER_SIZE];
+    if (!ctx->fp || len >= WRAP_MARKER) return -1;
+    if (ctx->end + RECORD_HEADER_SIZE + len > ctx->max_size) return -1; // full
+    write_len((char *) len_bytes, len);
+    if (0 != fseek(ctx->fp, (long) ctx->end, SEEK_SET)) return -1;
+    if (1 != fwrite(len_bytes, RECORD_HEADER_SIZE, 1, ctx->fp)) return -1;
+    if (1 != fwrite(data, len, 1, ctx->fp)) return -1;
+    ctx->end += RECORD_HEADER_SIZE + len;
+    ctx->count++;
+    return file_write_header(ctx);
+}
+
+static int file_read_len(IotcFileStoreContext *ctx, size_t *len) {
+    unsigned char len_bytes[RECORD_HEADER_SIZE];
+    if (0 != fseek(ctx->fp, (long) ctx->head, SEEK_SET)) return -1;
+    if (1 != fread(len_bytes, RECORD_HEADER_SIZE, 1, ctx->fp)) return -1;
+    *len = read_len((const char *) len_bytes);
+    if (ctx->head + RECORD_HEADER_SIZE + *len > ctx->end) return -1;
+    return 0;
+}
+
+static int file_peek(void *c, char *buffer, size_t buffer_size) {
+    IotcFileStoreContext *ctx = (IotcFileStoreContext *) c;
+    size_t len;
+    if (!ctx->fp) return -1;
+    if (0 == ctx->count) return 0;
+    if (0 != file_read_len(ctx, &len)) return -1;
+    if (len > buffer_size) return -1;
+    if (len > 0 && 1 != fread(buffer, len, 1, ctx->fp)) return -1;
+    return (int) len;
+}
+
+static int file_pop(void *c) {
+    IotcFileStoreContext *ctx = (IotcFileStoreContext *) c;
+    size_t len;
+    if (!ctx->fp || 0 == ctx->count) return -1;
+    if (1 == ctx->count || 0 != file_read_len(ctx, &len)) {
+        // last record, or the file is damaged. Either way, start over.
+        return file_reset(ctx);
+    }
+    ctx->head += RECORD_HEADER_SIZE + len;
+    ctx->count--;
+    return file_write_header(ctx);
+}
+
+static size_t file_count(void *c) {
+    return ((IotcFileStoreContext *) c)->count;
+}
+
+bool iotc_offline_store_file_backend_init(
+        IotcStoreBackend *backend,
+        IotcFileStoreContext *ctx,
+        const char *path,
+        size_t max_size
+) {
+    unsigned char header[FILE_HEADER_SIZE];
+    memset(ctx, 0, sizeof(IotcFileStoreContext));
+    if (!path || max_size <= FILE_HEADER_SIZE) return false;
+    ctx->path = path;
+    ctx->max_size = max_size;
+
+    ctx->fp = fopen(path, "r+b");
+    if (ctx->fp
+        && 1 == fread(header, FILE_HEADER_SIZE, 1, ctx->fp)
+        && 0 == memcmp(header, FILE_MAGIC, 4)
+        && 0 == fseek(ctx->fp, 0, SEEK_END)) {
+        long size = ftell(ctx->fp);
+        ctx->head = get_u32(&header[4]);
+        ctx->count = get_u32(&header[8]);
+        ctx->end = size > 0 ? (size_t) size : 0;
+        if (ctx->head < FILE_HEADER_SIZE || ctx->head > ctx->end || (0 == ctx->count) != (ctx->head == ctx->end)) {
+            if (0 != file_reset(ctx)) return false;
+        }
+    } else if (0 != file_reset(ctx)) {
+        return false;
+    }
+
+    backend->ctx = ctx;
+    backend->push = file_push;
+    backend->peek = file_peek;
+    backend->pop = file_pop;
+    backend->count = file_count;
+    return true;
+}
+
+void iotc_offline_store_file_backend_deinit(IotcFileStoreContext *ctx) {
+    if (ctx->fp) {
+        fclose(ctx->fp);
+    }
+    ctx->fp = NULL;
+}
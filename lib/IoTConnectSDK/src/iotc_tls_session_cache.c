@@ -0,0 +1,104 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_tls_session_cache.h"
+#include "iotconnect_mem.h"
+
+#define MAX_HOST_LEN 255
+#define RECORD_OVERHEAD (1 + MAX_HOST_LEN + 2)
+
+bool iotc_tls_session_cache_init(IotcTlsSessionCache *cache, size_t max_session_size, IotcTlsSessionStore *store) {
+    memset(cache, 0, sizeof(IotcTlsSessionCache));
+    if (0 == max_session_size) {
+        return false;
+    }
+    cache->record_size = RECORD_OVERHEAD + max_session_size;
+    cache->record = (unsigned char *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, cache->record_size);
+    if (!cache->record) {
+        cache->record_size = 0;
+        return false;
+    }
+    cache->store = store;
+    return true;
+}
+
+void iotc_tls_session_cache_deinit(IotcTlsSessionCache *cache) {
+    iotcl_mem_free(cache->record);
+    memset(cache, 0, sizeof(IotcTlsSessionCache));
+}
+
+// Returns the offset of the session in the record if it belongs to the host and the port, or 0 if it does not.
+static size_t match_record(IotcTlsSessionCache *cache, const char *host, int port) {
+    const unsigned char *r = cache->record;
+    size_t host_len = strlen(host);
+    size_t offset = 1 + host_len + 2;
+    if (cache->record_len <= offset || r[0] != host_len || 0 != memcmp(&r[1], host, host_len)) {
+        return 0;
+    }
+    if ((r[1 + host_len] | (r[2 + host_len] << 8u)) != port) {
+        return 0;
+    }
+    return offset;
+}
+
+size_t iotc_tls_session_cache_get(IotcTlsSessionCache *cache, const char *host, int port, const unsigned char **session) {
+    *session = NULL;
+    if (!cache->record || !host) {
+        return 0;
+    }
+    if (!cache->loaded) {
+        cache->loaded = true;
+        if (cache->store && cache->store->load) {
+            cache->record_len = cache->store->load(cache->store->ctx, cache->record, cache->record_size);
+            if (cache->record_len > cache->record_size) {
+                cache->record_len = 0;
+            }
+        }
+    }
+    size_t offset = match_record(cache, host, port);
+    if (0 == offset) {
+        return 0;
+    }
+    *session = &cache->record[offset];
+    return cache->record_len - offset;
+}
+
+void iotc_tls_session_cache_put(IotcTlsSessionCache *cache, const char *host, int port, const unsigned char *session, size_t len) {
+    size_t host_len = host ? strlen(host) : 0;
+    if (!cache->record || 0 == host_len || host_len > MAX_HOST_LEN || 0 == len) {
+        return;
+    }
+    size_t offset = 1 + host_len + 2;
+    if (offset + len > cache->record_size) {
+        iotc_tls_session_cache_clear(cache); // an older session would be stale
+        return;
+    }
+    // nothing to do if the transport handed back the session that was resumed
+    if (offset == match_record(cache, host, port) && cache->record_len - offset == len
+        && 0 == memcmp(&cache->record[offset], session, len)) {
+        return;
+    }
+    cache->record[0] = (unsigned char) host_len;
+    memcpy(&cache->record[1], host, host_len);
+    cache->record[1 + host_len] = (unsigned char) (port & 0xFF);
+    cache->record[2 + host_len] = (unsigned char) ((port >> 8) & 0xFF);
+    memcpy(&cache->record[offset], session, len);
+    cache->record_len = offset + len;
+    cache->loaded = true;
+    if (cache->store && cache->store->save) {
+        cache->store->save(cache->store->ctx, cache->record, cache->record_len);
+    }
+}
+
+void iotc_tls_session_cache_clear(IotcTlsSessionCache *cache) {
+    cache->record_len = 0;
+    cache->loaded = true;
+    if (cache->store && cache->store->save) {
+        cache->store->save(cache->store->ctx, NULL, 0);
+    }
+}
@@ -0,0 +1,34 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Platform functions for host (POSIX) builds. The Arduino versions are in iotc_transport_arduino.cpp.
+#ifndef ARDUINO
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdlib.h>
+#include <time.h>
+#include "iotc_transport.h"
+
+unsigned long iotc_transport_millis(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000UL + (unsigned long) (ts.tv_nsec / 1000000L);
+}
+
+unsigned long iotc_transport_micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000UL + (unsigned long) (ts.tv_nsec / 1000L);
+}
+
+long iotc_transport_random(long max) {
+    if (max <= 0) {
+        return 0;
+    }
+    return rand() % max;
+}
+
+#endif // ARDUINO
@@ -0,0 +1,240 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "iotc_http_request.h"
+#include "iotc_mqtt_client.h"
+#include "iotconnect_log.h"
+#include "iotconnect_mem.h"
+#include "iotc_transport_arduino.h"
+
+#define MQTT_PUBLISH_HEADER 0x30 // PUBLISH with QoS 0
+#define MQTT_PUBLISH_QOS1_HEADER 0x32
+#define MQTT_PUBLISH_DUP_FLAG 0x08
+#define MQTT_MAX_FIXED_HEADER_SIZE 5 // 1 byte type and up to 4 bytes of remaining length
+
+static WiFiClientSecure *net = NULL;
+static PubSubClient *client = NULL;
+
+// Whole PUBLISH packets are built here by mqtt_reserve and mqtt_commit, and written to the network in one go.
+// Allocated on first use.
+static uint8_t *tx_buffer = NULL;
+static size_t tx_buffer_size = 0;
+static size_t tx_topic_len = 0;
+static size_t pubsub_buffer_size = 0; // allocated by PubSubClient and counted as SDK transport memory
+static IotcTransportMessageCallback message_cb = NULL;
+static void *message_cb_user_data = NULL;
+
+static void pubsub_message_callback(char* topic, byte* payload, unsigned int length) {
+    if (message_cb) {
+        message_cb(payload, length, message_cb_user_data);
+    }
+}
+
+static bool mqtt_connect(
+        void *ctx,
+        const char *host,
+        int port,
+        const char *client_id,
+        const char *user_name,
+        const char *pass
+) {
+    client->setServer(host, (uint16_t) port);
+    if (client->connect(client_id, user_name, pass)) {
+        return true;
+    }
+    IOTCL_ERROR("Failed to connect to MQTT server. Client state is %d", client->state());
+    return false;
+}
+
+static void mqtt_disconnect(void *ctx) {
+    client->disconnect();
+}
+
+static bool mqtt_is_connected(void *ctx) {
+    return client->state() == MQTT_CONNECTED;
+}
+
+static bool mqtt_subscribe(void *ctx, const char *topic) {
+    return client->subscribe(topic);
+}
+
+static bool mqtt_publish(void *ctx, const char *topic, const char *data, size_t len) {
+    return client->publish(topic, (const uint8_t *) data, (unsigned int) len);
+}
+
+// Puts the topic after the space reserved for the fixed header at its maximum size.
+// Returns the offset where the rest of the packet goes, or 0 if there is no room.
+static size_t tx_set_topic(const char *topic) {
+    size_t topic_len = strlen(topic);
+    size_t offset = MQTT_MAX_FIXED_HEADER_SIZE + 2 + topic_len;
+    if (!tx_buffer) {
+        tx_buffer = (uint8_t *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, tx_buffer_size);
+        if (!tx_buffer) {
+            return 0;
+        }
+    }
+    if (offset >= tx_buffer_size) {
+        return 0;
+    }
+    tx_buffer[MQTT_MAX_FIXED_HEADER_SIZE] = (uint8_t) (topic_len >> 8u);
+    tx_buffer[MQTT_MAX_FIXED_HEADER_SIZE + 1] = (uint8_t) (topic_len & 0xFFu);
+    memcpy(&tx_buffer[MQTT_MAX_FIXED_HEADER_SIZE + 2], topic, topic_len);
+    tx_topic_len = topic_len;
+    return offset;
+}
+
+// Writes the fixed header right before the topic and sends the packet of remaining_len bytes after the header
+static bool tx_write_packet(uint8_t type_and_flags, size_t remaining_len) {
+    uint8_t header[MQTT_MAX_FIXED_HEADER_SIZE];
+    size_t header_len = 1;
+    size_t remaining = remaining_len;
+    header[0] = type_and_flags;
+    do {
+        uint8_t digit = (uint8_t) (remaining % 128);
+        remaining /= 128;
+        header[header_len++] = remaining > 0 ? (uint8_t) (digit | 0x80u) : digit;
+    } while (remaining > 0 && header_len < MQTT_MAX_FIXED_HEADER_SIZE);
+
+    size_t start = MQTT_MAX_FIXED_HEADER_SIZE - header_len;
+    memcpy(&tx_buffer[start], header, header_len);
+    size_t total = header_len + remaining_len;
+    return client->write(&tx_buffer[start], total) == total;
+}
+
+// The payload goes after the fixed header, which is reserved at the maximum size, and the topic
+static char *mqtt_reserve(void *ctx, const char *topic, size_t *size) {
+    size_t payload_offset = tx_set_topic(topic);
+    if (!payload_offset) {
+        return NULL;
+    }
+    *size = tx_buffer_size - payload_offset;
+    return (char *) &tx_buffer[payload_offset];
+}
+
+static bool mqtt_commit(void *ctx, size_t len) {
+    if (!tx_buffer || !client->connected()) {
+        return false;
+    }
+    if (len > tx_buffer_size - (MQTT_MAX_FIXED_HEADER_SIZE + 2 + tx_topic_len)) {
+        return false; // larger than what mqtt_reserve handed out
+    }
+    return tx_write_packet(MQTT_PUBLISH_HEADER, 2 + tx_topic_len + len);
+}
+
+// PubSubClient only publishes with QoS 0, so the packet is built like in mqtt_commit, with the packet id
+// between the topic and the payload. PubSubClient ignores the PUBACK, which is the only part missing
+// for the SDK to retransmit unacknowledged messages.
+static bool mqtt_publish_qos1(
+        void *ctx,
+        const char *topic,
+        const char *data,
+        size_t len,
+        unsigned short packet_id,
+        bool dup
+) {
+    if (!client->connected()) {
+        return false;
+    }
+    size_t offset = tx_set_topic(topic);
+    if (!offset || offset + 2 + len > tx_buffer_size) {
+        return false;
+    }
+    tx_buffer[offset] = (uint8_t) (packet_id >> 8u);
+    tx_buffer[offset + 1] = (uint8_t) (packet_id & 0xFFu);
+    memcpy(&tx_buffer[offset + 2], data, len);
+    uint8_t flags = dup ? MQTT_PUBLISH_QOS1_HEADER | MQTT_PUBLISH_DUP_FLAG : MQTT_PUBLISH_QOS1_HEADER;
+    return tx_write_packet(flags, 2 + tx_topic_len + 2 + len);
+}
+
+static bool mqtt_poll(void *ctx) {
+    return client->loop();
+}
+
+static void mqtt_set_message_callback(void *ctx, IotcTransportMessageCallback cb, void *user_data) {
+    message_cb = cb;
+    message_cb_user_data = user_data;
+}
+
+static int http_request(void *ctx, const char *url, const char *post_data, char **response) {
+    IotConnectHttpResponse r;
+    r.data = NULL;
+    int ret = iotconnect_https_request(net, &r, url, post_data);
+    *response = r.data;
+    return ret;
+}
+
+static void http_close(void *ctx) {
+    iotconnect_https_close();
+}
+
+static void get_tls_stats(void *ctx, IotcTlsStats *stats) {
+    IotConnectHttpStats http_stats;
+    iotconnect_https_get_stats(&http_stats);
+    memset(stats, 0, sizeof(IotcTlsStats));
+    stats->http_requests = http_stats.requests;
+    stats->http_handshakes = http_stats.handshakes;
+    stats->http_reused = http_stats.reused;
+    stats->http_handshake_ms = http_stats.handshake_ms;
+    stats->http_last_handshake_ms = http_stats.last_handshake_ms;
+}
+
+static IotcTransport transport = {
+        NULL,
+        mqtt_connect,
+        mqtt_disconnect,
+        mqtt_is_connected,
+        mqtt_subscribe,
+        mqtt_publish,
+        mqtt_reserve,
+        mqtt_commit,
+        mqtt_publish_qos1,
+        NULL, // PubSubClient does not report PUBACKs
+        mqtt_poll,
+        mqtt_set_message_callback,
+        NULL, // WiFiClientSecure does not expose TLS sessions, so they cannot be resumed
+        NULL,
+        http_request,
+        http_close,
+        get_tls_stats
+};
+
+IotcTransport *iotc_transport_arduino_get(WiFiClientSecure *n, size_t mqtt_buffer_size) {
+    if (!client) {
+        client = new PubSubClient();
+        client->setCallback(pubsub_message_callback);
+    }
+    net = n;
+    client->setClient(*net);
+    size_t buffer_size = mqtt_buffer_size ? mqtt_buffer_size : IOTC_MQTT_DEFAULT_BUFFER_SIZE;
+    if (client->setBufferSize((uint16_t) buffer_size)) {
+        iotcl_mem_untrack(IOTCL_MEM_TRANSPORT, pubsub_buffer_size);
+        pubsub_buffer_size = buffer_size;
+        iotcl_mem_track(IOTCL_MEM_TRANSPORT, pubsub_buffer_size);
+    }
+    size_t new_tx_buffer_size = buffer_size;
+    if (new_tx_buffer_size != tx_buffer_size) {
+        iotcl_mem_free(tx_buffer);
+        tx_buffer = NULL;
+        tx_buffer_size = new_tx_buffer_size;
+    }
+    return &transport;
+}
+
+unsigned long iotc_transport_millis(void) {
+    return millis();
+}
+
+unsigned long iotc_transport_micros(void) {
+    return micros();
+}
+
+long iotc_transport_random(long max) {
+    return random(max);
+}
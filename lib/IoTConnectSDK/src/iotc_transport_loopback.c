@@ -0,0 +1,298 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+#include "iotconnect_common.h"
+#include "iotconnect_mem.h"
+#include "iotc_transport_loopback.h"
+
+#define DISCOVERY_RESPONSE "{\"baseUrl\":\"https://" IOTC_LOOPBACK_HOST "/api/2.0/agent/\"}"
+
+#define SYNC_RESPONSE_TEMPLATE \
+    "{\"d\":{\"ec\":0,\"ct\":200,\"ds\":0,\"cpId\":\"%s\",\"dtg\":\"" IOTC_LOOPBACK_DTG "\",\"ee\":0,\"rc\":0,\"at\":1," \
+    "\"p\":{\"n\":\"mqtt\",\"h\":\"" IOTC_LOOPBACK_HOST "\",\"p\":8883,\"id\":\"%s-%s\"," \
+    "\"un\":\"" IOTC_LOOPBACK_HOST "/%s-%s/?api-version=2018-06-30\",\"pwd\":\"SharedAccessSignature loopback\"," \
+    "\"pub\":\"devices/%s-%s/messages/events/\",\"sub\":\"devices/%s-%s/messages/devicebound/#\"}}}"
+
+#define SYNC_ERROR_RESPONSE "{\"d\":{\"ec\":0,\"ct\":200,\"ds\":3}}" // device not found
+
+// The response is freed by the SDK with free(), like with any transport
+static char *create_sync_response(const char *post_data) {
+    char *response = NULL;
+    IotclMemSubsystem previous = iotcl_mem_select(IOTCL_MEM_TRANSPORT);
+    cJSON *root = cJSON_Parse(post_data);
+    const char *cpid = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(root, "cpId"));
+    const char *duid = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(root, "uniqueId"));
+    if (!cpid || !duid) {
+        response = iotcl_strdup(SYNC_ERROR_RESPONSE);
+    } else {
+        size_t size = sizeof(SYNC_RESPONSE_TEMPLATE) + 5 * strlen(cpid) + 4 * strlen(duid);
+        response = (char *) malloc(size);
+        if (response) {
+            snprintf(response, size, SYNC_RESPONSE_TEMPLATE,
+                     cpid, cpid, duid, cpid, duid, cpid, duid, cpid, duid
+            );
+        }
+    }
+    cJSON_Delete(root);
+    iotcl_mem_select(previous);
+    return response;
+}
+
+static bool mqtt_connect(
+        void *ctx,
+        const char *host,
+        int port,
+        const char *client_id,
+        const char *user_name,
+        const char *pass
+) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    (void) port;
+    (void) user_name;
+    (void) pass;
+    if (lb->fail_connects > 0) {
+        lb->fail_connects--;
+        lb->stats.failed_connects++;
+        return false;
+    }
+    if (!host || !client_id || 0 != strcmp(host, IOTC_LOOPBACK_HOST)) {
+        lb->stats.failed_connects++;
+        return false;
+    }
+    lb->connected = true;
+    lb->subscribed = false;
+    lb->puback_count = 0; // acknowledgements are lost with the old connection
+    lb->stats.connects++;
+    lb->resumed = !lb->no_session_resumption && lb->offered_session_len > 0
+            && lb->offered_session_len == lb->issued_session_len
+            && 0 == memcmp(lb->offered_session, lb->issued_session, lb->issued_session_len);
+    if (lb->resumed) {
+        lb->stats.resumed_connects++;
+    } else {
+        // full handshake. The broker issues a new session.
+        lb->sessions_issued++;
+        lb->issued_session_len = (size_t) snprintf(
+                (char *) lb->issued_session, sizeof(lb->issued_session), "loopback-session-%lu", lb->sessions_issued
+        );
+    }
+    return true;
+}
+
+static void mqtt_set_tls_session(void *ctx, const unsigned char *session, size_t len) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (len > sizeof(lb->offered_session)) {
+        len = 0; // cannot be one of ours
+    }
+    if (len > 0) {
+        memcpy(lb->offered_session, session, len);
+    }
+    lb->offered_session_len = len;
+}
+
+static size_t mqtt_get_tls_session(void *ctx, const unsigned char **session, bool *resumed) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    *resumed = lb->resumed;
+    if (!lb->connected || lb->no_session_resumption) {
+        *session = NULL;
+        return 0;
+    }
+    *session = lb->issued_session;
+    return lb->issued_session_len;
+}
+
+static void mqtt_disconnect(void *ctx) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    lb->connected = false;
+    lb->subscribed = false;
+}
+
+static bool mqtt_is_connected(void *ctx) {
+    return ((IotcLoopbackTransport *) ctx)->connected;
+}
+
+static bool mqtt_subscribe(void *ctx, const char *topic) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (!lb->connected || !topic) {
+        return false;
+    }
+    lb->subscribed = true;
+    return true;
+}
+
+static bool mqtt_publish(void *ctx, const char *topic, const char *data, size_t len) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (!lb->connected) {
+        return false;
+    }
+    if (lb->max_message_size && strlen(topic) + len > lb->max_message_size) {
+        return false;
+    }
+    lb->stats.published++;
+    lb->stats.published_bytes += len;
+    if (lb->on_publish) {
+        lb->on_publish(topic, data, len, lb->on_publish_user_data);
+    }
+    return true;
+}
+
+// The topic and the payload share the buffer, like in an MQTT client transmit buffer
+static char *mqtt_reserve(void *ctx, const char *topic, size_t *size) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    size_t topic_len = strlen(topic);
+    if (!lb->tx_buffer) {
+        lb->tx_buffer_size = lb->max_message_size ? lb->max_message_size : IOTC_LOOPBACK_TX_BUFFER_SIZE;
+        lb->tx_buffer = (char *) iotcl_mem_malloc(IOTCL_MEM_TRANSPORT, lb->tx_buffer_size);
+        if (!lb->tx_buffer) {
+            return NULL;
+        }
+    }
+    if (topic_len >= lb->tx_buffer_size) {
+        return NULL;
+    }
+    lb->tx_topic = topic;
+    *size = lb->tx_buffer_size - topic_len;
+    return &lb->tx_buffer[topic_len];
+}
+
+static bool mqtt_commit(void *ctx, size_t len) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (!lb->tx_buffer || !lb->tx_topic) {
+        return false;
+    }
+    size_t topic_len = strlen(lb->tx_topic);
+    if (len > lb->tx_buffer_size - topic_len) {
+        return false; // larger than what mqtt_reserve handed out
+    }
+    return mqtt_publish(ctx, lb->tx_topic, &lb->tx_buffer[topic_len], len);
+}
+
+static bool mqtt_publish_qos1(
+        void *ctx,
+        const char *topic,
+        const char *data,
+        size_t len,
+        unsigned short packet_id,
+        bool dup
+) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (!mqtt_publish(ctx, topic, data, len)) {
+        return false;
+    }
+    lb->stats.published_qos1++;
+    if (dup) {
+        lb->stats.duplicates++;
+    }
+    if (lb->drop_pubacks > 0) {
+        lb->drop_pubacks--;
+    } else if (lb->puback_count < IOTC_LOOPBACK_PUBACK_QUEUE_SIZE) {
+        lb->pubacks[lb->puback_count++] = packet_id;
+    }
+    return true;
+}
+
+static void mqtt_set_puback_callback(void *ctx, IotcTransportPubackCallback cb, void *user_data) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    lb->puback_cb = cb;
+    lb->puback_cb_user_data = user_data;
+}
+
+static bool mqtt_poll(void *ctx) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    if (!lb->connected) {
+        return false;
+    }
+    for (size_t i = 0; i < lb->puback_count; i++) {
+        if (lb->puback_cb) {
+            lb->puback_cb(lb->pubacks[i], lb->puback_cb_user_data);
+        }
+    }
+    lb->puback_count = 0;
+    // deliver only what is queued now. The callback may inject more messages.
+    size_t to_deliver = lb->subscribed ? lb->c2d_count : 0;
+    while (to_deliver-- > 0) {
+        char *message = lb->c2d_queue[lb->c2d_head];
+        lb->c2d_queue[lb->c2d_head] = NULL;
+        lb->c2d_head = (lb->c2d_head + 1) % IOTC_LOOPBACK_C2D_QUEUE_SIZE;
+        lb->c2d_count--;
+        lb->stats.delivered++;
+        if (lb->message_cb) {
+            lb->message_cb((const unsigned char *) message, strlen(message), lb->message_cb_user_data);
+        }
+        iotcl_mem_free(message);
+    }
+    return lb->connected;
+}
+
+static void mqtt_set_message_callback(void *ctx, IotcTransportMessageCallback cb, void *user_data) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    lb->message_cb = cb;
+    lb->message_cb_user_data = user_data;
+}
+
+static int http_request(void *ctx, const char *url, const char *post_data, char **response) {
+    IotcLoopbackTransport *lb = (IotcLoopbackTransport *) ctx;
+    lb->stats.http_requests++;
+    *response = NULL;
+    if (!post_data && strstr(url, "/api/sdk/cpid/")) {
+        *response = iotcl_strdup(DISCOVERY_RESPONSE);
+    } else if (post_data && strstr(url, IOTC_LOOPBACK_HOST) && strstr(url, "sync?")) {
+        *response = create_sync_response(post_data);
+    } else {
+        return -3; // like a connection failure
+    }
+    return *response ? 0 : -1;
+}
+
+void iotc_transport_loopback_init(IotcTransport *transport, IotcLoopbackTransport *loopback) {
+    memset(loopback, 0, sizeof(IotcLoopbackTransport));
+    transport->ctx = loopback;
+    transport->mqtt_connect = mqtt_connect;
+    transport->mqtt_disconnect = mqtt_disconnect;
+    transport->mqtt_is_connected = mqtt_is_connected;
+    transport->mqtt_subscribe = mqtt_subscribe;
+    transport->mqtt_publish = mqtt_publish;
+    transport->mqtt_reserve = mqtt_reserve;
+    transport->mqtt_commit = mqtt_commit;
+    transport->mqtt_publish_qos1 = mqtt_publish_qos1;
+    transport->mqtt_set_puback_callback = mqtt_set_puback_callback;
+    transport->mqtt_poll = mqtt_poll;
+    transport->mqtt_set_message_callback = mqtt_set_message_callback;
+    transport->mqtt_set_tls_session = mqtt_set_tls_session;
+    transport->mqtt_get_tls_session = mqtt_get_tls_session;
+    transport->http_request = http_request;
+    transport->http_close = NULL;
+    transport->get_tls_stats = NULL; // no TLS
+}
+
+void iotc_transport_loopback_deinit(IotcLoopbackTransport *loopback) {
+    for (size_t i = 0; i < IOTC_LOOPBACK_C2D_QUEUE_SIZE; i++) {
+        iotcl_mem_free(loopback->c2d_queue[i]);
+        loopback->c2d_queue[i] = NULL;
+    }
+    loopback->c2d_count = 0;
+    iotcl_mem_free(loopback->tx_buffer);
+    loopback->tx_buffer = NULL;
+    loopback->connected = false;
+    loopback->subscribed = false;
+}
+
+bool iotc_transport_loopback_inject(IotcLoopbackTransport *loopback, const char *message) {
+    if (loopback->c2d_count >= IOTC_LOOPBACK_C2D_QUEUE_SIZE) {
+        return false;
+    }
+    char *copy = iotcl_mem_strdup(IOTCL_MEM_TRANSPORT, message);
+    if (!copy) {
+        return false;
+    }
+    size_t tail = (loopback->c2d_head + loopback->c2d_count) % IOTC_LOOPBACK_C2D_QUEUE_SIZE;
+    loopback->c2d_queue[tail] = copy;
+    loopback->c2d_count++;
+    return true;
+}
@@ -0,0 +1,147 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "iotconnect_arena.h"
+#include "iotconnect_mem.h"
+
+// Strictest alignment of anything that cJSON allocates
+typedef union {
+    void *p;
+    double d;
+    long long ll;
+} MaxAlign;
+
+#define ALIGN_UP(x) (((x) + sizeof(MaxAlign) - 1) & ~(sizeof(MaxAlign) - 1))
+
+typedef struct ArenaBlockTag {
+    struct ArenaBlockTag *next; // older block
+    char *data;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// The first block and its data are in the same allocation as this struct
+struct IotclArenaTag {
+    ArenaBlock *blocks; // newest first
+    size_t block_size;
+    size_t used; // across all blocks
+    ArenaBlock first;
+};
+
+static IotclArena selected = NULL;
+static IotclArenaStats stats;
+
+static bool contains(IotclArena arena, const void *pointer) {
+    const char *p = (const char *) pointer;
+    for (ArenaBlock *b = arena->blocks; b; b = b->next) {
+        if (p >= b->data && p < b->data + b->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *CJSON_CDECL hook_malloc(size_t size) {
+    if (selected) {
+        return iotcl_arena_alloc(selected, size);
+    }
+    return iotcl_mem_malloc(iotcl_mem_get_selected(), size);
+}
+
+// Nodes of an arena tree can be freed while editing it, like when an item is replaced.
+// Their memory is simply not reused until the arena is destroyed.
+static void CJSON_CDECL hook_free(void *pointer) {
+    if (selected && contains(selected, pointer)) {
+        return;
+    }
+    iotcl_mem_free(pointer);
+}
+
+void iotcl_arena_install_hooks(void) {
+    cJSON_Hooks hooks = {hook_malloc, hook_free};
+    cJSON_InitHooks(&hooks);
+    selected = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void iotcl_arena_uninstall_hooks(void) {
+    cJSON_InitHooks(NULL);
+    selected = NULL;
+}
+
+IotclArena iotcl_arena_create(size_t block_size) {
+    const size_t header_size = ALIGN_UP(sizeof(struct IotclArenaTag));
+    block_size = ALIGN_UP(block_size);
+    IotclArena arena = (IotclArena) iotcl_mem_malloc(IOTCL_MEM_TELEMETRY, header_size + block_size);
+    if (!arena) {
+        return NULL;
+    }
+    arena->block_size = block_size;
+    arena->used = 0;
+    arena->first.next = NULL;
+    arena->first.data = (char *) arena + header_size;
+    arena->first.size = block_size;
+    arena->first.used = 0;
+    arena->blocks = &arena->first;
+    stats.arenas++;
+    return arena;
+}
+
+void *iotcl_arena_alloc(IotclArena arena, size_t size) {
+    size = ALIGN_UP(size);
+    ArenaBlock *b = arena->blocks;
+    if (b->size - b->used < size) {
+        const size_t header_size = ALIGN_UP(sizeof(ArenaBlock));
+        const size_t data_size = size > arena->block_size ? size : arena->block_size;
+        b = (ArenaBlock *) iotcl_mem_malloc(IOTCL_MEM_TELEMETRY, header_size + data_size);
+        if (!b) {
+            return NULL;
+        }
+        b->data = (char *) b + header_size;
+        b->size = data_size;
+        b->used = 0;
+        b->next = arena->blocks;
+        arena->blocks = b;
+        stats.extra_blocks++;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    arena->used += size;
+    return p;
+}
+
+IotclArena iotcl_arena_select(IotclArena arena) {
+    IotclArena previous = selected;
+    selected = arena;
+    return previous;
+}
+
+void iotcl_arena_destroy(IotclArena arena) {
+    if (!arena) {
+        return;
+    }
+    if (selected == arena) {
+        selected = NULL;
+    }
+    if (arena->used > stats.peak_used) {
+        stats.peak_used = arena->used;
+    }
+    ArenaBlock *b = arena->blocks;
+    while (b != &arena->first) {
+        ArenaBlock *next = b->next;
+        iotcl_mem_free(b);
+        b = next;
+    }
+    iotcl_mem_free(arena);
+}
+
+void iotcl_arena_get_stats(IotclArenaStats *s) {
+    memcpy(s, &stats, sizeof(stats));
+}
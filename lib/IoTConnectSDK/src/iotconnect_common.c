@@ -5,22 +5,118 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "iotconnect_common.h"
 
-static char timebuf[sizeof "2011-10-08T07:07:01.000Z"];
+#define MS_PER_DAY 86400000LL
 
-static const char *to_iso_timestamp(time_t *timestamp) {
-    time_t ts = timestamp ? *timestamp : time(NULL);
-    strftime(timebuf, (sizeof timebuf), "%Y-%m-%dT%H:%M:%S.000Z", gmtime(&ts));
-    return timebuf;
+static char timebuf[IOTCL_ISO_TIMESTAMP_SIZE];
+
+static char *put_digits(char *p, unsigned int value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = (char) ('0' + value % 10);
+        value /= 10;
+    }
+    return p + digits;
+}
+
+// Writes "YYYY-MM-DDT" for the number of days since the epoch.
+// Uses the days to civil date algorithm from http://howardhinnant.github.io/date_algorithms.html
+static void format_date(char *p, long days) {
+    days += 719468; // days from 0000-03-01 to 1970-01-01
+    const long era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned int doe = (unsigned int) (days - era * 146097); // day of the 400 year era
+    const unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // year of the era
+    const unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100); // day of the year, starting in March
+    const unsigned int mp = (5 * doy + 2) / 153;
+    const unsigned int day = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned int month = mp < 10 ? mp + 3 : mp - 9;
+    const long year = (long) yoe + era * 400 + (month <= 2);
+
+    p = put_digits(p, (unsigned int) year, 4);
+    *p++ = '-';
+    p = put_digits(p, month, 2);
+    *p++ = '-';
+    p = put_digits(p, day, 2);
+    *p = 'T';
+}
+
+// Writes "HH:MM:SS.mmmZ" and the terminator
+static void format_time_of_day(char *p, unsigned long ms_of_day) {
+    const unsigned long seconds = ms_of_day / 1000;
+    p = put_digits(p, (unsigned int) (seconds / 3600), 2);
+    *p++ = ':';
+    p = put_digits(p, (unsigned int) (seconds / 60 % 60), 2);
+    *p++ = ':';
+    p = put_digits(p, (unsigned int) (seconds % 60), 2);
+    *p++ = '.';
+    p = put_digits(p, (unsigned int) (ms_of_day % 1000), 3);
+    *p++ = 'Z';
+    *p = 0;
+}
+
+size_t iotcl_format_iso_timestamp(char buffer[IOTCL_ISO_TIMESTAMP_SIZE], long long utc_ms) {
+    if (utc_ms < 0) {
+        utc_ms = 0;
+    }
+    format_date(buffer, (long) (utc_ms / MS_PER_DAY));
+    format_time_of_day(&buffer[sizeof("2011-10-08T") - 1], (unsigned long) (utc_ms % MS_PER_DAY));
+    return IOTCL_ISO_TIMESTAMP_SIZE - 1;
+}
+
+long long iotcl_utc_ms_now(void) {
+    struct timeval tv;
+    if (0 != gettimeofday(&tv, NULL)) {
+        return (long long) time(NULL) * 1000;
+    }
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+size_t iotcl_iso_timestamp_now_into(char buffer[IOTCL_ISO_TIMESTAMP_SIZE]) {
+    return iotcl_format_iso_timestamp(buffer, iotcl_utc_ms_now());
 }
 
 const char *iotcl_to_iso_timestamp(time_t timestamp) {
-    return to_iso_timestamp(&timestamp);
+    iotcl_format_iso_timestamp(timebuf, (long long) timestamp * 1000);
+    return timebuf;
 }
 
 const char *iotcl_iso_timestamp_now() {
-    return to_iso_timestamp(NULL);
+    iotcl_iso_timestamp_now_into(timebuf);
+    return timebuf;
+}
+
+void iotcl_clock_sync(IotclClock *clock, long long utc_ms, unsigned long monotonic_ms) {
+    clock->utc_ms = utc_ms;
+    clock->last_monotonic_ms = monotonic_ms;
+    clock->synced = true;
+}
+
+bool iotcl_clock_is_synced(const IotclClock *clock) {
+    return clock->synced;
+}
+
+long long iotcl_clock_utc_ms(IotclClock *clock, unsigned long monotonic_ms) {
+    // unsigned subtraction keeps working when the counter wraps around
+    clock->utc_ms += (unsigned long) (monotonic_ms - clock->last_monotonic_ms);
+    clock->last_monotonic_ms = monotonic_ms;
+    return clock->utc_ms;
+}
+
+size_t iotcl_clock_timestamp(IotclClock *clock, unsigned long monotonic_ms, char buffer[IOTCL_ISO_TIMESTAMP_SIZE]) {
+    long long utc_ms = iotcl_clock_utc_ms(clock, monotonic_ms);
+    if (utc_ms < 0) {
+        utc_ms = 0;
+    }
+    const long day = (long) (utc_ms / MS_PER_DAY);
+    if (!clock->date_valid || day != clock->date_day) {
+        format_date(clock->date, day);
+        clock->date_day = day;
+        clock->date_valid = true;
+    }
+    memcpy(buffer, clock->date, sizeof(clock->date));
+    format_time_of_day(&buffer[sizeof(clock->date)], (unsigned long) (utc_ms % MS_PER_DAY));
+    return IOTCL_ISO_TIMESTAMP_SIZE - 1;
 }
 
 char *iotcl_strdup(const char *str) {
@@ -12,6 +12,7 @@
 
 #include "iotconnect_common.h"
 #include "iotconnect_discovery.h"
+#include "iotconnect_mem.h"
 
 static char *safe_get_string_and_strdup(cJSON *cjson, const char *value_name) {
     cJSON *value = cJSON_GetObjectItem(cjson, value_name);
@@ -22,7 +23,7 @@ static char *safe_get_string_and_strdup(cJSON *cjson, const char *value_name) {
     if (!str_value) {
         return NULL;
     }
-    return iotcl_strdup(str_value);
+    return iotcl_mem_strdup(IOTCL_MEM_DISCOVERY, str_value);
 }
 
 static bool split_url(IotclDiscoveryResponse *response) {
@@ -30,7 +31,7 @@ static bool split_url(IotclDiscoveryResponse *response) {
 
 
     // mutable version that will allow us to modify the url string
-    char *base_url_copy = iotcl_strdup(response->url);
+    char *base_url_copy = iotcl_mem_strdup(IOTCL_MEM_DISCOVERY, response->url);
     if (!base_url_copy) {
         return false;
     }
@@ -43,19 +44,19 @@ static bool split_url(IotclDiscoveryResponse *response) {
                 host = &base_url_copy[i + 1];
                 // host will be terminated below
             } else if (num_found == 3) {
-                response->path = iotcl_strdup(&base_url_copy[i]); // first make a copy
+                response->path = iotcl_mem_strdup(IOTCL_MEM_DISCOVERY, &base_url_copy[i]); // first make a copy
                 base_url_copy[i] = 0; // then terminate host so that it can be duped below
                 break;
             }
         }
     }
-    response->host = iotcl_strdup(host);
-    free(base_url_copy);
+    response->host = iotcl_mem_strdup(IOTCL_MEM_DISCOVERY, host);
+    iotcl_mem_free(base_url_copy);
 
     return (response->host && response->path);
 }
 
-IotclDiscoveryResponse *iotcl_discovery_parse_discovery_response(const char *response_data) {
+static IotclDiscoveryResponse *parse_discovery_response(const char *response_data) {
     cJSON *json_root = cJSON_Parse(response_data);
     if (!json_root) {
         return NULL;
@@ -67,7 +68,9 @@ IotclDiscoveryResponse *iotcl_discovery_parse_discovery_response(const char *res
         return NULL;
     }
 
-    IotclDiscoveryResponse *response = (IotclDiscoveryResponse *) calloc(1, sizeof(IotclDiscoveryResponse));
+    IotclDiscoveryResponse *response = (IotclDiscoveryResponse *) iotcl_mem_calloc(
+            IOTCL_MEM_DISCOVERY, 1, sizeof(IotclDiscoveryResponse)
+    );
     if (!response) {
         goto cleanup;
     }
@@ -78,7 +81,7 @@ IotclDiscoveryResponse *iotcl_discovery_parse_discovery_response(const char *res
             goto cleanup;
         }
 
-        response->url = iotcl_strdup(jsonBaseUrl);
+        response->url = iotcl_mem_strdup(IOTCL_MEM_DISCOVERY, jsonBaseUrl);
         if (split_url(response)) {
             cJSON_Delete(json_root);
             return response;
@@ -94,16 +97,18 @@ IotclDiscoveryResponse *iotcl_discovery_parse_discovery_response(const char *res
 
 void iotcl_discovery_free_discovery_response(IotclDiscoveryResponse *response) {
     if (response) {
-        free(response->url);
-        free(response->host);
-        free(response->path);
-        free(response);
+        iotcl_mem_free(response->url);
+        iotcl_mem_free(response->host);
+        iotcl_mem_free(response->path);
+        iotcl_mem_free(response);
     }
 }
 
-IotclSyncResponse *iotcl_discovery_parse_sync_response(const char *response_data) {
+static IotclSyncResponse *parse_sync_response(const char *response_data) {
     cJSON *tmp_value = NULL;
-    IotclSyncResponse *response = (IotclSyncResponse *) calloc(1, sizeof(IotclSyncResponse));
+    IotclSyncResponse *response = (IotclSyncResponse *) iotcl_mem_calloc(
+            IOTCL_MEM_DISCOVERY, 1, sizeof(IotclSyncResponse)
+    );
     if (NULL == response) {
         return NULL;
     }
@@ -190,15 +195,141 @@ void iotcl_discovery_free_sync_response(IotclSyncResponse *response) {
     if (!response) {
         return;
     }
-    free(response->cpid);
-    free(response->dtg);
-    free(response->broker.host);
-    free(response->broker.client_id);
-    free(response->broker.user_name);
-    free(response->broker.pass);
-    free(response->broker.name);
-    free(response->broker.sub_topic);
-    free(response->broker.pub_topic);
-    free(response);
+    iotcl_mem_free(response->cpid);
+    iotcl_mem_free(response->dtg);
+    iotcl_mem_free(response->broker.host);
+    iotcl_mem_free(response->broker.client_id);
+    iotcl_mem_free(response->broker.user_name);
+    iotcl_mem_free(response->broker.pass);
+    iotcl_mem_free(response->broker.name);
+    iotcl_mem_free(response->broker.sub_topic);
+    iotcl_mem_free(response->broker.pub_topic);
+    iotcl_mem_free(response);
+}
+
+
+// The cache is shaped like the discovery and sync responses combined, so that the same parsers can read it back:
+// {"v":1,"ts":<saved_at>,"baseUrl":"...","d":{"ds":0,"cpId":"...","dtg":"...","p":{"n":...,"id":...}}}
+static bool add_optional_string(cJSON *object, const char *name, const char *value) {
+    if (!value) {
+        return true; // the parser treats missing values as NULL
+    }
+    return NULL != cJSON_AddStringToObject(object, name, value);
+}
+
+static char *create_cache(const IotclDiscoveryResponse *dr, const IotclSyncResponse *sr, time_t saved_at) {
+    char *result = NULL;
+    if (!dr || !sr || !dr->url || sr->ds != IOTCL_SR_OK) {
+        return NULL;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    if (!root) {
+        return NULL;
+    }
+
+    if (!cJSON_AddNumberToObject(root, "v", IOTCL_DISCOVERY_CACHE_VERSION)) goto cleanup;
+    if (!cJSON_AddNumberToObject(root, "ts", (double) saved_at)) goto cleanup;
+    if (!cJSON_AddStringToObject(root, "baseUrl", dr->url)) goto cleanup;
+
+    {
+        cJSON *d = cJSON_AddObjectToObject(root, "d");
+        if (!d) goto cleanup;
+        if (!cJSON_AddNumberToObject(d, "ds", IOTCL_SR_OK)) goto cleanup;
+        if (!add_optional_string(d, "cpId", sr->cpid)) goto cleanup;
+        if (!add_optional_string(d, "dtg", sr->dtg)) goto cleanup;
+
+        cJSON *p = cJSON_AddObjectToObject(d, "p");
+        if (!p) goto cleanup;
+        if (!add_optional_string(p, "n", sr->broker.name)) goto cleanup;
+        if (!add_optional_string(p, "id", sr->broker.client_id)) goto cleanup;
+        if (!add_optional_string(p, "h", sr->broker.host)) goto cleanup;
+        if (!add_optional_string(p, "un", sr->broker.user_name)) goto cleanup;
+        if (!add_optional_string(p, "pwd", sr->broker.pass)) goto cleanup;
+        if (!add_optional_string(p, "sub", sr->broker.sub_topic)) goto cleanup;
+        if (!add_optional_string(p, "pub", sr->broker.pub_topic)) goto cleanup;
+    }
+
+    {
+        // the caller frees the result with free(), so it cannot be left in tracked memory
+        char *printed = cJSON_PrintUnformatted(root);
+        result = iotcl_strdup(printed);
+        cJSON_free(printed);
+    }
+
+    // fall through
+    cleanup:
+    cJSON_Delete(root);
+    return result;
 }
 
+static bool parse_cache(
+        const char *cache_data,
+        IotclDiscoveryResponse **dr,
+        IotclSyncResponse **sr,
+        time_t *saved_at
+) {
+    *dr = NULL;
+    *sr = NULL;
+
+    cJSON *root = cJSON_Parse(cache_data);
+    if (!root) {
+        return false;
+    }
+    cJSON *version = cJSON_GetObjectItemCaseSensitive(root, "v");
+    cJSON *ts = cJSON_GetObjectItemCaseSensitive(root, "ts");
+    bool valid = cJSON_IsNumber(version) && version->valueint == IOTCL_DISCOVERY_CACHE_VERSION && cJSON_IsNumber(ts);
+    if (valid && saved_at) {
+        *saved_at = (time_t) ts->valuedouble;
+    }
+    cJSON_Delete(root);
+    if (!valid) {
+        return false;
+    }
+
+    *dr = parse_discovery_response(cache_data);
+    *sr = parse_sync_response(cache_data);
+    if (!*dr || !*sr || (*sr)->ds != IOTCL_SR_OK) {
+        iotcl_discovery_free_discovery_response(*dr);
+        iotcl_discovery_free_sync_response(*sr);
+        *dr = NULL;
+        *sr = NULL;
+        return false;
+    }
+    return true;
+}
+
+// The public functions count cJSON allocations against discovery
+
+IotclDiscoveryResponse *iotcl_discovery_parse_discovery_response(const char *response_data) {
+    IotclMemSubsystem previous = iotcl_mem_select(IOTCL_MEM_DISCOVERY);
+    IotclDiscoveryResponse *ret = parse_discovery_response(response_data);
+    iotcl_mem_select(previous);
+    return ret;
+}
+
+IotclSyncResponse *iotcl_discovery_parse_sync_response(const char *response_data) {
+    IotclMemSubsystem previous = iotcl_mem_select(IOTCL_MEM_DISCOVERY);
+    IotclSyncResponse *ret = parse_sync_response(response_data);
+    iotcl_mem_select(previous);
+    return ret;
+}
+
+char *iotcl_discovery_create_cache(const IotclDiscoveryResponse *dr, const IotclSyncResponse *sr, time_t saved_at) {
+    IotclMemSubsystem previous = iotcl_mem_select(IOTCL_MEM_DISCOVERY);
+    char *ret = create_cache(dr, sr, saved_at);
+    iotcl_mem_select(previous);
+    return ret;
+}
+
+bool iotcl_discovery_parse_cache(
+        const char *cache_data,
+        IotclDiscoveryResponse **dr,
+        IotclSyncResponse **sr,
+        time_t *saved_at
+) {
+    IotclMemSubsystem previous = iotcl_mem_select(IOTCL_MEM_DISCOVERY);
+    bool ret = parse_cache(cache_data, dr, sr, saved_at);
+    iotcl_mem_select(previous);
+    return ret;
+}
@@ -5,25 +5,50 @@
  */
 #include <stdlib.h>
 #include <string.h>
-#include "cJSON.h"
 
 #include "iotconnect_common.h"
 #include "iotconnect_lib.h"
-
-#define CJSON_ADD_ITEM_HAS_RETURN \
-    (CJSON_VERSION_MAJOR * 10000 + CJSON_VERSION_MINOR * 100 + CJSON_VERSION_PATCH >= 10713)
-
-#if !CJSON_ADD_ITEM_HAS_RETURN
-#define XSTR(x) STR(x)
-#define STR(x) #x
-#pragma message "Patch:" XSTR(CJSON_VERSION_PATCH)
-#error "cJSON version must be 1.7.13 or newer"
-#endif
-
+#include "iotconnect_mem.h"
+
+// Number of OTA download URLs that are kept in the event itself. More are allocated separately.
+#define EVENT_INLINE_URLS 8
+
+// Max nesting of JSON objects and arrays in an event. Same as CJSON_NESTING_LIMIT in the cJSON based implementation.
+// Only the few levels that hold the fields of interest are decoded recursively, so this does not affect the stack.
+#define EVENT_MAX_DEPTH 1000
+
+// Fields that are taken from the first occurrence of their key. @see set_first
+#define FIELD_CMD_TYPE   (1u << 0u)
+#define FIELD_ACK_ID     (1u << 1u)
+#define FIELD_CPID       (1u << 2u)
+#define FIELD_UNIQUE_ID  (1u << 3u)
+#define FIELD_COMMAND    (1u << 4u)
+#define FIELD_SW_VERSION (1u << 5u)
+#define FIELD_HW_VERSION (1u << 6u)
+
+// The event is decoded without building a JSON tree. The message is copied once into this struct
+// and the string values of interest are unescaped and null-terminated in place in that copy.
+// Fields are NULL if they were not present in the message.
 struct IotclEventDataTag {
-    cJSON *data;
-    cJSON *root;
+    IotclContext ctx; // the device identity that received the event
     IotConnectEventType type;
+    const char *cmd_type;
+    const char *ack_id;
+    const char *cpid;
+    const char *unique_id;
+    const char *command;
+    const char *sw_version;
+    const char *hw_version;
+    const char *urls[EVENT_INLINE_URLS]; // NULL for array elements that are not usable URLs
+    const char **more_urls; // URLs past EVENT_INLINE_URLS
+    size_t more_urls_size;
+    size_t num_urls; // number of elements in the urls array
+    unsigned int fields_seen;
+    bool url_key_seen; // for the current element of the urls array
+    bool data_seen;
+    bool ver_seen;
+    bool urls_seen;
+    char message[]; // private copy of the message
 };
 
 /*
@@ -59,8 +84,7 @@ static int to_ack_status(bool success, IotConnectEventType type) {
 static bool iotc_process_callback(struct IotclEventDataTag *eventData) {
     if (!eventData) return false;
 
-    IotclConfig *config = iotcl_get_config();
-    if (!config) return false;
+    IotclConfig *config = &eventData->ctx->config;
 
     if (config->event_functions.msg_cb) {
         config->event_functions.msg_cb(eventData, eventData->type);
@@ -84,198 +108,702 @@ static bool iotc_process_callback(struct IotclEventDataTag *eventData) {
 }
 
 
-/************************ CJSON IMPLEMENTATION **************************/
-static inline bool is_valid_string(const cJSON *json) {
-    return (NULL != json && cJSON_IsString(json) && json->valuestring != NULL);
+/************************ EVENT DECODER **************************/
+
+// Where a value is located in the message, for the values that we care about
+typedef enum {
+    CTX_OTHER,
+    CTX_ROOT,
+    CTX_DATA, // root "data" object
+    CTX_VER, // data "ver" object
+    CTX_URLS, // data "urls" array
+    CTX_URL // an element of the urls array
+} ScanContext;
+
+typedef struct {
+    char *p;
+    char *end;
+} Scanner;
+
+static bool scan_value(Scanner *s, int depth, ScanContext ctx, struct IotclEventDataTag *e, char **str);
+
+static bool equals_ignore_case(const char *a, const char *b) {
+    for (; *a && *b; a++, b++) {
+        char ca = (char) ((*a >= 'A' && *a <= 'Z') ? *a + ('a' - 'A') : *a);
+        char cb = (char) ((*b >= 'A' && *b <= 'Z') ? *b + ('a' - 'A') : *b);
+        if (ca != cb) return false;
+    }
+    return *a == *b;
 }
 
-bool iotcl_process_event(const char *event) {
-    cJSON *root = cJSON_Parse(event);
-    if (!root) return false;
-
-    { // scope out the on-the fly varialble declarations for cleanup jump
-        // root object should only have cmdType
-        cJSON *j_type = cJSON_GetObjectItemCaseSensitive(root, "cmdType");
-        if (!is_valid_string(j_type)) goto cleanup;
-
-        cJSON *j_ack_id = NULL;
-        cJSON *data = NULL; // data should have ackId
-        if (!is_valid_string(j_ack_id)) {
-            data = cJSON_GetObjectItemCaseSensitive(root, "data");
-            if (!data) goto cleanup;
-            j_ack_id = cJSON_GetObjectItemCaseSensitive(data, "ackId");
-            if (!is_valid_string(j_ack_id)) goto cleanup;
-        }
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
 
-        if (4 != strlen(j_type->valuestring)) {
-            // Don't know how to parse it then...
-            goto cleanup;
-        }
+// Like cJSON, any control character counts as whitespace
+static void skip_whitespace(Scanner *s) {
+    while (s->p < s->end && (unsigned char) *s->p <= 32) {
+        s->p++;
+    }
+}
 
-        IotConnectEventType type = (IotConnectEventType) strtol(&j_type->valuestring[2], NULL, 16);
+// Invalid digits make the value zero, like in cJSON parse_hex4()
+static bool scan_hex4(Scanner *s, unsigned int *value) {
+    bool valid = true;
+    if (s->end - s->p < 4) return false;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *s->p++;
+        *value <<= 4;
+        if (c >= '0' && c <= '9') *value |= (unsigned int) (c - '0');
+        else if (c >= 'a' && c <= 'f') *value |= (unsigned int) (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') *value |= (unsigned int) (c - 'A' + 10);
+        else if (c == '"' || c == '\\') return false; // the string ends or has another escape here
+        else valid = false;
+    }
+    if (!valid) *value = 0;
+    return true;
+}
 
-        if (type < DEVICE_COMMAND) {
-            goto cleanup;
-        }
+static char *put_utf8(char *w, unsigned int cp) {
+    if (cp < 0x80) {
+        *w++ = (char) cp;
+    } else if (cp < 0x800) {
+        *w++ = (char) (0xC0 | (cp >> 6));
+        *w++ = (char) (0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *w++ = (char) (0xE0 | (cp >> 12));
+        *w++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char) (0x80 | (cp & 0x3F));
+    } else {
+        *w++ = (char) (0xF0 | (cp >> 18));
+        *w++ = (char) (0x80 | ((cp >> 12) & 0x3F));
+        *w++ = (char) (0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char) (0x80 | (cp & 0x3F));
+    }
+    return w;
+}
 
-        // In case we have a supported command. Do some checks before allowing further processing of acks
-        // NOTE: "i" in cpId is lower case, but per spec it's supposed to be in upper case
-        if (type == DEVICE_COMMAND || type == DEVICE_OTA) {
-            if (
-                    !is_valid_string(cJSON_GetObjectItem(data, "cpid"))
-                    || !is_valid_string(cJSON_GetObjectItemCaseSensitive(data, "uniqueId"))
-                    ) {
-                goto cleanup;
+// Unescapes the string in place and null-terminates it. The decoded string is never longer than the
+// escaped one, so writing never overtakes reading, and the terminator at most replaces the closing quote.
+static bool scan_string(Scanner *s, char **out) {
+    if (s->p >= s->end || *s->p != '"') return false;
+    char *start = ++s->p;
+    char *w = start;
+    while (s->p < s->end) {
+        char c = *s->p++;
+        if (c == '"') {
+            *w = 0;
+            *out = start;
+            return true;
+        }
+        if (c != '\\') {
+            *w++ = c;
+            continue;
+        }
+        if (s->p >= s->end) return false;
+        c = *s->p++;
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                *w++ = c;
+                break;
+            case 'b':
+                *w++ = '\b';
+                break;
+            case 'f':
+                *w++ = '\f';
+                break;
+            case 'n':
+                *w++ = '\n';
+                break;
+            case 'r':
+                *w++ = '\r';
+                break;
+            case 't':
+                *w++ = '\t';
+                break;
+            case 'u': {
+                unsigned int cp;
+                if (!scan_hex4(s, &cp)) return false;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned int low;
+                    if (s->end - s->p < 2 || s->p[0] != '\\' || s->p[1] != 'u') return false;
+                    s->p += 2;
+                    if (!scan_hex4(s, &low) || low < 0xDC00 || low > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+                w = put_utf8(w, cp);
+                break;
             }
+            default:
+                return false;
         }
+    }
+    return false;
+}
 
-        struct IotclEventDataTag *eventData = (struct IotclEventDataTag *) calloc(
-                sizeof(struct IotclEventDataTag), 1);
-        if (NULL == eventData) goto cleanup;
+static bool scan_literal(Scanner *s, const char *literal) {
+    size_t len = strlen(literal);
+    if ((size_t) (s->end - s->p) < len || 0 != memcmp(s->p, literal, len)) return false;
+    s->p += len;
+    return true;
+}
 
-        eventData->root = root;
-        eventData->data = data;
-        eventData->type = type;
-        return iotc_process_callback(eventData);
+// Accepts what strtod() would accept of the characters that cJSON parse_number() passes to it
+static bool scan_number(Scanner *s) {
+    char *p = s->p;
+    bool has_digits = false;
+    if (p < s->end && *p == '-') p++;
+    for (; p < s->end && is_digit(*p); p++) has_digits = true;
+    if (p < s->end && *p == '.') {
+        for (p++; p < s->end && is_digit(*p); p++) has_digits = true;
     }
+    if (!has_digits) return false;
+    if (p < s->end && (*p == 'e' || *p == 'E')) {
+        char *exp = p + 1;
+        if (exp < s->end && (*exp == '+' || *exp == '-')) exp++;
+        if (exp < s->end && is_digit(*exp)) {
+            for (p = exp; p < s->end && is_digit(*p); p++);
+        }
+    }
+    s->p = p;
+    return true;
+}
 
-    cleanup:
-    if (root) {
-        cJSON_free(root);
+// Scans a value that is not an object or an array
+static bool scan_scalar(Scanner *s, char **str) {
+    switch (*s->p) {
+        case '"':
+            return scan_string(s, str);
+        case 't':
+            return scan_literal(s, "true");
+        case 'f':
+            return scan_literal(s, "false");
+        case 'n':
+            return scan_literal(s, "null");
+        default:
+            return (*s->p == '-' || is_digit(*s->p)) && scan_number(s);
     }
-    return false;
+}
 
+static bool scan_key(Scanner *s, char **key) {
+    skip_whitespace(s);
+    if (!scan_string(s, key)) return false;
+    skip_whitespace(s);
+    if (s->p >= s->end || *s->p != ':') return false;
+    s->p++;
+    return true;
 }
 
-char *iotcl_clone_command(IotclEventData data) {
-    cJSON *command = cJSON_GetObjectItemCaseSensitive(data->data, "command");
-    if (NULL == command || !is_valid_string(command)) {
-        return NULL;
+// Validates an object or an array that holds none of the fields that we care about.
+// Nested values are tracked with a bit per level instead of recursion, so deep nesting cannot exhaust the stack.
+static bool skip_container(Scanner *s, int depth) {
+    unsigned char is_object[EVENT_MAX_DEPTH / 8 + 1];
+    int level = 0; // levels open within this container
+    char *key;
+    char *str;
+    for (;;) {
+        skip_whitespace(s);
+        if (s->p >= s->end) return false;
+        const char c = *s->p;
+        if (c == '{' || c == '[') {
+            if (depth + level >= EVENT_MAX_DEPTH) return false;
+            if (c == '{') {
+                is_object[level / 8] |= (unsigned char) (1u << (level % 8));
+            } else {
+                is_object[level / 8] &= (unsigned char) ~(1u << (level % 8));
+            }
+            level++;
+            s->p++;
+            skip_whitespace(s);
+            if (s->p < s->end && *s->p == (c == '{' ? '}' : ']')) {
+                s->p++;
+                level--;
+            } else {
+                if (c == '{' && !scan_key(s, &key)) return false;
+                continue; // the first value in the container
+            }
+        } else if (!scan_scalar(s, &str)) {
+            return false;
+        }
+        // after a value, close the containers that end here and move on to the next value
+        for (;;) {
+            if (0 == level) return true;
+            skip_whitespace(s);
+            if (s->p >= s->end) return false;
+            const bool in_object = 0 != (is_object[(level - 1) / 8] & (1u << ((level - 1) % 8)));
+            if (*s->p == ',') {
+                s->p++;
+                if (in_object && !scan_key(s, &key)) return false;
+                break;
+            }
+            if (*s->p != (in_object ? '}' : ']')) return false;
+            s->p++;
+            level--;
+        }
     }
+}
 
-    return iotcl_strdup(command->valuestring);
+// Only the first occurrence of a key counts, even if its value is not a string, like with cJSON_GetObjectItem()
+static void set_first(struct IotclEventDataTag *e, unsigned int field, const char **dest, const char *value) {
+    if (0 == (e->fields_seen & field)) {
+        e->fields_seen |= field;
+        *dest = value;
+    }
 }
 
-char *iotcl_clone_download_url(IotclEventData data, size_t index) {
-    cJSON *urls = cJSON_GetObjectItemCaseSensitive(data->data, "urls");
-    if (NULL == urls || !cJSON_IsArray(urls)) {
-        return NULL;
+static const char **url_slot(struct IotclEventDataTag *e, size_t index) {
+    return index < EVENT_INLINE_URLS ? &e->urls[index] : &e->more_urls[index - EVENT_INLINE_URLS];
+}
+
+// Makes room for the urls array element with index num_urls
+static bool reserve_url_slot(struct IotclEventDataTag *e) {
+    if (e->num_urls < EVENT_INLINE_URLS + e->more_urls_size) {
+        return true;
     }
-    if ((size_t) cJSON_GetArraySize(urls) > index) {
-        cJSON *url = cJSON_GetArrayItem(urls, index);
-        if (is_valid_string(url)) {
-            return iotcl_strdup(url->valuestring);
-        } else if (cJSON_IsObject(url)) {
-            cJSON *url_str = cJSON_GetObjectItem(url, "url");
-            if (is_valid_string(url_str)) {
-                return iotcl_strdup(url_str->valuestring);
+    size_t new_size = e->more_urls_size ? e->more_urls_size * 2 : EVENT_INLINE_URLS;
+    const char **more_urls = (const char **) iotcl_mem_realloc(
+            IOTCL_MEM_EVENTS, (void *) e->more_urls, new_size * sizeof(const char *)
+    );
+    if (!more_urls) return false;
+    memset((void *) &more_urls[e->more_urls_size], 0, (new_size - e->more_urls_size) * sizeof(const char *));
+    e->more_urls = more_urls;
+    e->more_urls_size = new_size;
+    return true;
+}
+
+// Records the value of a key if it is one of the fields that we care about. value is NULL if it is not a string.
+// Key matching is the same as in the original cJSON based implementation (GetObjectItem is case insensitive).
+static void assign_field(ScanContext ctx, const char *key, const char *value, struct IotclEventDataTag *e) {
+    switch (ctx) {
+        case CTX_ROOT:
+            if (0 == strcmp(key, "cmdType")) set_first(e, FIELD_CMD_TYPE, &e->cmd_type, value);
+            break;
+        case CTX_DATA:
+            if (0 == strcmp(key, "ackId")) set_first(e, FIELD_ACK_ID, &e->ack_id, value);
+            else if (0 == strcmp(key, "uniqueId")) set_first(e, FIELD_UNIQUE_ID, &e->unique_id, value);
+            else if (0 == strcmp(key, "command")) set_first(e, FIELD_COMMAND, &e->command, value);
+            else if (equals_ignore_case(key, "cpid")) set_first(e, FIELD_CPID, &e->cpid, value);
+            break;
+        case CTX_VER:
+            if (equals_ignore_case(key, "sw")) set_first(e, FIELD_SW_VERSION, &e->sw_version, value);
+            else if (equals_ignore_case(key, "hw")) set_first(e, FIELD_HW_VERSION, &e->hw_version, value);
+            break;
+        case CTX_URL:
+            if (!e->url_key_seen && equals_ignore_case(key, "url")) {
+                e->url_key_seen = true;
+                *url_slot(e, e->num_urls) = value;
             }
-        }
+            break;
+        default:
+            break;
     }
-    return NULL;
 }
 
+static ScanContext child_context(ScanContext ctx, const char *key, struct IotclEventDataTag *e) {
+    if (ctx == CTX_ROOT && !e->data_seen && 0 == strcmp(key, "data")) {
+        e->data_seen = true;
+        return CTX_DATA;
+    }
+    if (ctx == CTX_DATA && !e->ver_seen && 0 == strcmp(key, "ver")) {
+        e->ver_seen = true;
+        return CTX_VER;
+    }
+    if (ctx == CTX_DATA && !e->urls_seen && 0 == strcmp(key, "urls")) {
+        e->urls_seen = true;
+        return CTX_URLS;
+    }
+    return CTX_OTHER;
+}
 
-char *iotcl_clone_sw_version(IotclEventData data) {
-    cJSON *ver = cJSON_GetObjectItemCaseSensitive(data->data, "ver");
-    if (cJSON_IsObject(ver)) {
-        cJSON *sw = cJSON_GetObjectItem(ver, "sw");
-        if (is_valid_string(sw)) {
-            return iotcl_strdup(sw->valuestring);
+static bool scan_object(Scanner *s, int depth, ScanContext ctx, struct IotclEventDataTag *e) {
+    if (depth > EVENT_MAX_DEPTH) return false;
+    s->p++; // opening brace
+    skip_whitespace(s);
+    if (s->p < s->end && *s->p == '}') {
+        s->p++;
+        return true;
+    }
+    for (;;) {
+        char *key;
+        char *value = NULL;
+        if (!scan_key(s, &key)) return false;
+        if (!scan_value(s, depth, child_context(ctx, key, e), e, &value)) return false;
+        assign_field(ctx, key, value, e);
+        skip_whitespace(s);
+        if (s->p >= s->end) return false;
+        if (*s->p == ',') {
+            s->p++;
+        } else if (*s->p == '}') {
+            s->p++;
+            return true;
+        } else {
+            return false;
         }
     }
-    return NULL;
 }
 
-char *iotcl_clone_hw_version(IotclEventData data) {
-    cJSON *ver = cJSON_GetObjectItemCaseSensitive(data->data, "ver");
-    if (cJSON_IsObject(ver)) {
-        cJSON *sw = cJSON_GetObjectItem(ver, "hw");
-        if (is_valid_string(sw)) {
-            return iotcl_strdup(sw->valuestring);
+static bool scan_array(Scanner *s, int depth, ScanContext ctx, struct IotclEventDataTag *e) {
+    if (depth > EVENT_MAX_DEPTH) return false;
+    s->p++; // opening bracket
+    skip_whitespace(s);
+    if (s->p < s->end && *s->p == ']') {
+        s->p++;
+        return true;
+    }
+    for (;;) {
+        char *value = NULL;
+        if (ctx == CTX_URLS) {
+            // URLs can be plain strings or objects with a "url" member
+            if (!reserve_url_slot(e)) return false;
+            e->url_key_seen = false;
+            if (!scan_value(s, depth, CTX_URL, e, &value)) return false;
+            if (value) {
+                *url_slot(e, e->num_urls) = value;
+            }
+            e->num_urls++;
+        } else if (!scan_value(s, depth, CTX_OTHER, e, &value)) {
+            return false;
+        }
+        skip_whitespace(s);
+        if (s->p >= s->end) return false;
+        if (*s->p == ',') {
+            s->p++;
+        } else if (*s->p == ']') {
+            s->p++;
+            return true;
+        } else {
+            return false;
         }
     }
-    return NULL;
 }
 
-char *iotcl_clone_ack_id(IotclEventData data) {
-    cJSON *ackid = cJSON_GetObjectItemCaseSensitive(data->data, "ackId");
-    if (is_valid_string(ackid)) {
-        return iotcl_strdup(ackid->valuestring);
+// Validates the value and decodes the fields that we care about. If the value is a string, str is set to it.
+static bool scan_value(Scanner *s, int depth, ScanContext ctx, struct IotclEventDataTag *e, char **str) {
+    skip_whitespace(s);
+    if (s->p >= s->end) return false;
+    switch (*s->p) {
+        case '{':
+            return ctx == CTX_OTHER ? skip_container(s, depth) : scan_object(s, depth + 1, ctx, e);
+        case '[':
+            return ctx == CTX_OTHER ? skip_container(s, depth) : scan_array(s, depth + 1, ctx, e);
+        default:
+            return scan_scalar(s, str);
     }
-    return NULL;
 }
 
-static char *create_ack(
-        bool success,
-        const char *message,
-        IotConnectEventType message_type,
-        const char *ack_id) {
+bool iotcl_process_event(const char *event) {
+    return iotcl_process_event_with_length_ctx(iotcl_get_default_context(), event, strlen(event));
+}
 
-    char *result = NULL;
+bool iotcl_process_event_with_length(const char *event, size_t event_len) {
+    return iotcl_process_event_with_length_ctx(iotcl_get_default_context(), event, event_len);
+}
 
-    IotclConfig *config = iotcl_get_config();
+bool iotcl_process_event_ctx(IotclContext ctx, const char *event) {
+    return iotcl_process_event_with_length_ctx(ctx, event, strlen(event));
+}
 
-    if (!config) {
-        return NULL;
+bool iotcl_process_event_with_length_ctx(IotclContext ctx, const char *event, size_t event_len) {
+    if (!iotcl_context_get_config(ctx)) return false;
+    // single allocation for the decoded fields and the message that they point into
+    struct IotclEventDataTag *e = (struct IotclEventDataTag *) iotcl_mem_malloc(
+            IOTCL_MEM_EVENTS, sizeof(struct IotclEventDataTag) + event_len + 1
+    );
+    if (!e) return false;
+    memset(e, 0, sizeof(struct IotclEventDataTag));
+    e->ctx = ctx;
+    memcpy(e->message, event, event_len);
+    e->message[event_len] = 0;
+
+    Scanner s = {e->message, e->message + event_len};
+    char *root_string = NULL;
+    skip_whitespace(&s);
+    if (s.p >= s.end || *s.p != '{') goto cleanup; // root must be an object
+    if (!scan_value(&s, 0, CTX_ROOT, e, &root_string)) goto cleanup;
+
+    // root object should only have cmdType and data should have ackId
+    if (!e->cmd_type || !e->ack_id) goto cleanup;
+
+    if (4 != strlen(e->cmd_type)) {
+        // Don't know how to parse it then...
+        goto cleanup;
     }
 
-    cJSON *ack_json = cJSON_CreateObject();
+    e->type = (IotConnectEventType) strtol(&e->cmd_type[2], NULL, 16);
 
-    if (ack_json == NULL) {
-        return NULL;
+    if (e->type < DEVICE_COMMAND) {
+        goto cleanup;
     }
 
-    // message type 5 in response is the command response. Type 11 is OTA response.
-    if (!cJSON_AddNumberToObject(ack_json, "mt", message_type == DEVICE_COMMAND ? 5 : 11)) goto cleanup;
-    if (!cJSON_AddStringToObject(ack_json, "t", iotcl_iso_timestamp_now())) goto cleanup;
+    // In case we have a supported command. Do some checks before allowing further processing of acks
+    // NOTE: "i" in cpId is lower case, but per spec it's supposed to be in upper case
+    if (e->type == DEVICE_COMMAND || e->type == DEVICE_OTA) {
+        if (!e->cpid || !e->unique_id) {
+            goto cleanup;
+        }
+    }
 
-    if (!cJSON_AddStringToObject(ack_json, "uniqueId", config->device.duid)) goto cleanup;
-    if (!cJSON_AddStringToObject(ack_json, "cpId", config->device.cpid)) goto cleanup;
+    return iotc_process_callback(e);
 
-    {
-        cJSON *sdk_info = cJSON_CreateObject();
-        if (NULL == sdk_info) {
-            return NULL;
-        }
-        if (!cJSON_AddItemToObject(ack_json, "sdk", sdk_info)) {
-            cJSON_Delete(sdk_info);
-            goto cleanup;
+    cleanup:
+    iotcl_destroy_event(e);
+    return false;
+}
+
+IotclContext iotcl_event_get_context(IotclEventData data) {
+    return data ? data->ctx : NULL;
+}
+
+char *iotcl_clone_command(IotclEventData data) {
+    return iotcl_strdup(data->command);
+}
+
+const char *iotcl_get_command(IotclEventData data) {
+    return data->command;
+}
+
+char *iotcl_clone_download_url(IotclEventData data, size_t index) {
+    if (index < data->num_urls) {
+        return iotcl_strdup(*url_slot(data, index));
+    }
+    return NULL;
+}
+
+char *iotcl_clone_sw_version(IotclEventData data) {
+    return iotcl_strdup(data->sw_version);
+}
+
+char *iotcl_clone_hw_version(IotclEventData data) {
+    return iotcl_strdup(data->hw_version);
+}
+
+char *iotcl_clone_ack_id(IotclEventData data) {
+    return iotcl_strdup(data->ack_id);
+}
+
+/************************ ACKS **************************/
+// Acks are rendered directly as text. The output is the same as what cJSON_PrintUnformatted would produce:
+// {"mt":5,"t":"<time>","uniqueId":"<duid>","cpId":"<cpid>","sdk":{"l":"M_C","v":"2.0","e":"<env>"},"d":{"ackId":"<id>","msg":"<msg>","st":6}}
+// Everything between the time and the ack ID depends only on the configuration, so it is rendered once at init.
+
+typedef struct {
+    char *buffer; // if NULL, the output length is only measured
+    size_t size;
+    size_t len;
+    bool overflow;
+} AckWriter;
+
+static void ack_write(AckWriter *w, const char *str, size_t len) {
+    if (w->overflow) return;
+    if (w->buffer) {
+        // always keep one byte for the string terminator
+        if (w->len + len + 1 > w->size) {
+            w->overflow = true;
+            return;
         }
-        if (!cJSON_AddStringToObject(sdk_info, "l", CONFIG_IOTCONNECT_SDK_NAME)) goto cleanup;
-        if (!cJSON_AddStringToObject(sdk_info, "v", CONFIG_IOTCONNECT_SDK_VERSION)) goto cleanup;
-        if (!cJSON_AddStringToObject(sdk_info, "e", config->device.env)) goto cleanup;
+        memcpy(&w->buffer[w->len], str, len);
     }
+    w->len += len;
+}
 
-    {
-        cJSON *ack_data = cJSON_CreateObject();
-        if (NULL == ack_data) goto cleanup;
-        if (!cJSON_AddItemToObject(ack_json, "d", ack_data)) {
-            cJSON_Delete(ack_data);
-            goto cleanup;
+static void ack_write_str(AckWriter *w, const char *str) {
+    ack_write(w, str, strlen(str));
+}
+
+// Writes the string contents with JSON escaping, without the quotes
+static void ack_write_escaped(AckWriter *w, const char *str) {
+    static const char HEX[] = "0123456789abcdef";
+    const char *run_start = str;
+    const char *p;
+    for (p = str; *p; p++) {
+        const unsigned char c = (unsigned char) *p;
+        if (c > 31 && c != '\"' && c != '\\') {
+            continue;
         }
-        if (!cJSON_AddStringToObject(ack_data, "ackId", ack_id)) goto cleanup;
-        if (!cJSON_AddStringToObject(ack_data, "msg", message ? message : "")) goto cleanup;
-        if (!cJSON_AddNumberToObject(ack_data, "st", to_ack_status(success, message_type))) goto cleanup;
+        ack_write(w, run_start, (size_t) (p - run_start));
+        run_start = p + 1;
+        char esc[6] = {'\\', 0, '0', '0', 0, 0};
+        size_t esc_len = 2;
+        switch (c) {
+            case '\\':
+            case '\"':
+                esc[1] = (char) c;
+                break;
+            case '\b':
+                esc[1] = 'b';
+                break;
+            case '\f':
+                esc[1] = 'f';
+                break;
+            case '\n':
+                esc[1] = 'n';
+                break;
+            case '\r':
+                esc[1] = 'r';
+                break;
+            case '\t':
+                esc[1] = 't';
+                break;
+            default:
+                esc[1] = 'u';
+                esc[4] = HEX[c >> 4];
+                esc[5] = HEX[c & 0xF];
+                esc_len = 6;
+                break;
+        }
+        ack_write(w, esc, esc_len);
     }
+    ack_write(w, run_start, (size_t) (p - run_start));
+}
 
-    result = cJSON_PrintUnformatted(ack_json);
+static void render_device_part(AckWriter *w, const IotclConfig *config) {
+    ack_write_str(w, ",\"uniqueId\":\"");
+    ack_write_escaped(w, config->device.duid);
+    ack_write_str(w, "\",\"cpId\":\"");
+    ack_write_escaped(w, config->device.cpid);
+    ack_write_str(w, "\",\"sdk\":{\"l\":\"" CONFIG_IOTCONNECT_SDK_NAME "\",\"v\":\"" CONFIG_IOTCONNECT_SDK_VERSION "\",\"e\":\"");
+    ack_write_escaped(w, config->device.env);
+    ack_write_str(w, "\"},\"d\":{\"ackId\":\"");
+}
 
-    // fall through
-    cleanup:
-    cJSON_Delete(ack_json);
+bool iotcl_event_init(IotclContext ctx) {
+    IotclConfig *config = iotcl_context_get_config(ctx);
+    AckWriter w = {NULL, 0, 0, false};
+    if (!config) {
+        return false;
+    }
+    iotcl_event_deinit(ctx);
+    render_device_part(&w, config);
+    ctx->ack_device_part = (char *) iotcl_mem_malloc(IOTCL_MEM_EVENTS, w.len + 1);
+    if (!ctx->ack_device_part) {
+        return false;
+    }
+    w.buffer = ctx->ack_device_part;
+    w.size = w.len + 1;
+    w.len = 0;
+    render_device_part(&w, config);
+    ctx->ack_device_part[w.len] = 0;
+    ctx->ack_device_part_len = w.len;
+    return true;
+}
+
+void iotcl_event_deinit(IotclContext ctx) {
+    iotcl_mem_free(ctx->ack_device_part);
+    ctx->ack_device_part = NULL;
+    ctx->ack_device_part_len = 0;
+}
+
+static void render_ack(
+        IotclContext ctx,
+        AckWriter *w,
+        bool success,
+        const char *message,
+        IotConnectEventType message_type,
+        const char *ack_id) {
+    // message type 5 in response is the command response. Type 11 is OTA response.
+    ack_write_str(w, message_type == DEVICE_COMMAND ? "{\"mt\":5,\"t\":\"" : "{\"mt\":11,\"t\":\"");
+    char time[IOTCL_ISO_TIMESTAMP_SIZE];
+    ack_write(w, time, iotcl_iso_timestamp_now_into(time));
+    ack_write(w, "\"", 1);
+    ack_write(w, ctx->ack_device_part, ctx->ack_device_part_len);
+    ack_write_escaped(w, ack_id);
+    ack_write_str(w, "\",\"msg\":\"");
+    ack_write_escaped(w, message ? message : "");
+    ack_write_str(w, "\",\"st\":");
+    char status[2] = {(char) ('0' + to_ack_status(success, message_type)), 0};
+    ack_write(w, status, 1);
+    ack_write(w, "}}", 2);
+}
+
+static size_t create_ack_into(
+        IotclContext ctx,
+        char *buffer,
+        size_t buffer_size,
+        bool success,
+        const char *message,
+        IotConnectEventType message_type,
+        const char *ack_id) {
+    AckWriter w = {buffer, buffer_size, 0, false};
+    if (!buffer || !ack_id || !ctx || !ctx->ack_device_part || 0 == buffer_size) {
+        return 0;
+    }
+    render_ack(ctx, &w, success, message, message_type, ack_id);
+    if (w.overflow) {
+        buffer[0] = 0;
+        return 0;
+    }
+    buffer[w.len] = 0;
+    return w.len;
+}
+
+static char *create_ack(
+        IotclContext ctx,
+        bool success,
+        const char *message,
+        IotConnectEventType message_type,
+        const char *ack_id) {
+    AckWriter w = {NULL, 0, 0, false};
+    if (!ack_id || !ctx || !ctx->ack_device_part) {
+        return NULL;
+    }
+    render_ack(ctx, &w, success, message, message_type, ack_id);
+    // the application frees the ack, so it is not tracked
+    char *result = (char *) malloc(w.len + 1);
+    if (!result) {
+        return NULL;
+    }
+    if (0 == create_ack_into(ctx, result, w.len + 1, success, message, message_type, ack_id)) {
+        free(result);
+        return NULL;
+    }
     return result;
 }
 
+size_t iotcl_create_ack_into(
+        char *buffer,
+        size_t buffer_size,
+        IotclEventData data,
+        bool success,
+        const char *message
+) {
+    if (!data) return 0;
+    return create_ack_into(data->ctx, buffer, buffer_size, success, message, data->type, data->ack_id);
+}
+
+size_t iotcl_create_ota_ack_into(
+        char *buffer,
+        size_t buffer_size,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+) {
+    return create_ack_into(iotcl_get_default_context(), buffer, buffer_size, success, message, DEVICE_OTA, ota_ack_id);
+}
+
+size_t iotcl_create_ota_ack_into_ctx(
+        IotclContext ctx,
+        char *buffer,
+        size_t buffer_size,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+) {
+    return create_ack_into(ctx, buffer, buffer_size, success, message, DEVICE_OTA, ota_ack_id);
+}
+
 char *iotcl_create_ack_string_and_destroy_event(
         IotclEventData data,
         bool success,
         const char *message
 ) {
     if (!data) return NULL;
-    // alrwady checked that ack ID is valid in the messages
-    char *ack_id = cJSON_GetObjectItemCaseSensitive(data->data, "ackId")->valuestring;
-    char *ret = create_ack(success, message, data->type, ack_id);
+    // already checked that ack ID is valid in the messages
+    char *ret = create_ack(data->ctx, success, message, data->type, data->ack_id);
     iotcl_destroy_event(data);
     return ret;
 }
@@ -285,12 +813,21 @@ char *iotcl_create_ota_ack_response(
         bool success,
         const char *message
 ) {
-    char *ret = create_ack(success, message, DEVICE_OTA, ota_ack_id);
+    char *ret = create_ack(iotcl_get_default_context(), success, message, DEVICE_OTA, ota_ack_id);
     return ret;
 }
 
+char *iotcl_create_ota_ack_response_ctx(
+        IotclContext ctx,
+        const char *ota_ack_id,
+        bool success,
+        const char *message
+) {
+    return create_ack(ctx, success, message, DEVICE_OTA, ota_ack_id);
+}
+
 void iotcl_destroy_event(IotclEventData data) {
-    cJSON_Delete(data->root);
-    free(data);
+    iotcl_mem_free((void *) data->more_urls);
+    iotcl_mem_free(data);
 }
 
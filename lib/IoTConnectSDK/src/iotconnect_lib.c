@@ -10,12 +10,32 @@
 
 #include "iotconnect_common.h"
 #include "iotconnect_lib.h"
+#include "iotconnect_arena.h"
+#include "iotconnect_log.h"
 
-static IotclConfig config;
-static bool config_is_valid = false;
+static struct IotclContextTag default_context;
+static unsigned int arena_hook_users = 0; // contexts that share the cJSON arena hooks
 
-bool iotcl_init(IotclConfig *c) {
-    iotcl_deinit();
+void iotcl_context_deinit(IotclContext ctx) {
+    if (!ctx) {
+        return;
+    }
+    if (ctx->uses_arena_hooks) {
+        arena_hook_users--;
+        if (0 == arena_hook_users) {
+            iotcl_arena_uninstall_hooks();
+        }
+    }
+    iotcl_telemetry_schema_deinit(ctx);
+    iotcl_event_deinit(ctx);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+bool iotcl_context_init(IotclContext ctx, IotclConfig *c) {
+    if (!ctx) {
+        return false;
+    }
+    iotcl_context_deinit(ctx);
     if (
             !c || !c->device.env || !c->device.cpid || !c->device.duid ||
             0 == strlen(c->device.env) || 0 == strlen(c->device.cpid) || 0 == strlen(c->device.duid)
@@ -27,28 +47,48 @@ bool iotcl_init(IotclConfig *c) {
         IOTCL_LOG ("IotConnectLib_Configure: combined name (cpid + uuid) exceeded maximum value" IOTCL_NL);
         return false;
     }
-    memcpy(&config, c, sizeof(config));
+    memcpy(&ctx->config, c, sizeof(ctx->config));
+    ctx->config_is_valid = true;
 
-    if (!config.device.duid || !config.device.cpid || !config.device.env) {
-        // allocation failure
+    if (!iotcl_telemetry_schema_init(ctx)) {
+        IOTCL_LOG ("IotConnectLib_Configure: invalid telemetry schema or malloc failure" IOTCL_NL);
+        iotcl_context_deinit(ctx);
+        return false;
+    }
+    if (!iotcl_event_init(ctx)) {
         IOTCL_LOG ("IotConnectLib_Configure: malloc failure" IOTCL_NL);
-        iotcl_deinit();
+        iotcl_context_deinit(ctx);
         return false;
     }
-    config_is_valid = true;
+    if (ctx->config.telemetry.arena_size) {
+        if (0 == arena_hook_users) {
+            iotcl_arena_install_hooks();
+        }
+        arena_hook_users++;
+        ctx->uses_arena_hooks = true;
+    }
     return true;
 }
 
+bool iotcl_init(IotclConfig *c) {
+    return iotcl_context_init(&default_context, c);
+}
 
 IotclConfig *iotcl_get_config() {
-    if (!config_is_valid) {
-        return NULL;
-    }
-    return &config;
+    return iotcl_context_get_config(&default_context);
 }
 
 void iotcl_deinit() {
-    config_is_valid = false;
+    iotcl_context_deinit(&default_context);
+}
 
-    memset(&config, 0, sizeof(config));
+IotclContext iotcl_get_default_context(void) {
+    return &default_context;
+}
+
+IotclConfig *iotcl_context_get_config(IotclContext ctx) {
+    if (!ctx || !ctx->config_is_valid) {
+        return NULL;
+    }
+    return &ctx->config;
 }
@@ -0,0 +1,149 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iotconnect_log.h"
+
+#define TRUNCATION_MARK "..."
+
+static void default_sink(int level, const char *line, size_t len, void *ctx) {
+    (void) level;
+    (void) len;
+    (void) ctx;
+    printf("%s\n", line);
+}
+
+static IotclLogSink sink = default_sink;
+static void *sink_ctx = NULL;
+static IotclLogStats stats;
+
+// Formats into the line buffer. Returns the length of the line.
+static size_t format_line(char *line, const char *format, va_list args) {
+    int len = vsnprintf(line, CONFIG_IOTCONNECT_LOG_LINE_MAX, format, args);
+    if (len < 0) {
+        line[0] = 0;
+        return 0;
+    }
+    if (len >= CONFIG_IOTCONNECT_LOG_LINE_MAX) {
+        const size_t mark_len = sizeof(TRUNCATION_MARK) - 1;
+        len = CONFIG_IOTCONNECT_LOG_LINE_MAX - 1;
+        memcpy(&line[len - mark_len], TRUNCATION_MARK, mark_len);
+        __atomic_fetch_add(&stats.truncated, 1, __ATOMIC_RELAXED);
+    }
+    return (size_t) len;
+}
+
+#if CONFIG_IOTCONNECT_LOG_QUEUE_SIZE > 0
+
+#if (CONFIG_IOTCONNECT_LOG_QUEUE_SIZE & (CONFIG_IOTCONNECT_LOG_QUEUE_SIZE - 1)) != 0
+#error "CONFIG_IOTCONNECT_LOG_QUEUE_SIZE must be a power of two"
+#endif
+
+#define QUEUE_MASK (CONFIG_IOTCONNECT_LOG_QUEUE_SIZE - 1)
+
+// Bounded queue where producers claim a slot by advancing enqueue_pos and publish it through the slot turn.
+// The turn is stored relative to the slot index so that the zeroed queue is ready to use:
+// the slot for position pos is free when its turn is base(pos) and holds a line when its turn is base(pos) + 1.
+#define BASE(pos) ((pos) & ~(unsigned int) QUEUE_MASK)
+
+typedef struct {
+    unsigned int turn;
+    unsigned char level;
+    unsigned short len;
+    char line[CONFIG_IOTCONNECT_LOG_LINE_MAX];
+} LogSlot;
+
+static LogSlot queue[CONFIG_IOTCONNECT_LOG_QUEUE_SIZE];
+static unsigned int enqueue_pos = 0;
+static unsigned int dequeue_pos = 0; // only accessed by the flushing task
+static unsigned long reported_drops = 0;
+
+static LogSlot *claim_slot(void) {
+    unsigned int pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        LogSlot *slot = &queue[pos & QUEUE_MASK];
+        int diff = (int) (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) - BASE(pos));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return slot;
+            } // else pos was updated by the failed exchange
+        } else if (diff < 0) {
+            return NULL; // full
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void iotcl_log(int level, const char *format, ...) {
+    LogSlot *slot = claim_slot();
+    if (!slot) {
+        __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    slot->len = (unsigned short) format_line(slot->line, format, args);
+    va_end(args);
+    slot->level = (unsigned char) level;
+    __atomic_store_n(&slot->turn, slot->turn + 1, __ATOMIC_RELEASE);
+}
+
+size_t iotcl_log_flush(size_t max_lines) {
+    size_t count = 0;
+    while (max_lines == 0 || count < max_lines) {
+        LogSlot *slot = &queue[dequeue_pos & QUEUE_MASK];
+        if (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) != BASE(dequeue_pos) + 1) {
+            break; // empty, or the line is still being formatted
+        }
+        sink(slot->level, slot->line, slot->len, sink_ctx);
+        __atomic_store_n(&slot->turn, BASE(dequeue_pos) + CONFIG_IOTCONNECT_LOG_QUEUE_SIZE, __ATOMIC_RELEASE);
+        dequeue_pos++;
+        count++;
+    }
+    stats.logged += count;
+    unsigned long dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+    if (dropped != reported_drops) {
+        char line[48];
+        int len = snprintf(line, sizeof(line), "(%lu log lines dropped)", dropped - reported_drops);
+        sink(IOTCL_LOG_LEVEL_WARN, line, (size_t) len, sink_ctx);
+        reported_drops = dropped;
+    }
+    return count;
+}
+
+#else
+
+void iotcl_log(int level, const char *format, ...) {
+    char line[CONFIG_IOTCONNECT_LOG_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    size_t len = format_line(line, format, args);
+    va_end(args);
+    sink(level, line, len, sink_ctx);
+    stats.logged++;
+}
+
+size_t iotcl_log_flush(size_t max_lines) {
+    (void) max_lines;
+    return 0;
+}
+
+#endif // CONFIG_IOTCONNECT_LOG_QUEUE_SIZE
+
+void iotcl_log_set_sink(IotclLogSink new_sink, void *ctx) {
+    sink = new_sink ? new_sink : default_sink;
+    sink_ctx = new_sink ? ctx : NULL;
+}
+
+void iotcl_log_get_stats(IotclLogStats *s) {
+    memcpy(s, &stats, sizeof(stats));
+}
@@ -0,0 +1,163 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "iotconnect_mem.h"
+
+static IotclMemStats stats;
+static IotclMemSubsystem selected = IOTCL_MEM_TELEMETRY;
+
+static const char *const subsystem_names[IOTCL_MEM_NUM_SUBSYSTEMS] = {
+        "telemetry",
+        "events",
+        "discovery",
+        "transport"
+};
+
+#if CONFIG_IOTCONNECT_MEM_STATS
+
+static void add(IotclMemUsage *u, size_t size) {
+    u->current_bytes += size;
+    if (u->current_bytes > u->peak_bytes) {
+        u->peak_bytes = u->current_bytes;
+    }
+    if (size > u->largest) {
+        u->largest = size;
+    }
+    u->allocs++;
+}
+
+static void count_alloc(IotclMemSubsystem subsystem, size_t size) {
+    add(&stats.total, size);
+    add(&stats.subsystems[subsystem], size);
+}
+
+static void count_free(IotclMemSubsystem subsystem, size_t size) {
+    stats.total.current_bytes -= size;
+    stats.subsystems[subsystem].current_bytes -= size;
+}
+
+// Precedes each allocation. Sized to keep the returned memory aligned for any type.
+typedef union {
+    struct {
+        size_t size;
+        unsigned char subsystem;
+    } h;
+    void *p;
+    double d;
+    long long ll;
+} MemHeader;
+
+static void *finish_alloc(IotclMemSubsystem subsystem, MemHeader *header, size_t size) {
+    if (!header) {
+        return NULL;
+    }
+    header->h.size = size;
+    header->h.subsystem = (unsigned char) subsystem;
+    count_alloc(subsystem, size);
+    return header + 1;
+}
+
+void *iotcl_mem_malloc(IotclMemSubsystem subsystem, size_t size) {
+    return finish_alloc(subsystem, (MemHeader *) malloc(sizeof(MemHeader) + size), size);
+}
+
+void *iotcl_mem_calloc(IotclMemSubsystem subsystem, size_t count, size_t size) {
+    if (size && count > ((size_t) -1 - sizeof(MemHeader)) / size) {
+        return NULL;
+    }
+    return finish_alloc(subsystem, (MemHeader *) calloc(1, sizeof(MemHeader) + count * size), count * size);
+}
+
+void *iotcl_mem_realloc(IotclMemSubsystem subsystem, void *pointer, size_t size) {
+    if (!pointer) {
+        return iotcl_mem_malloc(subsystem, size);
+    }
+    MemHeader *header = (MemHeader *) pointer - 1;
+    size_t old_size = header->h.size;
+    IotclMemSubsystem old_subsystem = (IotclMemSubsystem) header->h.subsystem;
+    header = (MemHeader *) realloc(header, sizeof(MemHeader) + size);
+    if (!header) {
+        return NULL; // the original allocation is still valid and counted
+    }
+    count_free(old_subsystem, old_size);
+    return finish_alloc(subsystem, header, size);
+}
+
+void iotcl_mem_free(void *pointer) {
+    if (!pointer) {
+        return;
+    }
+    MemHeader *header = (MemHeader *) pointer - 1;
+    count_free((IotclMemSubsystem) header->h.subsystem, header->h.size);
+    free(header);
+}
+
+char *iotcl_mem_strdup(IotclMemSubsystem subsystem, const char *str) {
+    if (!str) {
+        return NULL;
+    }
+    size_t size = strlen(str) + 1;
+    char *p = (char *) iotcl_mem_malloc(subsystem, size);
+    if (p != NULL) {
+        memcpy(p, str, size);
+    }
+    return p;
+}
+
+void iotcl_mem_track(IotclMemSubsystem subsystem, size_t size) {
+    count_alloc(subsystem, size);
+}
+
+void iotcl_mem_untrack(IotclMemSubsystem subsystem, size_t size) {
+    count_free(subsystem, size);
+}
+
+#else
+
+void iotcl_mem_track(IotclMemSubsystem subsystem, size_t size) {
+    (void) subsystem;
+    (void) size;
+}
+
+void iotcl_mem_untrack(IotclMemSubsystem subsystem, size_t size) {
+    (void) subsystem;
+    (void) size;
+}
+
+#endif // CONFIG_IOTCONNECT_MEM_STATS
+
+IotclMemSubsystem iotcl_mem_select(IotclMemSubsystem subsystem) {
+    IotclMemSubsystem previous = selected;
+    selected = subsystem;
+    return previous;
+}
+
+IotclMemSubsystem iotcl_mem_get_selected(void) {
+    return selected;
+}
+
+void iotcl_mem_get_stats(IotclMemStats *s) {
+    memcpy(s, &stats, sizeof(stats));
+}
+
+void iotcl_mem_reset_peaks(void) {
+    stats.total.peak_bytes = stats.total.current_bytes;
+    stats.total.largest = 0;
+    for (int i = 0; i < IOTCL_MEM_NUM_SUBSYSTEMS; i++) {
+        stats.subsystems[i].peak_bytes = stats.subsystems[i].current_bytes;
+        stats.subsystems[i].largest = 0;
+    }
+}
+
+const char *iotcl_mem_subsystem_name(IotclMemSubsystem subsystem) {
+    if ((int) subsystem < 0 || subsystem >= IOTCL_MEM_NUM_SUBSYSTEMS) {
+        return "unknown";
+    }
+    return subsystem_names[subsystem];
+}
@@ -0,0 +1,400 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+/*
+ * Fast number to JSON text conversion without printf/scanf.
+ * Integers are converted directly. Other values use the Grisu2 algorithm by Florian Loitsch
+ * ("Printing Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010),
+ * following the structure of the public domain implementation by Milo Yip and the one in nlohmann/json.
+ * The output always parses back to the same double and is the shortest representation for almost all values.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "iotconnect_common.h"
+
+// integral values below this are printed by the integer path. Matches the point where %g would switch to exponents.
+#define INTEGER_PATH_LIMIT 1e15
+
+// the decimal exponent range where numbers are printed without an exponent, same as "%1.15g"
+#define MIN_DECIMAL_EXP (-4)
+#define MAX_DECIMAL_EXP 15
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k;
+} CachedPower;
+
+// normalized 64-bit approximations of 10^k for k = -300, -292, ..., 324
+static const CachedPower CACHED_POWERS[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C,  -980, -276},
+    {0xD3515C2831559A83,  -954, -268},
+    {0x9D71AC8FADA6C9B5,  -927, -260},
+    {0xEA9C227723EE8BCB,  -901, -252},
+    {0xAECC49914078536D,  -874, -244},
+    {0x823C12795DB6CE57,  -847, -236},
+    {0xC21094364DFB5637,  -821, -228},
+    {0x9096EA6F3848984F,  -794, -220},
+    {0xD77485CB25823AC7,  -768, -212},
+    {0xA086CFCD97BF97F4,  -741, -204},
+    {0xEF340A98172AACE5,  -715, -196},
+    {0xB23867FB2A35B28E,  -688, -188},
+    {0x84C8D4DFD2C63F3B,  -661, -180},
+    {0xC5DD44271AD3CDBA,  -635, -172},
+    {0x936B9FCEBB25C996,  -608, -164},
+    {0xDBAC6C247D62A584,  -582, -156},
+    {0xA3AB66580D5FDAF6,  -555, -148},
+    {0xF3E2F893DEC3F126,  -529, -140},
+    {0xB5B5ADA8AAFF80B8,  -502, -132},
+    {0x87625F056C7C4A8B,  -475, -124},
+    {0xC9BCFF6034C13053,  -449, -116},
+    {0x964E858C91BA2655,  -422, -108},
+    {0xDFF9772470297EBD,  -396, -100},
+    {0xA6DFBD9FB8E5B88F,  -369,  -92},
+    {0xF8A95FCF88747D94,  -343,  -84},
+    {0xB94470938FA89BCF,  -316,  -76},
+    {0x8A08F0F8BF0F156B,  -289,  -68},
+    {0xCDB02555653131B6,  -263,  -60},
+    {0x993FE2C6D07B7FAC,  -236,  -52},
+    {0xE45C10C42A2B3B06,  -210,  -44},
+    {0xAA242499697392D3,  -183,  -36},
+    {0xFD87B5F28300CA0E,  -157,  -28},
+    {0xBCE5086492111AEB,  -130,  -20},
+    {0x8CBCCC096F5088CC,  -103,  -12},
+    {0xD1B71758E219652C,   -77,   -4},
+    {0x9C40000000000000,   -50,    4},
+    {0xE8D4A51000000000,   -24,   12},
+    {0xAD78EBC5AC620000,     3,   20},
+    {0x813F3978F8940984,    30,   28},
+    {0xC097CE7BC90715B3,    56,   36},
+    {0x8F7E32CE7BEA5C70,    83,   44},
+    {0xD5D238A4ABE98068,   109,   52},
+    {0x9F4F2726179A2245,   136,   60},
+    {0xED63A231D4C4FB27,   162,   68},
+    {0xB0DE65388CC8ADA8,   189,   76},
+    {0x83C7088E1AAB65DB,   216,   84},
+    {0xC45D1DF942711D9A,   242,   92},
+    {0x924D692CA61BE758,   269,  100},
+    {0xDA01EE641A708DEA,   295,  108},
+    {0xA26DA3999AEF774A,   322,  116},
+    {0xF209787BB47D6B85,   348,  124},
+    {0xB454E4A179DD1877,   375,  132},
+    {0x865B86925B9BC5C2,   402,  140},
+    {0xC83553C5C8965D3D,   428,  148},
+    {0x952AB45CFA97A0B3,   455,  156},
+    {0xDE469FBD99A05FE3,   481,  164},
+    {0xA59BC234DB398C25,   508,  172},
+    {0xF6C69A72A3989F5C,   534,  180},
+    {0xB7DCBF5354E9BECE,   561,  188},
+    {0x88FCF317F22241E2,   588,  196},
+    {0xCC20CE9BD35C78A5,   614,  204},
+    {0x98165AF37B2153DF,   641,  212},
+    {0xE2A0B5DC971F303A,   667,  220},
+    {0xA8D9D1535CE3B396,   694,  228},
+    {0xFB9B7CD9A4A7443C,   720,  236},
+    {0xBB764C4CA7A44410,   747,  244},
+    {0x8BAB8EEFB6409C1A,   774,  252},
+    {0xD01FEF10A657842C,   800,  260},
+    {0x9B10A4E5E9913129,   827,  268},
+    {0xE7109BFBA19C0C9D,   853,  276},
+    {0xAC2820D9623BF429,   880,  284},
+    {0x80444B5E7AA7CF85,   907,  292},
+    {0xBF21E44003ACDD2D,   933,  300},
+    {0x8E679C2F5E44FF8F,   960,  308},
+    {0xD433179D9C8CB841,   986,  316},
+    {0x9E19DB92B4E31BA9,  1013,  324}
+};
+
+#define CACHED_POWERS_MIN_DEC_EXP (-300)
+#define CACHED_POWERS_DEC_STEP 8
+
+// the target binary exponent range for the scaled boundaries
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+
+static DiyFp diyfp_sub(DiyFp x, DiyFp y) {
+    DiyFp r = {x.f - y.f, x.e};
+    return r;
+}
+
+// returns the rounded upper 64 bits of the 128-bit product
+static DiyFp diyfp_mul(DiyFp x, DiyFp y) {
+    const uint64_t u_lo = x.f & 0xFFFFFFFFu;
+    const uint64_t u_hi = x.f >> 32u;
+    const uint64_t v_lo = y.f & 0xFFFFFFFFu;
+    const uint64_t v_hi = y.f >> 32u;
+
+    const uint64_t p0 = u_lo * v_lo;
+    const uint64_t p1 = u_lo * v_hi;
+    const uint64_t p2 = u_hi * v_lo;
+    const uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32u) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+    q += (uint64_t) 1u << 31u; // round, ties up
+
+    DiyFp r = {p3 + (p2 >> 32u) + (p1 >> 32u) + (q >> 32u), x.e + y.e + 64};
+    return r;
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+    while ((x.f >> 63u) == 0) {
+        x.f <<= 1u;
+        x.e--;
+    }
+    return x;
+}
+
+static DiyFp diyfp_normalize_to(DiyFp x, int target_exponent) {
+    x.f <<= (unsigned) (x.e - target_exponent);
+    x.e = target_exponent;
+    return x;
+}
+
+// Computes the normalized value and its normalized boundaries m- and m+, which share the same exponent.
+static void compute_boundaries(double value, DiyFp *w, DiyFp *m_minus, DiyFp *m_plus) {
+    const uint64_t hidden_bit = (uint64_t) 1u << 52u;
+    const int bias = 1023 + 52;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t biased_e = bits >> 52u;
+    const uint64_t fraction = bits & (hidden_bit - 1u);
+
+    DiyFp v;
+    if (biased_e == 0) { // subnormal
+        v.f = fraction;
+        v.e = 1 - bias;
+    } else {
+        v.f = fraction + hidden_bit;
+        v.e = (int) biased_e - bias;
+    }
+
+    // the lower boundary is closer if the fraction is zero, except for the smallest normal number
+    const int lower_boundary_is_closer = (fraction == 0 && biased_e > 1);
+    DiyFp plus = {2 * v.f + 1, v.e - 1};
+    DiyFp minus;
+    if (lower_boundary_is_closer) {
+        minus.f = 4 * v.f - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = 2 * v.f - 1;
+        minus.e = v.e - 1;
+    }
+
+    *m_plus = diyfp_normalize(plus);
+    *m_minus = diyfp_normalize_to(minus, m_plus->e);
+    *w = diyfp_normalize(v);
+}
+
+// Returns a cached power c = f * 2^e = 10^k such that the product with a DiyFp of binary exponent e
+// has an exponent in [GRISU_ALPHA, GRISU_GAMMA]
+static CachedPower get_cached_power(int e) {
+    const int f = GRISU_ALPHA - e - 1;
+    const int k = (f * 78913) / (1 << 18) + (f > 0); // ceil(f * log10(2))
+    const int index = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) / CACHED_POWERS_DEC_STEP;
+    return CACHED_POWERS[index];
+}
+
+// Returns the number of decimal digits of n and sets pow10 to the largest power of ten <= n
+static int find_largest_pow10(uint32_t n, uint32_t *pow10) {
+    static const uint32_t POW10[] = {
+            1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+    };
+    int digits = 10;
+    while (digits > 1 && n < POW10[digits - 1]) {
+        digits--;
+    }
+    *pow10 = POW10[digits - 1];
+    return digits;
+}
+
+static void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    while (rest < dist
+           && delta - rest >= ten_k
+           && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buf[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+static void grisu2_digit_gen(char *buffer, int *length, int *decimal_exponent, DiyFp m_minus, DiyFp w, DiyFp m_plus) {
+    uint64_t delta = diyfp_sub(m_plus, m_minus).f;
+    uint64_t dist = diyfp_sub(m_plus, w).f;
+
+    const unsigned int one_e = (unsigned int) -m_plus.e;
+    const uint64_t one_f = (uint64_t) 1u << one_e;
+
+    uint32_t p1 = (uint32_t) (m_plus.f >> one_e); // integral part
+    uint64_t p2 = m_plus.f & (one_f - 1);         // fractional part
+
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, &pow10);
+    while (n > 0) {
+        const uint32_t d = p1 / pow10;
+        p1 %= pow10;
+        buffer[(*length)++] = (char) ('0' + d);
+        n--;
+
+        const uint64_t rest = ((uint64_t) p1 << one_e) + p2;
+        if (rest <= delta) {
+            *decimal_exponent += n;
+            grisu2_round(buffer, *length, dist, delta, rest, (uint64_t) pow10 << one_e);
+            return;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for (;;) {
+        p2 *= 10;
+        const uint64_t d = p2 >> one_e;
+        p2 &= one_f - 1;
+        buffer[(*length)++] = (char) ('0' + d);
+        m++;
+
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    *decimal_exponent -= m;
+    grisu2_round(buffer, *length, dist, delta, p2, one_f);
+}
+
+// Generates the shortest digits for a positive finite value such that value = digits * 10^decimal_exponent
+static int grisu2(char *digits, int *decimal_exponent, double value) {
+    DiyFp w, m_minus, m_plus;
+    compute_boundaries(value, &w, &m_minus, &m_plus);
+
+    const CachedPower cached = get_cached_power(m_plus.e);
+    const DiyFp c_minus_k = {cached.f, cached.e};
+
+    const DiyFp w_scaled = diyfp_mul(w, c_minus_k);
+    DiyFp w_minus = diyfp_mul(m_minus, c_minus_k);
+    DiyFp w_plus = diyfp_mul(m_plus, c_minus_k);
+
+    // shrink the interval by one unit to account for the rounding errors of the multiplication
+    w_minus.f += 1;
+    w_plus.f -= 1;
+
+    int length = 0;
+    *decimal_exponent = -cached.k;
+    grisu2_digit_gen(digits, &length, decimal_exponent, w_minus, w_scaled, w_plus);
+    return length;
+}
+
+static char *write_uint64(char *p, uint64_t n) {
+    char tmp[20];
+    int i = 0;
+    do {
+        tmp[i++] = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (i > 0) {
+        *p++ = tmp[--i];
+    }
+    return p;
+}
+
+// Places the decimal point or appends the exponent, in the same style as "%g"
+static char *format_digits(char *p, const char *digits, int length, int decimal_exponent) {
+    const int n = length + decimal_exponent; // position of the decimal point relative to the first digit
+
+    if (length <= n && n <= MAX_DECIMAL_EXP) {
+        // digits followed by zeros: 1234e3 -> 1234000
+        memcpy(p, digits, (size_t) length);
+        p += length;
+        memset(p, '0', (size_t) (n - length));
+        return p + (n - length);
+    }
+
+    if (0 < n && n <= MAX_DECIMAL_EXP) {
+        // dot inside the digits: 1234e-2 -> 12.34
+        memcpy(p, digits, (size_t) n);
+        p += n;
+        *p++ = '.';
+        memcpy(p, &digits[n], (size_t) (length - n));
+        return p + (length - n);
+    }
+
+    if (MIN_DECIMAL_EXP < n && n <= 0) {
+        // leading zeros: 1234e-6 -> 0.001234
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', (size_t) -n);
+        p += -n;
+        memcpy(p, digits, (size_t) length);
+        return p + length;
+    }
+
+    // exponent notation: 1234e-20 -> 1.234e-17
+    *p++ = digits[0];
+    if (length > 1) {
+        *p++ = '.';
+        memcpy(p, &digits[1], (size_t) (length - 1));
+        p += length - 1;
+    }
+    int e = n - 1;
+    *p++ = 'e';
+    if (e < 0) {
+        *p++ = '-';
+        e = -e;
+    } else {
+        *p++ = '+';
+    }
+    if (e < 10) {
+        *p++ = '0'; // at least two exponent digits, like printf
+    }
+    return write_uint64(p, (uint64_t) e);
+}
+
+size_t iotcl_format_number(char buffer[IOTCL_NUMBER_BUFFER_SIZE], double value) {
+    char *p = buffer;
+
+    if (isnan(value) || isinf(value)) {
+        memcpy(buffer, "null", sizeof("null"));
+        return sizeof("null") - 1;
+    }
+
+    if (signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    if (value < INTEGER_PATH_LIMIT && value == (double) (uint64_t) value) {
+        p = write_uint64(p, (uint64_t) value);
+    } else {
+        char digits[18];
+        int decimal_exponent;
+        const int length = grisu2(digits, &decimal_exponent, value);
+        p = format_digits(p, digits, length, decimal_exponent);
+    }
+    *p = 0;
+    return (size_t) (p - buffer);
+}
+
+double iotcl_round_to_decimals(double value, int decimals) {
+    static const double SCALE[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+    if (decimals < 0 || decimals >= (int) (sizeof(SCALE) / sizeof(SCALE[0]))) {
+        return value;
+    }
+    // values this large have no fractional digits left to round
+    if (isnan(value) || isinf(value) || fabs(value) >= INTEGER_PATH_LIMIT) {
+        return value;
+    }
+    return round(value * SCALE[decimals]) / SCALE[decimals];
+}
@@ -7,11 +7,14 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 
 #include "iotconnect_common.h"
 #include "iotconnect_lib.h"
 #include "iotconnect_telemetry.h"
+#include "iotconnect_arena.h"
+#include "iotconnect_mem.h"
 
 
 #include "cJSON.h"
@@ -23,59 +26,98 @@ struct IotclMessageHandleTag {
     cJSON *root_value;
     cJSON *telemetry_data_array;
     cJSON *current_telemetry_object; // an object inside the "d" array inside the "d" array of the root object
+    IotclArena arena; // holds this struct and the whole tree, if arena_size is configured. NULL otherwise.
+    const char *duid; // of the context that created the message
 };
 
-cJSON *json_object_dotset_locate(cJSON *search_object, char **leaf_name, const char *path) {
-    static const char *DELIM = ".";
-    char *mutable_path = iotcl_strdup(path);
-    char *token = strtok(mutable_path, DELIM);
-    *leaf_name = NULL;
-    if (NULL == token) {
-        // PANIC. Should not happen
-        free(mutable_path);
+// A precompiled dotted path. Segment strings are stored in the same allocation, after the pointer array.
+struct IotclTelemetryPathTag {
+    size_t num_parents;
+    const char *leaf;
+    const char *parents[]; // names of the nested objects, outermost first
+};
+
+// Returns the named child object of the parent, creating it if needed.
+// If constant_key is true, the name will be referenced by the new object rather than copied.
+static cJSON *locate_child_object(cJSON *parent, const char *name, bool constant_key) {
+    cJSON *child = cJSON_GetObjectItem(parent, name);
+    if (child) {
+        return child;
+    }
+    child = cJSON_CreateObject();
+    if (!child) {
         return NULL;
     }
-    cJSON *target_object = search_object;
-    do {
-        free(*leaf_name);
-        *leaf_name = iotcl_strdup(token);
-        if (!*leaf_name) {
-            goto cleanup;
-        }
-        char *last_token = *leaf_name;
-        token = strtok(NULL, DELIM);
-        if (NULL != token) {
-            // we have more and need to create the nested object
-            cJSON *parent_object;
-            if (cJSON_HasObjectItem(target_object, last_token)) {
-                parent_object = cJSON_GetObjectItem(target_object, last_token);
-            } else {
-                parent_object = cJSON_AddObjectToObject(target_object, last_token);
-
-                // NOTE: The user should clean up the search object if we return
-                // That should free all added objects, so this should be safe to do
-                if (!parent_object) goto cleanup;
-            }
-            target_object = parent_object;
-        }
-    } while (token != NULL);
+    // NOTE: The user should clean up the search object if we return NULL
+    // That should free all added objects, so this should be safe to do
+    if (!(constant_key ? cJSON_AddItemToObjectCS(parent, name, child) : cJSON_AddItemToObject(parent, name, child))) {
+        cJSON_Delete(child);
+        return NULL;
+    }
+    return child;
+}
 
-    free(mutable_path);
-    return target_object;
+// Finds the next dot separated token in the path, skipping empty tokens like strtok would.
+// Returns the token start and sets token_len, or returns NULL if there are no more tokens.
+static const char *next_path_token(const char *path, size_t *token_len) {
+    while (*path == '.') path++;
+    if (!*path) return NULL;
+    const char *dot = strchr(path, '.');
+    *token_len = dot ? (size_t) (dot - path) : strlen(path);
+    return path;
+}
 
-    cleanup:
-    free(mutable_path);
-    return NULL;
+// Walks the dotted path without any string copies on the heap and returns the object where the leaf value
+// needs to be set. Paths without dots are returned immediately as the leaf name.
+// leaf_buffer is only used if the leaf is not null-terminated in the path itself (trailing dots).
+static cJSON *json_object_dotset_locate(
+        cJSON *search_object,
+        const char **leaf_name,
+        char leaf_buffer[IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN + 1],
+        const char *path
+) {
+    *leaf_name = NULL;
+    if (!path) return NULL;
+    if (NULL == strchr(path, '.')) {
+        if (!*path) return NULL;
+        *leaf_name = path;
+        return search_object;
+    }
+
+    size_t token_len = 0;
+    const char *token = next_path_token(path, &token_len);
+    if (NULL == token) return NULL;
+
+    cJSON *target_object = search_object;
+    size_t next_len = 0;
+    const char *next;
+    while (NULL != (next = next_path_token(token + token_len, &next_len))) {
+        // we have more and need to locate or create the nested object
+        if (token_len > IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN) return NULL;
+        memcpy(leaf_buffer, token, token_len);
+        leaf_buffer[token_len] = 0;
+        target_object = locate_child_object(target_object, leaf_buffer, false);
+        if (!target_object) return NULL;
+        token = next;
+        token_len = next_len;
+    }
+    if (0 == token[token_len]) {
+        *leaf_name = token;
+    } else {
+        if (token_len > IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN) return NULL;
+        memcpy(leaf_buffer, token, token_len);
+        leaf_buffer[token_len] = 0;
+        *leaf_name = leaf_buffer;
+    }
+    return target_object;
 }
 
 static cJSON *setup_telemetry_object(IotclMessageHandle message) {
-    IotclConfig *config = iotcl_get_config();
-    if (!config) return NULL;
     if (!message) return NULL;
 
     cJSON *telemetry_object = cJSON_CreateObject();
     if (!telemetry_object) return NULL;
-    cJSON_AddStringToObject(telemetry_object, "id", config->device.duid);
+    cJSON_AddStringToObject(telemetry_object, "id", message->duid);
     cJSON_AddStringToObject(telemetry_object, "tg", "");
     cJSON *data_array = cJSON_AddArrayToObject(telemetry_object, "d");
     if (!data_array) goto cleanup_to;
@@ -102,15 +144,35 @@ static cJSON *setup_telemetry_object(IotclMessageHandle message) {
 }
 
 IotclMessageHandle iotcl_telemetry_create() {
+    return iotcl_telemetry_create_ctx(iotcl_get_default_context());
+}
+
+IotclMessageHandle iotcl_telemetry_create_ctx(IotclContext ctx) {
     cJSON *sdk_array = NULL;
-    IotclConfig *config = iotcl_get_config();
+    IotclConfig *config = iotcl_context_get_config(ctx);
     if (!config) return NULL;
     if (!config->telemetry.dtg) return NULL;
-    struct IotclMessageHandleTag *msg =
-            (struct IotclMessageHandleTag *) calloc(sizeof(struct IotclMessageHandleTag), 1);
-
-    if (!msg) return NULL;
+    struct IotclMessageHandleTag *msg;
+    IotclArena arena = NULL;
+    if (config->telemetry.arena_size) {
+        arena = iotcl_arena_create(config->telemetry.arena_size);
+        if (!arena) return NULL;
+        msg = (struct IotclMessageHandleTag *) iotcl_arena_alloc(arena, sizeof(struct IotclMessageHandleTag));
+        if (!msg) {
+            iotcl_arena_destroy(arena);
+            return NULL;
+        }
+        memset(msg, 0, sizeof(struct IotclMessageHandleTag));
+        msg->arena = arena;
+    } else {
+        msg = (struct IotclMessageHandleTag *) iotcl_mem_calloc(
+                IOTCL_MEM_TELEMETRY, 1, sizeof(struct IotclMessageHandleTag)
+        );
+        if (!msg) return NULL;
+    }
+    msg->duid = config->device.duid;
 
+    IotclArena previous = iotcl_arena_select(arena);
     msg->root_value = cJSON_CreateObject();
 
     if (!msg->root_value) goto cleanup;
@@ -120,25 +182,24 @@ IotclMessageHandle iotcl_telemetry_create() {
     if (!cJSON_AddNumberToObject(msg->root_value, "mt", 0)) goto cleanup; // telemetry message type (zero)
     sdk_array = cJSON_AddObjectToObject(msg->root_value, "sdk");
     if (!sdk_array) goto cleanup;
-    if (!cJSON_AddStringToObject(sdk_array, "l", CONFIG_IOTCONNECT_SDK_NAME)) goto cleanup_array;
-    if (!cJSON_AddStringToObject(sdk_array, "v", CONFIG_IOTCONNECT_SDK_VERSION)) goto cleanup_array;
-    if (!cJSON_AddStringToObject(sdk_array, "e", config->device.env)) goto cleanup_array;
+    if (!cJSON_AddStringToObject(sdk_array, "l", CONFIG_IOTCONNECT_SDK_NAME)) goto cleanup;
+    if (!cJSON_AddStringToObject(sdk_array, "v", CONFIG_IOTCONNECT_SDK_VERSION)) goto cleanup;
+    if (!cJSON_AddStringToObject(sdk_array, "e", config->device.env)) goto cleanup;
 
     msg->telemetry_data_array = cJSON_AddArrayToObject(msg->root_value, "d");
 
-    if (!msg->telemetry_data_array) goto cleanup_array;
+    if (!msg->telemetry_data_array) goto cleanup;
 
+    iotcl_arena_select(previous);
     return msg;
 
-    cleanup_array:
-    cJSON_free(sdk_array);
     cleanup:
-    cJSON_free(msg);
+    iotcl_arena_select(previous);
+    iotcl_telemetry_destroy(msg); // the sdk object is part of the root tree
     return NULL;
 }
 
-bool iotcl_telemetry_add_with_epoch_time(IotclMessageHandle message, time_t time) {
-    if (!message) return false;
+static bool add_with_epoch_time(IotclMessageHandle message, time_t time) {
     cJSON *telemetry_object = setup_telemetry_object(message);
     cJSON_AddNumberToObject(telemetry_object, "ts", time);
     if (!cJSON_HasObjectItem(message->root_value, "ts")) {
@@ -147,8 +208,7 @@ bool iotcl_telemetry_add_with_epoch_time(IotclMessageHandle message, time_t time
     return true;
 }
 
-bool iotcl_telemetry_add_with_iso_time(IotclMessageHandle message, const char *time) {
-    if (!message) return false;
+static bool add_with_iso_time(IotclMessageHandle message, const char *time) {
     cJSON *const telemetry_object = setup_telemetry_object(message);
     if (!telemetry_object) return false;
     if (!cJSON_AddStringToObject(telemetry_object, "dt", time)) return false;
@@ -158,88 +218,178 @@ bool iotcl_telemetry_add_with_iso_time(IotclMessageHandle message, const char *t
     return true;
 }
 
-bool iotcl_telemetry_set_number(IotclMessageHandle message, const char *path, double value) {
+bool iotcl_telemetry_add_with_epoch_time(IotclMessageHandle message, time_t time) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = add_with_epoch_time(message, time);
+    iotcl_arena_select(previous);
+    return ret;
+}
+
+bool iotcl_telemetry_add_with_iso_time(IotclMessageHandle message, const char *time) {
     if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = add_with_iso_time(message, time);
+    iotcl_arena_select(previous);
+    return ret;
+}
+
+// The arena of the message must be selected
+static bool ensure_current_telemetry_object(IotclMessageHandle message) {
     if (NULL == message->current_telemetry_object) {
-        if (!iotcl_telemetry_add_with_iso_time(message, iotcl_iso_timestamp_now())) return false;
+        char time[IOTCL_ISO_TIMESTAMP_SIZE];
+        iotcl_iso_timestamp_now_into(time);
+        if (!add_with_iso_time(message, time)) return false;
     }
-    char *leaf_name = NULL;
-    cJSON *target = json_object_dotset_locate(message->current_telemetry_object, &leaf_name, path);
-    if (!target) goto cleanup; // out of memory
-
-    if (!cJSON_AddNumberToObject(target, leaf_name, value)) goto cleanup_tgt;
-    free(leaf_name);
     return true;
+}
+
+// Takes ownership of the item. The item must be created with the arena of the message selected.
+static bool set_item(IotclMessageHandle message, const char *path, cJSON *item) {
+    if (!item) return false;
+    if (!message || !ensure_current_telemetry_object(message)) goto cleanup;
 
-    cleanup_tgt:
-    cJSON_free(target);
+    {
+        char leaf_buffer[IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN + 1];
+        const char *leaf_name = NULL;
+        cJSON *target = json_object_dotset_locate(message->current_telemetry_object, &leaf_name, leaf_buffer, path);
+        if (!target) goto cleanup; // out of memory or invalid path
+
+        if (!cJSON_AddItemToObject(target, leaf_name, item)) goto cleanup;
+    }
+    return true;
 
     cleanup:
-    free(leaf_name);
+    cJSON_Delete(item);
     return false;
 }
 
-bool iotcl_telemetry_set_bool(IotclMessageHandle message, const char *path, bool value) {
-    if (!message) return false;
-    if (NULL == message->current_telemetry_object) {
-        if (!iotcl_telemetry_add_with_iso_time(message, iotcl_iso_timestamp_now())) return false;
+// Takes ownership of the item. The item must be created with the arena of the message selected.
+// Keys are referenced from the path handle instead of being copied.
+static bool set_item_at(IotclMessageHandle message, IotclTelemetryPath path, cJSON *item) {
+    if (!item) return false;
+    if (!message || !path || !ensure_current_telemetry_object(message)) goto cleanup;
+
+    {
+        cJSON *target = message->current_telemetry_object;
+        for (size_t i = 0; i < path->num_parents; i++) {
+            target = locate_child_object(target, path->parents[i], true);
+            if (!target) goto cleanup;
+        }
+        if (!cJSON_AddItemToObjectCS(target, path->leaf, item)) goto cleanup;
     }
-    char *leaf_name = NULL;
-    cJSON *target = json_object_dotset_locate(message->current_telemetry_object, &leaf_name, path);
-    if (!target) goto cleanup; // out of memory
-
-    if (!cJSON_AddBoolToObject(target, leaf_name, value)) goto cleanup_tgt;
-    free(leaf_name);
     return true;
 
-    cleanup_tgt:
-    cJSON_free(target);
-
     cleanup:
-    free(leaf_name);
+    cJSON_Delete(item);
     return false;
 }
 
-bool iotcl_telemetry_set_string(IotclMessageHandle message, const char *path, const char *value) {
+bool iotcl_telemetry_set_number(IotclMessageHandle message, const char *path, double value) {
     if (!message) return false;
-    if (NULL == message->current_telemetry_object) {
-        iotcl_telemetry_add_with_iso_time(message, iotcl_iso_timestamp_now());
-    }
-    char *leaf_name = NULL;
-    cJSON *const target = json_object_dotset_locate(message->current_telemetry_object, &leaf_name, path);
-    if (!target) goto cleanup; // out of memory
-
-    if (!cJSON_AddStringToObject(target, leaf_name, value)) goto cleanup_tgt;
-    free(leaf_name);
-    return true;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item(message, path, cJSON_CreateNumber(value));
+    iotcl_arena_select(previous);
+    return ret;
+}
 
-    cleanup_tgt:
-    cJSON_free(target);
+bool iotcl_telemetry_set_bool(IotclMessageHandle message, const char *path, bool value) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item(message, path, cJSON_CreateBool(value));
+    iotcl_arena_select(previous);
+    return ret;
+}
 
-    cleanup:
-    free(leaf_name);
-    return false;
+bool iotcl_telemetry_set_string(IotclMessageHandle message, const char *path, const char *value) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item(message, path, cJSON_CreateString(value));
+    iotcl_arena_select(previous);
+    return ret;
 }
 
 bool iotcl_telemetry_set_null(IotclMessageHandle message, const char *path) {
     if (!message) return false;
-    if (NULL == message->current_telemetry_object) {
-        iotcl_telemetry_add_with_iso_time(message, iotcl_iso_timestamp_now());
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item(message, path, cJSON_CreateNull());
+    iotcl_arena_select(previous);
+    return ret;
+}
+
+IotclTelemetryPath iotcl_telemetry_path_create(const char *path) {
+    if (!path) return NULL;
+
+    size_t num_tokens = 0;
+    size_t strings_size = 0;
+    size_t token_len = 0;
+    const char *token = path;
+    while (NULL != (token = next_path_token(token, &token_len))) {
+        if (token_len > IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN) return NULL;
+        num_tokens++;
+        strings_size += token_len + 1;
+        token += token_len;
     }
-    char *leaf_name = NULL;
-    cJSON *const target = json_object_dotset_locate(message->current_telemetry_object, &leaf_name, path);
-    if (!target) goto cleanup; // out of memory
+    if (0 == num_tokens) return NULL;
+
+    const size_t header_size = sizeof(struct IotclTelemetryPathTag) + (num_tokens - 1) * sizeof(const char *);
+    struct IotclTelemetryPathTag *handle = (struct IotclTelemetryPathTag *) iotcl_mem_malloc(
+            IOTCL_MEM_TELEMETRY, header_size + strings_size
+    );
+    if (!handle) return NULL;
+
+    char *strings = (char *) handle + header_size;
+    handle->num_parents = num_tokens - 1;
+    size_t i = 0;
+    token = path;
+    while (NULL != (token = next_path_token(token, &token_len))) {
+        memcpy(strings, token, token_len);
+        strings[token_len] = 0;
+        if (i < handle->num_parents) {
+            handle->parents[i++] = strings;
+        } else {
+            handle->leaf = strings;
+        }
+        strings += token_len + 1;
+        token += token_len;
+    }
+    return handle;
+}
 
-    if (!cJSON_AddNullToObject(target, leaf_name)) goto cleanup_tgt;
-    free(leaf_name);
-    return true;
+void iotcl_telemetry_path_destroy(IotclTelemetryPath path) {
+    iotcl_mem_free(path);
+}
 
-    cleanup_tgt:
-    cJSON_free(target);
+bool iotcl_telemetry_set_number_at(IotclMessageHandle message, IotclTelemetryPath path, double value) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item_at(message, path, cJSON_CreateNumber(value));
+    iotcl_arena_select(previous);
+    return ret;
+}
 
-    cleanup:
-    free(leaf_name);
-    return false;
+bool iotcl_telemetry_set_bool_at(IotclMessageHandle message, IotclTelemetryPath path, bool value) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item_at(message, path, cJSON_CreateBool(value));
+    iotcl_arena_select(previous);
+    return ret;
+}
+
+bool iotcl_telemetry_set_string_at(IotclMessageHandle message, IotclTelemetryPath path, const char *value) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item_at(message, path, cJSON_CreateString(value));
+    iotcl_arena_select(previous);
+    return ret;
+}
+
+bool iotcl_telemetry_set_null_at(IotclMessageHandle message, IotclTelemetryPath path) {
+    if (!message) return false;
+    IotclArena previous = iotcl_arena_select(message->arena);
+    bool ret = set_item_at(message, path, cJSON_CreateNull());
+    iotcl_arena_select(previous);
+    return ret;
 }
 
 const char *iotcl_create_serialized_string(IotclMessageHandle message, bool pretty) {
@@ -256,9 +406,19 @@ void iotcl_destroy_serialized(const char *serialized_string) {
     cJSON_free((char *) serialized_string);
 }
 
+bool iotcl_telemetry_serialize_into(IotclMessageHandle message, char *buffer, size_t buffer_size, bool pretty) {
+    if (!message) return false;
+    if (!message->root_value) return false;
+    if (!buffer || buffer_size > INT_MAX) return false;
+    return cJSON_PrintPreallocated(message->root_value, buffer, (int) buffer_size, pretty);
+}
+
 void iotcl_telemetry_destroy(IotclMessageHandle message) {
-    if (message) {
-        cJSON_Delete(message->root_value);
+    if (!message) return;
+    if (message->arena) {
+        iotcl_arena_destroy(message->arena); // frees the whole tree and the message itself
+        return;
     }
-    free(message);
+    cJSON_Delete(message->root_value);
+    iotcl_mem_free(message);
 }
@@ -0,0 +1,541 @@
+/* Copyright (C) 2020 Avnet - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "iotconnect_common.h"
+#include "iotconnect_lib.h"
+#include "iotconnect_telemetry.h"
+#include "iotconnect_log.h"
+#include "iotconnect_mem.h"
+
+/////////////////////////////////////////////////////////
+// Streaming writer implementation.
+// The output must match what cJSON_PrintUnformatted would produce for the equivalent message handle.
+
+// If the writer buffer is NULL, the output length is only measured.
+static bool write_raw(IotclTelemetryWriter *w, const char *str, size_t len) {
+    if (w->overflow) return false;
+    if (!w->buffer) {
+        w->len += len;
+        return true;
+    }
+    // always keep one byte for the string terminator
+    if (w->len + len + 1 > w->size) {
+        w->overflow = true;
+        return false;
+    }
+    memcpy(&w->buffer[w->len], str, len);
+    w->len += len;
+    return true;
+}
+
+static bool write_str(IotclTelemetryWriter *w, const char *str) {
+    return write_raw(w, str, strlen(str));
+}
+
+// same escaping rules as cJSON print_string_ptr()
+static bool write_json_string(IotclTelemetryWriter *w, const char *str) {
+    static const char HEX[] = "0123456789abcdef";
+    if (!write_raw(w, "\"", 1)) return false;
+    if (!str) str = "";
+    const char *run_start = str;
+    const char *p;
+    for (p = str; *p; p++) {
+        const unsigned char c = (unsigned char) *p;
+        if (c > 31 && c != '\"' && c != '\\') {
+            continue;
+        }
+        if (!write_raw(w, run_start, (size_t) (p - run_start))) return false;
+        run_start = p + 1;
+        char esc[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t esc_len = 2;
+        switch (c) {
+            case '\\':
+                esc[1] = '\\';
+                break;
+            case '\"':
+                esc[1] = '\"';
+                break;
+            case '\b':
+                esc[1] = 'b';
+                break;
+            case '\f':
+                esc[1] = 'f';
+                break;
+            case '\n':
+                esc[1] = 'n';
+                break;
+            case '\r':
+                esc[1] = 'r';
+                break;
+            case '\t':
+                esc[1] = 't';
+                break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = HEX[c >> 4];
+                esc[5] = HEX[c & 0xF];
+                esc_len = 6;
+                break;
+        }
+        if (!write_raw(w, esc, esc_len)) return false;
+    }
+    if (!write_raw(w, run_start, (size_t) (p - run_start))) return false;
+    return write_raw(w, "\"", 1);
+}
+
+static bool write_number(IotclTelemetryWriter *w, double value) {
+    char number_buffer[IOTCL_NUMBER_BUFFER_SIZE];
+    size_t len = iotcl_format_number(number_buffer, value);
+    return write_raw(w, number_buffer, len);
+}
+
+static bool write_key(IotclTelemetryWriter *w, const char *name) {
+    if (w->need_comma) {
+        if (!write_raw(w, ",", 1)) return false;
+    }
+    if (!write_json_string(w, name)) return false;
+    return write_raw(w, ":", 1);
+}
+
+static bool close_data_set(IotclTelemetryWriter *w) {
+    if (!w->set_open) return true;
+    for (; w->depth > 0; w->depth--) {
+        if (!write_raw(w, "}", 1)) return false;
+    }
+    // close the values object and the "d" array of the data set
+    if (!write_raw(w, "}]", 2)) return false;
+    if (w->set_time_is_epoch) {
+        if (!write_str(w, ",\"ts\":")) return false;
+        if (!write_str(w, w->set_time)) return false;
+    } else {
+        if (!write_str(w, ",\"dt\":")) return false;
+        if (!write_json_string(w, w->set_time)) return false;
+    }
+    if (!write_raw(w, "}", 1)) return false;
+    w->set_open = false;
+    return true;
+}
+
+// Writes the message root up to and including the opening of the "d" array of data sets
+static bool write_message_header(IotclTelemetryWriter *w, const IotclConfig *config) {
+    if (!write_str(w, "{\"cpid\":")) return false;
+    if (!write_json_string(w, config->device.cpid)) return false;
+    if (!write_str(w, ",\"dtg\":")) return false;
+    if (!write_json_string(w, config->telemetry.dtg)) return false;
+    if (!write_str(w, ",\"mt\":0,\"sdk\":{\"l\":\"" CONFIG_IOTCONNECT_SDK_NAME "\",\"v\":\"" CONFIG_IOTCONNECT_SDK_VERSION "\",\"e\":")) {
+        return false;
+    }
+    if (!write_json_string(w, config->device.env)) return false;
+    return write_str(w, "},\"d\":[");
+}
+
+static bool open_data_set(IotclTelemetryWriter *w, const char *time, bool is_epoch) {
+    if (strlen(time) >= sizeof(w->set_time)) return false;
+
+    // first data set will have the buffer end with "d":[
+    const bool is_first = w->buffer[w->len - 1] == '[';
+    if (!close_data_set(w)) return false;
+    if (!is_first) {
+        if (!write_raw(w, ",", 1)) return false;
+    }
+    if (!write_str(w, "{\"id\":")) return false;
+    if (!write_json_string(w, w->duid)) return false;
+    if (!write_str(w, ",\"tg\":\"\",\"d\":[{")) return false;
+
+    strcpy(w->set_time, time);
+    w->set_time_is_epoch = is_epoch;
+    if (is_epoch) {
+        if (!w->root_epoch_time[0]) {
+            strcpy(w->root_epoch_time, time);
+            w->root_epoch_first = !w->root_iso_time[0];
+        }
+    } else if (!w->root_iso_time[0]) {
+        strcpy(w->root_iso_time, time);
+    }
+
+    w->set_open = true;
+    w->need_comma = false;
+    w->depth = 0;
+    return true;
+}
+
+// Kept out of ensure_data_set(), so that the time buffer is not set up on every call
+static bool open_data_set_now(IotclTelemetryWriter *w) {
+    char time[IOTCL_ISO_TIMESTAMP_SIZE];
+    iotcl_iso_timestamp_now_into(time);
+    return open_data_set(w, time, false);
+}
+
+static bool ensure_data_set(IotclTelemetryWriter *w) {
+    if (!w || !w->buffer || w->overflow) return false;
+    if (w->set_open) return true;
+    return open_data_set_now(w);
+}
+
+bool iotcl_telemetry_writer_init(IotclTelemetryWriter *writer, char *buffer, size_t buffer_size) {
+    return iotcl_telemetry_writer_init_ctx(iotcl_get_default_context(), writer, buffer, buffer_size);
+}
+
+bool iotcl_telemetry_writer_init_ctx(IotclContext ctx, IotclTelemetryWriter *writer, char *buffer, size_t buffer_size) {
+    if (!writer) return false;
+    memset(writer, 0, sizeof(IotclTelemetryWriter));
+    IotclConfig *config = iotcl_context_get_config(ctx);
+    if (!config) return false;
+    if (!config->telemetry.dtg) return false;
+    if (!buffer || 0 == buffer_size) return false;
+
+    writer->buffer = buffer;
+    writer->size = buffer_size;
+    writer->duid = config->device.duid;
+
+    return write_message_header(writer, config);
+}
+
+bool iotcl_telemetry_writer_add_with_iso_time(IotclTelemetryWriter *writer, const char *time) {
+    if (!writer || !writer->buffer || writer->overflow || !time) return false;
+    return open_data_set(writer, time, false);
+}
+
+bool iotcl_telemetry_writer_add_with_epoch_time(IotclTelemetryWriter *writer, time_t time) {
+    if (!writer || !writer->buffer || writer->overflow) return false;
+    char time_str[IOTCL_NUMBER_BUFFER_SIZE];
+    iotcl_format_number(time_str, (double) time);
+    return open_data_set(writer, time_str, true);
+}
+
+bool iotcl_telemetry_writer_set_number(IotclTelemetryWriter *writer, const char *name, double value) {
+    if (!ensure_data_set(writer)) return false;
+    if (!write_key(writer, name)) return false;
+    if (!write_number(writer, value)) return false;
+    writer->need_comma = true;
+    return true;
+}
+
+bool iotcl_telemetry_writer_set_string(IotclTelemetryWriter *writer, const char *name, const char *value) {
+    if (!ensure_data_set(writer)) return false;
+    if (!write_key(writer, name)) return false;
+    if (!write_json_string(writer, value)) return false;
+    writer->need_comma = true;
+    return true;
+}
+
+bool iotcl_telemetry_writer_set_bool(IotclTelemetryWriter *writer, const char *name, bool value) {
+    if (!ensure_data_set(writer)) return false;
+    if (!write_key(writer, name)) return false;
+    if (!write_str(writer, value ? "true" : "false")) return false;
+    writer->need_comma = true;
+    return true;
+}
+
+bool iotcl_telemetry_writer_set_null(IotclTelemetryWriter *writer, const char *name) {
+    if (!ensure_data_set(writer)) return false;
+    if (!write_key(writer, name)) return false;
+    if (!write_raw(writer, "null", 4)) return false;
+    writer->need_comma = true;
+    return true;
+}
+
+bool iotcl_telemetry_writer_begin_object(IotclTelemetryWriter *writer, const char *name) {
+    if (!ensure_data_set(writer)) return false;
+    if (!write_key(writer, name)) return false;
+    if (!write_raw(writer, "{", 1)) return false;
+    writer->depth++;
+    writer->need_comma = false;
+    return true;
+}
+
+bool iotcl_telemetry_writer_end_object(IotclTelemetryWriter *writer) {
+    if (!writer || !writer->set_open || writer->depth == 0) return false;
+    if (!write_raw(writer, "}", 1)) return false;
+    writer->depth--;
+    writer->need_comma = true;
+    return true;
+}
+
+size_t iotcl_telemetry_writer_finish(IotclTelemetryWriter *writer) {
+    if (!writer || !writer->buffer || writer->overflow) return 0;
+    if (!close_data_set(writer)) return 0;
+    if (!write_raw(writer, "]", 1)) return 0;
+
+    // cJSON adds "t" and "ts" to the root in the order in which the first data set of each type was added
+    for (int i = 0; i < 2; i++) {
+        const bool epoch_turn = (i == 0) == writer->root_epoch_first;
+        if (epoch_turn && writer->root_epoch_time[0]) {
+            if (!write_str(writer, ",\"ts\":")) return 0;
+            if (!write_str(writer, writer->root_epoch_time)) return 0;
+        } else if (!epoch_turn && writer->root_iso_time[0]) {
+            if (!write_str(writer, ",\"t\":")) return 0;
+            if (!write_json_string(writer, writer->root_iso_time)) return 0;
+        }
+    }
+    if (!write_raw(writer, "}", 1)) return 0;
+    writer->buffer[writer->len] = 0; // write_raw() always leaves room for this
+    return writer->len;
+}
+
+/////////////////////////////////////////////////////////
+// Fixed schema templates
+
+#define SCHEMA_MAX_DEPTH 8
+
+typedef struct {
+    size_t offset; // offset of the constant fragment preceding the value in the template text
+    size_t len;
+    IotclAttributeType type;
+    int decimals;
+} SchemaSlot;
+
+// Owned by the context. @see IotclContext
+typedef struct IotclSchemaTemplateTag {
+    char *text;         // all constant fragments back to back. The message header comes first.
+    size_t header_len;
+    SchemaSlot *slots;
+    size_t num_slots;
+    size_t dt_offset;   // closes all objects after the last value, up to the "dt" value
+    size_t dt_len;
+} SchemaTemplate;
+
+// Splits the dotted attribute name into tokens. Returns the number of tokens or zero if the name is invalid.
+static size_t split_attribute_name(const char *name, const char *tokens[], size_t token_lens[]) {
+    size_t count = 0;
+    if (!name) return 0;
+    while (*name) {
+        if (*name == '.') {
+            name++;
+            continue;
+        }
+        if (count >= SCHEMA_MAX_DEPTH) return 0;
+        const char *dot = strchr(name, '.');
+        tokens[count] = name;
+        token_lens[count] = dot ? (size_t) (dot - name) : strlen(name);
+        name += token_lens[count];
+        count++;
+    }
+    return count;
+}
+
+static bool write_json_token(IotclTelemetryWriter *w, const char *token, size_t len) {
+    char name[IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN + 1];
+    if (len > IOTCL_TELEMETRY_PATH_SEGMENT_MAX_LEN) {
+        w->overflow = true;
+        return false;
+    }
+    memcpy(name, token, len);
+    name[len] = 0;
+    return write_json_string(w, name);
+}
+
+static bool same_tokens(const char *a[], const size_t a_lens[], const char *b[], const size_t b_lens[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (a_lens[i] != b_lens[i] || 0 != memcmp(a[i], b[i], a_lens[i])) return false;
+    }
+    return true;
+}
+
+// Writes the template text and records the slot fragment offsets. When w has no buffer, only the size is measured.
+static bool write_schema_template(IotclTelemetryWriter *w, const IotclConfig *config, SchemaTemplate *t) {
+    const char *prev_tokens[SCHEMA_MAX_DEPTH];
+    size_t prev_lens[SCHEMA_MAX_DEPTH];
+    size_t prev_depth = 0; // number of open nested objects
+    const IotclTelemetryConfig *tc = &config->telemetry;
+    SchemaSlot *slots = t->slots;
+
+    if (!write_message_header(w, config)) return false;
+    if (!write_str(w, "{\"id\":")) return false;
+    if (!write_json_string(w, config->device.duid)) return false;
+    if (!write_str(w, ",\"tg\":\"\",\"d\":[{")) return false;
+
+    for (size_t i = 0; i < tc->schema_size; i++) {
+        const char *tokens[SCHEMA_MAX_DEPTH];
+        size_t lens[SCHEMA_MAX_DEPTH];
+        const IotclTelemetryAttribute *attr = &tc->schema[i];
+        const size_t num_tokens = split_attribute_name(attr->name, tokens, lens);
+        if (0 == num_tokens) return false;
+        if (attr->type != IOTCL_ATTR_NUMBER && attr->type != IOTCL_ATTR_STRING && attr->type != IOTCL_ATTR_BOOL) {
+            return false;
+        }
+        // a repeated name, or a value that is also used as an object, would produce a duplicate key
+        for (size_t j = 0; j < i; j++) {
+            const char *j_tokens[SCHEMA_MAX_DEPTH];
+            size_t j_lens[SCHEMA_MAX_DEPTH];
+            const size_t j_num_tokens = split_attribute_name(tc->schema[j].name, j_tokens, j_lens);
+            const size_t n = j_num_tokens < num_tokens ? j_num_tokens : num_tokens;
+            if (same_tokens(tokens, lens, j_tokens, j_lens, n)) {
+                IOTCL_LOG("Telemetry schema attribute %s conflicts with %s" IOTCL_NL, attr->name, tc->schema[j].name);
+                return false;
+            }
+        }
+        const size_t depth = num_tokens - 1;
+
+        size_t common = 0;
+        while (common < depth && common < prev_depth
+               && lens[common] == prev_lens[common] && 0 == memcmp(tokens[common], prev_tokens[common], lens[common])) {
+            common++;
+        }
+
+        slots[i].offset = w->len;
+        slots[i].type = attr->type;
+        slots[i].decimals = attr->decimals;
+        for (; prev_depth > common; prev_depth--) {
+            if (!write_raw(w, "}", 1)) return false;
+        }
+        if (i > 0) {
+            if (!write_raw(w, ",", 1)) return false;
+        }
+        for (size_t d = common; d < depth; d++) {
+            // an object that was closed already cannot be reopened, as that would produce a duplicate key
+            for (size_t j = 0; j + 1 < i; j++) {
+                const char *j_tokens[SCHEMA_MAX_DEPTH];
+                size_t j_lens[SCHEMA_MAX_DEPTH];
+                const size_t j_num_tokens = split_attribute_name(tc->schema[j].name, j_tokens, j_lens);
+                if (j_num_tokens > d + 1 && same_tokens(tokens, lens, j_tokens, j_lens, d + 1)) {
+                    IOTCL_LOG("Telemetry schema attributes of a nested object must be declared next to each other" IOTCL_NL);
+                    return false;
+                }
+            }
+            if (!write_json_token(w, tokens[d], lens[d])) return false;
+            if (!write_raw(w, ":{", 2)) return false;
+        }
+        if (!write_json_token(w, tokens[depth], lens[depth])) return false;
+        if (!write_raw(w, ":", 1)) return false;
+        slots[i].len = w->len - slots[i].offset;
+
+        memcpy(prev_tokens, tokens, sizeof(tokens));
+        memcpy(prev_lens, lens, sizeof(lens));
+        prev_depth = depth;
+    }
+
+    t->dt_offset = w->len;
+    for (; prev_depth > 0; prev_depth--) {
+        if (!write_raw(w, "}", 1)) return false;
+    }
+    if (!write_str(w, "}],\"dt\":")) return false;
+    t->dt_len = w->len - t->dt_offset;
+    return true;
+}
+
+static void free_schema_template(SchemaTemplate *t) {
+    if (t) {
+        iotcl_mem_free(t->text);
+        iotcl_mem_free(t->slots);
+        iotcl_mem_free(t);
+    }
+}
+
+bool iotcl_telemetry_schema_init(IotclContext ctx) {
+    IotclConfig *config = iotcl_context_get_config(ctx);
+    if (!config) return false;
+    iotcl_telemetry_schema_deinit(ctx);
+    if (!config->telemetry.schema || 0 == config->telemetry.schema_size) {
+        return true; // nothing to do
+    }
+    if (!config->telemetry.dtg) return false;
+
+    SchemaTemplate *t = (SchemaTemplate *) iotcl_mem_calloc(IOTCL_MEM_TELEMETRY, 1, sizeof(SchemaTemplate));
+    if (!t) return false;
+    t->slots = (SchemaSlot *) iotcl_mem_calloc(
+            IOTCL_MEM_TELEMETRY, config->telemetry.schema_size, sizeof(SchemaSlot)
+    );
+    if (!t->slots) goto cleanup;
+
+    IotclTelemetryWriter w;
+    memset(&w, 0, sizeof(w));
+    if (!write_schema_template(&w, config, t)) goto cleanup;
+
+    t->text = (char *) iotcl_mem_malloc(IOTCL_MEM_TELEMETRY, w.len + 1);
+    if (!t->text) goto cleanup;
+    memset(&w, 0, sizeof(w));
+    w.buffer = t->text;
+    w.size = t->dt_offset + t->dt_len + 1;
+    if (!write_schema_template(&w, config, t)) goto cleanup;
+    t->text[w.len] = 0;
+
+    t->header_len = t->slots[0].offset;
+    t->num_slots = config->telemetry.schema_size;
+    ctx->schema_template = t;
+    return true;
+
+    cleanup:
+    free_schema_template(t);
+    return false;
+}
+
+void iotcl_telemetry_schema_deinit(IotclContext ctx) {
+    free_schema_template(ctx->schema_template);
+    ctx->schema_template = NULL;
+}
+
+size_t iotcl_telemetry_render_schema(
+        const IotclTelemetryValue *values,
+        size_t num_values,
+        const char *time,
+        char *buffer,
+        size_t buffer_size
+) {
+    return iotcl_telemetry_render_schema_ctx(iotcl_get_default_context(), values, num_values, time, buffer, buffer_size);
+}
+
+size_t iotcl_telemetry_render_schema_ctx(
+        IotclContext ctx,
+        const IotclTelemetryValue *values,
+        size_t num_values,
+        const char *time,
+        char *buffer,
+        size_t buffer_size
+) {
+    const SchemaTemplate *t = ctx ? ctx->schema_template : NULL;
+    if (!t || !values || num_values != t->num_slots) return 0;
+    if (!buffer || 0 == buffer_size) return 0;
+    char now[IOTCL_ISO_TIMESTAMP_SIZE];
+    if (!time) {
+        iotcl_iso_timestamp_now_into(now);
+        time = now;
+    }
+
+    IotclTelemetryWriter w;
+    memset(&w, 0, sizeof(w));
+    w.buffer = buffer;
+    w.size = buffer_size;
+
+    write_raw(&w, t->text, t->header_len);
+    for (size_t i = 0; i < num_values; i++) {
+        const SchemaSlot *slot = &t->slots[i];
+        write_raw(&w, &t->text[slot->offset], slot->len);
+        if (values[i].is_null) {
+            write_raw(&w, "null", 4);
+            continue;
+        }
+        switch (slot->type) {
+            case IOTCL_ATTR_NUMBER:
+                if (slot->decimals > 0) {
+                    write_number(&w, iotcl_round_to_decimals(values[i].v.number, slot->decimals));
+                } else {
+                    write_number(&w, values[i].v.number);
+                }
+                break;
+            case IOTCL_ATTR_STRING:
+                write_json_string(&w, values[i].v.string);
+                break;
+            case IOTCL_ATTR_BOOL:
+                write_str(&w, values[i].v.boolean ? "true" : "false");
+                break;
+        }
+    }
+    write_raw(&w, &t->text[t->dt_offset], t->dt_len);
+    write_json_string(&w, time);
+    write_str(&w, "}],\"t\":");
+    write_json_string(&w, time);
+    if (!write_raw(&w, "}", 1)) return 0; // fails if any of the previous writes overflowed
+    buffer[w.len] = 0;
+    return w.len;
+}
@@ -59,32 +59,22 @@ static void on_connection_status(IotConnectConnectionStatus status) {
     }
 }
 
-static void command_status(IotclEventData data, bool status, const char *command_name, const char *message) {
-    const char *ack = iotcl_create_ack_string_and_destroy_event(data, status, message);
-    printf("command: %s status=%s: %s\n", command_name, status ? "OK" : "Failed", message);
-    printf("Sent CMD ack: %s\n", ack);
-    iotconnect_sdk_send_packet(ack);
-    free((void *) ack);
+// Command handlers. The SDK finds the handler by the first word of the command and sends the ack.
+static bool on_led_on(const IotcCommandArgs *args, const char **message, void *user_data) {
+    digitalWrite(LED, HIGH);
+    return true;
 }
 
-static void on_command(IotclEventData data) {
-    char *command = iotcl_clone_command(data);
-    if (NULL != command) {
-      if (0 == strcmp(command, "led-on")) {        
-        digitalWrite(LED, HIGH);
-        command_status(data, true, command, "Success");
-      } else if (0 == strcmp(command, "led-off")) {
-        digitalWrite(LED, LOW);
-        command_status(data, true, command, "Success");
-      } else  {
-        command_status(data, false, command, "Not implemented");
-      }
-      free((void *) command);
-    } else {
-        command_status(data, false, "?", "Internal error");
-    }
+static bool on_led_off(const IotcCommandArgs *args, const char **message, void *user_data) {
+    digitalWrite(LED, LOW);
+    return true;
 }
 
+static const IotcCommandRoute command_routes[] = {
+        {"led-on", on_led_on, NULL},
+        {"led-off", on_led_off, NULL},
+};
+
 static bool is_app_version_same_as_ota(const char *version) {
     return strcmp(APP_VERSION, version) == 0;
 }
@@ -131,29 +121,49 @@ static void on_ota(IotclEventData data) {
             free((void *) command);
         }
     }
-    const char *ack = iotcl_create_ack_string_and_destroy_event(data, success, message);
-    if (NULL != ack) {
+    char ack[256];
+    if (0 != iotcl_create_ack_into(ack, sizeof(ack), data, success, message)) {
+        iotcl_destroy_event(data);
         printf("Sent OTA ack: %s\n", ack);
-        iotconnect_sdk_send_packet(ack);
-        free((void *) ack);
+        iotconnect_sdk_send_packet_qos(ack, 1); // QoS 1 is sent once on Arduino, as PubSubClient does not report PUBACKs
+        return;
+    }
+    // large ack IDs or messages
+    char *large_ack = iotcl_create_ack_string_and_destroy_event(data, success, message);
+    if (large_ack) {
+        printf("Sent OTA ack: %s\n", large_ack);
+        iotconnect_sdk_send_packet_qos(large_ack, 1);
+        free(large_ack);
     }
 }
 
 static void publish_telemetry() {
-    IotclMessageHandle msg = iotcl_telemetry_create();
+    // The streaming writer serializes directly into the MQTT transmit buffer without any heap allocations or copies.
+    // The iotcl_telemetry_create() message handle API can be used instead if values need to be set out of order.
+    size_t size;
+    char *buffer = iotconnect_sdk_reserve_packet(&size);
+    if (!buffer) {
+        return;
+    }
+    IotclTelemetryWriter writer;
+    iotcl_telemetry_writer_init(&writer, buffer, size);
 
     // Optional. The first time you create a data point, the current timestamp will be automatically added
     // TelemetryAddWith* calls are only required if sending multiple data points in one packet.
-    iotcl_telemetry_add_with_iso_time(msg, iotcl_iso_timestamp_now());
-    iotcl_telemetry_set_string(msg, "version", APP_VERSION);
-    iotcl_telemetry_set_number(msg, "cpu", 3.123); // test floating point numbers
-    iotcl_telemetry_set_number(msg, "button", digitalRead(BUTTON));
+    char timestamp[IOTCL_ISO_TIMESTAMP_SIZE];
+    iotconnect_sdk_timestamp(timestamp);
+    iotcl_telemetry_writer_add_with_iso_time(&writer, timestamp);
+    iotcl_telemetry_writer_set_string(&writer, "version", APP_VERSION);
+    iotcl_telemetry_writer_set_number(&writer, "cpu", 3.123); // test floating point numbers
+    iotcl_telemetry_writer_set_number(&writer, "button", digitalRead(BUTTON));
 
-    const char *str = iotcl_create_serialized_string(msg, false);
-    iotcl_telemetry_destroy(msg);
-    printf("Sending: %s\n", str);
-    iotconnect_sdk_send_packet(str); // underlying code will report an error
-    iotcl_destroy_serialized(str);
+    size_t len = iotcl_telemetry_writer_finish(&writer);
+    if (0 == len) {
+        printf("Telemetry message does not fit into the buffer!\n");
+        return;
+    }
+    printf("Sending: %s\n", buffer);
+    iotconnect_sdk_commit_packet(len); // underlying code will report an error
 }
 void demo_setup()
 {
@@ -197,7 +207,8 @@ void demo_setup()
   config->net = &net;
   config->ota_cb = on_ota;
   config->status_cb = on_connection_status;
-  config->cmd_cb = on_command;
+  config->command_routes = command_routes;
+  config->num_command_routes = sizeof(command_routes) / sizeof(command_routes[0]);
 
   if (config->auth_info.type == IOTC_AT_X509) {
     config->auth_info.data.cert_info.device_cert = (char*) IOTCONNECT_DEVICE_CERT;
@@ -219,16 +230,18 @@ void demo_setup()
     if (ret == 0) {
       digitalWrite(LED, HIGH); // set the LED on while we are connected. Override with commands
       for (int i = 0; i < 20; i++) {
-        if (!iotconnect_sdk_is_connected()) {
-          // not connected, but mqtt should try to reconnect
+        if (iotconnect_sdk_get_connection_state() == IOTC_CONN_STATE_IDLE) {
+          // disconnected by the cloud (for example, on a force sync). The SDK needs to be initialized again.
           break;
-        } else {
+        }
+        // while the connection is down, the SDK keeps reconnecting in the background from iotconnect_sdk_loop()
+        if (iotconnect_sdk_is_connected()) {
           publish_telemetry();
         }
         // loop for 5 seconds, checking the button state for changes every 100 ms.
         for (int j = 0; j < 50; j++) {
           iotconnect_sdk_loop();
-          if (button_state_changed()) {
+          if (button_state_changed() && iotconnect_sdk_is_connected()) {
             publish_telemetry(); // publish as soon as we detect that button state changed
           }
           delay(100);